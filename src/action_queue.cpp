@@ -0,0 +1,131 @@
+#include "sptf.h"
+#include "action_queue.h"
+
+/*
+ * Coalescing command queue (network task only)
+ *
+ * A command is merged with the last queued one whenever possible:
+ * - Next/Previous add up into a single skip count, opposite skips cancel out
+ * - Two Toggle cancel out
+ * - GetToken is only queued once
+ * Commands of different kinds keep their order.
+ */
+
+
+/**
+ * Queue a command, merging it with the previous one if possible
+ *
+ * @param q
+ * @param action
+ * @return false if queue is full
+ */
+bool actionQueuePush(ACTION_queue_t *q, uint8_t action) {
+    SPTF_action_t *tail = q->len ? &q->items[q->len - 1] : nullptr;
+    int8_t count = 0;
+
+    switch (action) {
+        case Next:
+        case Previous:
+            count = action == Next ? 1 : -1;
+            if (tail && tail->action == Next && tail->count + count > INT8_MIN && tail->count + count < INT8_MAX) {
+                tail->count += count;
+                q->merged++;
+                if (tail->count == 0) {
+                    q->len--;
+                }
+                return true;
+            }
+            action = Next;
+            break;
+
+        case Toggle:
+            if (tail && tail->action == Toggle) {
+                q->len--;
+                q->merged++;
+                return true;
+            }
+            break;
+
+        case GetToken:
+            for (uint8_t i = 0; i < q->len; i++) {
+                if (q->items[i].action == GetToken) {
+                    q->merged++;
+                    return true;
+                }
+            }
+            break;
+
+        default:
+            if (tail && tail->action == action) {
+                q->merged++;
+                return true;
+            }
+    }
+
+    if (q->len >= ACTION_QUEUE_SIZE) {
+        q->dropped++;
+        return false;
+    }
+
+    SPTF_action_t &item = q->items[q->len++];
+    item.action = action;
+    item.count = count;
+    return true;
+}
+
+
+/**
+ * Get next command to run
+ *
+ * @param q
+ * @param action    nullptr to discard it
+ * @return false if queue is empty
+ */
+bool actionQueuePop(ACTION_queue_t *q, SPTF_action_t *action) {
+    if (!q->len) {
+        return false;
+    }
+    if (action) {
+        *action = q->items[0];
+    }
+    q->len--;
+    memmove(&q->items[0], &q->items[1], q->len * sizeof(SPTF_action_t));
+    return true;
+}
+
+
+/**
+ * Put a command back at the front of the queue, e.g. the rest of a skip
+ * that could not be sent yet; merged with the first one if possible
+ *
+ * @param q
+ * @param action
+ * @return false if queue is full
+ */
+bool actionQueueRequeue(ACTION_queue_t *q, const SPTF_action_t &action) {
+    if (q->len && action.action == Next && q->items[0].action == Next
+        && q->items[0].count + action.count > INT8_MIN && q->items[0].count + action.count < INT8_MAX) {
+        q->items[0].count += action.count;
+        q->merged++;
+        if (q->items[0].count == 0) {
+            actionQueuePop(q, nullptr);
+        }
+        return true;
+    }
+
+    if (q->len && action.action == Toggle && q->items[0].action == Toggle) {
+        actionQueuePop(q, nullptr);
+        q->merged++;
+        return true;
+    }
+
+    if (q->len >= ACTION_QUEUE_SIZE) {
+        q->dropped++;
+        return false;
+    }
+
+    memmove(&q->items[1], &q->items[0], q->len * sizeof(SPTF_action_t));
+    q->items[0] = action;
+    q->len++;
+    return true;
+}
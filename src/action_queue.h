@@ -0,0 +1,34 @@
+#ifndef M5SPOT_ACTION_QUEUE_H
+#define M5SPOT_ACTION_QUEUE_H
+
+#include <stdint.h>
+
+#define ACTION_QUEUE_SIZE 8
+
+/*
+ * Pending Spotify command; for skips, count is the number of tracks
+ * to skip (negative to go backwards)
+ */
+typedef struct {
+    uint8_t action;
+    int8_t count;
+} SPTF_action_t;
+
+typedef struct {
+    SPTF_action_t items[ACTION_QUEUE_SIZE];
+    uint8_t len;
+    uint32_t merged;
+    uint32_t dropped;
+} ACTION_queue_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool actionQueuePush(ACTION_queue_t *q, uint8_t action);
+bool actionQueuePop(ACTION_queue_t *q, SPTF_action_t *action);
+bool actionQueueRequeue(ACTION_queue_t *q, const SPTF_action_t &action);
+//@formatter:on
+
+#endif // M5SPOT_ACTION_QUEUE_H
@@ -0,0 +1,123 @@
+#include <string.h>
+#include "arena.h"
+
+static uint8_t buff[ARENA_SIZE] __attribute__ ((aligned (ARENA_ALIGN)));
+static uint32_t last = 0;     // Offset of the last allocation, which can grow in place
+static ARENA_stats_t stats = {0, 0, 0, 0};
+
+
+/**
+ * Free everything allocated since last reset
+ */
+void arenaReset() {
+    stats.used = 0;
+    stats.resets++;
+    last = 0;
+}
+
+
+/**
+ * Get the current position
+ *
+ * @return Mark for arenaRewind()
+ */
+uint32_t arenaMark() {
+    return stats.used;
+}
+
+
+/**
+ * Free everything allocated since a mark
+ *
+ * @param mark  From arenaMark()
+ */
+void arenaRewind(uint32_t mark) {
+    if (mark >= stats.used) {
+        return;
+    }
+    stats.used = mark;
+    if (last >= mark) {
+        // Freed, the one before can't be known: no growing until next allocation
+        last = ARENA_SIZE;
+    }
+}
+
+
+/**
+ * Allocate a block
+ *
+ * @param size
+ * @return nullptr if the arena is full
+ */
+void *arenaAlloc(size_t size) {
+    uint32_t start = (stats.used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (start + size > ARENA_SIZE) {
+        stats.overflows++;
+        return nullptr;
+    }
+
+    last = start;
+    stats.used = start + size;
+    if (stats.used > stats.high_water) {
+        stats.high_water = stats.used;
+    }
+    return &buff[start];
+}
+
+
+/**
+ * Bytes left for the next allocation
+ *
+ * @return
+ */
+size_t arenaAvailable() {
+    uint32_t start = (stats.used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    return start < ARENA_SIZE ? ARENA_SIZE - start : 0;
+}
+
+
+/**
+ * Resize the last allocated block in place
+ *
+ * @param ptr
+ * @param size  New size
+ * @return false if ptr is not the last block, or if size does not fit
+ */
+bool arenaGrow(void *ptr, size_t size) {
+    if (ptr != &buff[last] || last + size > ARENA_SIZE) {
+        stats.overflows++;
+        return false;
+    }
+
+    stats.used = last + size;
+    if (stats.used > stats.high_water) {
+        stats.high_water = stats.used;
+    }
+    return true;
+}
+
+
+/**
+ * Copy a string
+ *
+ * @param str
+ * @return nullptr if the arena is full
+ */
+char *arenaStrdup(const char *str) {
+    size_t len = strlen(str);
+    char *copy = (char *) arenaAlloc(len + 1);
+    if (copy) {
+        memcpy(copy, str, len + 1);
+    }
+    return copy;
+}
+
+
+/**
+ * Get usage counters
+ *
+ * @return
+ */
+const ARENA_stats_t &arenaStats() {
+    return stats;
+}
@@ -0,0 +1,41 @@
+#ifndef M5SPOT_ARENA_H
+#define M5SPOT_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Per-cycle arena (network task only)
+ *
+ * A static bump allocator for the buffers of one request/parse/render
+ * cycle: error payloads, token copies, event messages. Reset at the start
+ * of each network loop, so polling does not touch the general heap; loops
+ * making several requests rewind it to a mark in between.
+ */
+
+#define ARENA_SIZE 4096
+#define ARENA_ALIGN 4
+
+typedef struct {
+    uint32_t used;
+    uint32_t high_water;    // Max used in a cycle
+    uint32_t overflows;     // Allocations refused (or truncated)
+    uint32_t resets;
+} ARENA_stats_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void arenaReset();
+uint32_t arenaMark();
+void arenaRewind(uint32_t mark);
+void *arenaAlloc(size_t size);
+size_t arenaAvailable();
+bool arenaGrow(void *ptr, size_t size);
+char *arenaStrdup(const char *str);
+const ARENA_stats_t &arenaStats();
+//@formatter:on
+
+#endif // M5SPOT_ARENA_H
@@ -0,0 +1,483 @@
+#include <Arduino.h>
+#include "hal/hal.h"
+#include "art_cache.h"
+#include "sptf.h"
+
+/*
+ * Album art cache
+ *
+ * Album art is stored on SD as it appears on screen, i.e. raw RGB565 pixels
+ * read back from the LCD once the JPEG has been decoded. Displaying a cached
+ * album art is then a plain blit, without any download nor JPEG decoding.
+ * The index keeps keys, sizes and a use counter for LRU eviction. Cache hits
+ * only update it in memory, it is written to SD along with the next change.
+ *
+ * Album art can also be written while it is decoded off screen (prefetch on
+ * boards without PSRAM for a full size canvas): the decoder draws into a
+ * strip of ART_CACHE_STRIP_ROWS rows, and rows are written to SD once done.
+ */
+
+static ART_cache_entry_t entries[ART_CACHE_MAX_ENTRIES];
+static uint32_t use_counter = 0;
+static bool cache_ready = false;
+
+
+/**
+ * Get blob filename for a key
+ *
+ * @param key
+ * @param path
+ * @param size
+ */
+static void blobPath(const char *key, char *path, size_t size) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = key; *c; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619u;
+    }
+    snprintf(path, size, ART_CACHE_DIR "/%08x.565", hash);
+}
+
+
+/**
+ * Write index to SD
+ */
+static void saveIndex() {
+    HalFile *file = halStorage()->open(ART_CACHE_INDEX, hal_write);
+    if (!file) {
+        return;
+    }
+    file->write((uint8_t *) entries, sizeof(entries));
+    delete file;
+}
+
+
+/**
+ * Find key in index
+ *
+ * @param key
+ * @return Entry, or nullptr
+ */
+static ART_cache_entry_t *findEntry(const char *key) {
+    for (auto &e : entries) {
+        if (e.key[0] != '\0' && strcmp(e.key, key) == 0) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * Remove an entry and its blob
+ *
+ * @param e
+ */
+static void evictEntry(ART_cache_entry_t *e) {
+    char path[32];
+    blobPath(e->key, path, sizeof(path));
+    halStorage()->remove(path);
+    memset(e, 0, sizeof(ART_cache_entry_t));
+}
+
+
+/**
+ * Get a free index entry, evicting least recently used ones
+ * until size bytes fit within the cache budget
+ *
+ * @param size
+ * @return
+ */
+static ART_cache_entry_t *allocEntry(uint32_t size) {
+    while (true) {
+        uint32_t total = 0;
+        ART_cache_entry_t *unused = nullptr;
+        ART_cache_entry_t *lru = nullptr;
+
+        for (auto &e : entries) {
+            if (e.key[0] == '\0') {
+                unused = unused ? unused : &e;
+                continue;
+            }
+            total += e.size;
+            if (!lru || e.last_used < lru->last_used) {
+                lru = &e;
+            }
+        }
+
+        if (unused && total + size <= ART_CACHE_MAX_BYTES) {
+            return unused;
+        }
+        if (!lru) {
+            return nullptr;
+        }
+        evictEntry(lru);
+    }
+}
+
+
+/**
+ * Load cache index from SD
+ *
+ * @return false if no SD card is available
+ */
+bool artCacheBegin() {
+    cache_ready = false;
+    memset(entries, 0, sizeof(entries));
+
+    HalStorage *storage = halStorage();
+    if (!storage->ready()) {
+        return false;
+    }
+
+    if (!storage->exists(ART_CACHE_DIR)) {
+        storage->mkdir(ART_CACHE_DIR);
+    }
+
+    HalFile *file = storage->open(ART_CACHE_INDEX, hal_read);
+    if (file) {
+        if (file->size() == sizeof(entries)) {
+            file->read((uint8_t *) entries, sizeof(entries));
+        }
+        delete file;
+    }
+
+    for (auto &e : entries) {
+        e.key[sizeof(e.key) - 1] = '\0';
+        if (e.last_used > use_counter) {
+            use_counter = e.last_used;
+        }
+    }
+
+    cache_ready = true;
+    return true;
+}
+
+
+/**
+ * Check whether album art is cached
+ *
+ * @param key   Album ID or image URL
+ * @return
+ */
+bool artCacheHas(const char *key) {
+    return cache_ready && findEntry(key);
+}
+
+
+/**
+ * Draw album art from cache
+ *
+ * @param key   Album ID or image URL
+ * @param x
+ * @param y
+ * @return false if key is not cached
+ */
+bool artCacheDraw(const char *key, int16_t x, int16_t y) {
+    if (!cache_ready) {
+        return false;
+    }
+
+    ART_cache_entry_t *e = findEntry(key);
+    if (!e) {
+        return false;
+    }
+
+    char path[32];
+    blobPath(key, path, sizeof(path));
+    HalFile *file = halStorage()->open(path, hal_read);
+    ART_blob_header_t header;
+    if (!file || file->read((uint8_t *) &header, sizeof(header)) != sizeof(header) || header.magic != ART_CACHE_MAGIC
+        || header.width != SPTF_ART_W || header.height != SPTF_ART_H) {
+        delete file;
+        evictEntry(e);
+        saveIndex();
+        return false;
+    }
+
+    uint16_t line[SPTF_ART_W];
+    size_t lineSize = sizeof(line);
+    for (uint16_t row = 0; row < header.height; row++) {
+        if (file->read((uint8_t *) line, lineSize) != lineSize) {
+            break;
+        }
+        halDisplay()->pushRect(x, y + row, header.width, 1, line);
+    }
+    delete file;
+
+    e->last_used = ++use_counter;
+    return true;
+}
+
+
+/**
+ * Index a blob just written, evicting least recently used ones as needed
+ *
+ * @param key
+ * @param size
+ * @return false if it does not fit
+ */
+static bool addEntry(const char *key, uint32_t size) {
+    ART_cache_entry_t *e = allocEntry(size);
+    if (!e) {
+        return false;
+    }
+    strlcpy(e->key, key, sizeof(e->key));
+    e->size = size;
+    e->last_used = ++use_counter;
+    saveIndex();
+    return true;
+}
+
+
+/**
+ * Store an on-screen album art into cache
+ *
+ * The blob is indexed once completely written, a short write (SD full or
+ * removed) removes it.
+ *
+ * @param key   Album ID or image URL
+ * @param x
+ * @param y
+ * @param w
+ * @param h
+ * @return false if not stored (no SD card, not SPTF_ART_W x SPTF_ART_H, write error)
+ */
+bool artCacheStore(const char *key, int16_t x, int16_t y, uint16_t w, uint16_t h) {
+    if (!cache_ready || key[0] == '\0' || w != SPTF_ART_W || h != SPTF_ART_H) {
+        return false;
+    }
+
+    ART_cache_entry_t *e = findEntry(key);
+    if (e) {
+        evictEntry(e);
+        saveIndex();
+    }
+
+    char path[32];
+    blobPath(key, path, sizeof(path));
+    HalFile *file = halStorage()->open(path, hal_write);
+    if (!file) {
+        return false;
+    }
+
+    ART_blob_header_t header = {ART_CACHE_MAGIC, w, h};
+    uint32_t size = sizeof(header) + (uint32_t) w * h * sizeof(uint16_t);
+    uint32_t written = file->write((uint8_t *) &header, sizeof(header));
+
+    uint16_t line[SPTF_ART_W];
+    size_t lineSize = w * sizeof(uint16_t);
+    for (uint16_t row = 0; row < h && written == sizeof(header) + row * lineSize; row++) {
+        halDisplay()->readRect(x, y + row, w, 1, line);
+        written += file->write((uint8_t *) line, lineSize);
+    }
+    delete file;
+
+    if (written != size || !addEntry(key, size)) {
+        halStorage()->remove(path);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Check whether album art can be cached (SD card available)
+ *
+ * @return
+ */
+bool artCacheReady() {
+    return cache_ready;
+}
+
+
+/*
+ * Off-screen display writing a cache blob
+ *
+ * Blocks are drawn top to bottom, a block being at most ART_CACHE_BLOCK_ROWS
+ * high: rows more than that above the last block drawn are complete. Pixels
+ * not drawn are left to the background (last whole box fill).
+ * SD accesses are made under lcd_mutex (shared SPI bus).
+ */
+class ArtCacheWriter final : public HalDisplay {
+public:
+    char key[96];
+    uint16_t w;
+    uint16_t h;
+    uint16_t *strip;            // ART_CACHE_STRIP_ROWS rows from strip_y
+    int32_t strip_y = 0;
+    uint16_t background = HAL_WHITE;
+    HalFile *file = nullptr;
+    uint32_t written = 0;
+    bool ok = true;
+
+    ArtCacheWriter(const char *key, uint16_t w, uint16_t h, uint16_t *strip) : w(w), h(h), strip(strip) {
+        strlcpy(this->key, key, sizeof(this->key));
+        fillStrip(0, ART_CACHE_STRIP_ROWS, background);
+    }
+
+    ~ArtCacheWriter() {
+        delete file;
+        free(strip);
+    }
+
+    int16_t width() override {
+        return w;
+    }
+
+    int16_t height() override {
+        return h;
+    }
+
+    void fillScreen(uint16_t color) override {
+        fillRect(0, 0, w, h, color);
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t rw, int32_t rh, uint16_t color) override {
+        if (x <= 0 && y <= strip_y && x + rw >= w && y + rh >= h) {
+            background = (color >> 8) | (color << 8);
+        }
+        uint16_t pixel = (color >> 8) | (color << 8);
+        int32_t x0 = x > 0 ? x : 0;
+        int32_t x1 = min(x + rw, (int32_t) w);
+        for (int32_t row = y > strip_y ? y : strip_y; row < min(y + rh, strip_y + ART_CACHE_STRIP_ROWS); row++) {
+            for (int32_t col = x0; col < x1; col++) {
+                strip[(row - strip_y) * w + col] = pixel;
+            }
+        }
+    }
+
+    void drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) override {
+    }
+
+    void pushRect(int32_t x, int32_t y, int32_t rw, int32_t rh, const uint16_t *pixels) override {
+        if (y + rh > strip_y + ART_CACHE_STRIP_ROWS) {
+            flush(y - (ART_CACHE_BLOCK_ROWS - 1));
+        }
+        int32_t x0 = x > 0 ? x : 0;
+        int32_t x1 = min(x + rw, (int32_t) w);
+        for (int32_t row = y > strip_y ? y : strip_y; row < min(y + rh, strip_y + ART_CACHE_STRIP_ROWS); row++) {
+            if (x0 < x1) {
+                memcpy(&strip[(row - strip_y) * w + x0], &pixels[(row - y) * rw + x0 - x], (x1 - x0) * sizeof(uint16_t));
+            }
+        }
+    }
+
+    void readRect(int32_t x, int32_t y, int32_t rw, int32_t rh, uint16_t *pixels) override {
+    }
+
+    int16_t textWidth(const char *text, uint8_t font) override {
+        return 0;
+    }
+
+    int16_t fontHeight(uint8_t font) override {
+        return 0;
+    }
+
+    /**
+     * Write rows above 'to' to the blob, and move the strip down
+     *
+     * @param to
+     */
+    void flush(int32_t to) {
+        to = min(to, (int32_t) h);
+        while (strip_y < to) {
+            int32_t rows = min(to - strip_y, (int32_t) ART_CACHE_STRIP_ROWS);
+            write((uint8_t *) strip, rows * w * sizeof(uint16_t));
+            memmove(strip, &strip[rows * w], (ART_CACHE_STRIP_ROWS - rows) * w * sizeof(uint16_t));
+            fillStrip(ART_CACHE_STRIP_ROWS - rows, rows, background);
+            strip_y += rows;
+        }
+    }
+
+private:
+    void fillStrip(int32_t row, int32_t rows, uint16_t pixel) {
+        for (uint32_t i = row * w; i < (uint32_t) (row + rows) * w; i++) {
+            strip[i] = pixel;
+        }
+    }
+
+    void write(const uint8_t *data, size_t len) {
+        if (!ok) {
+            return;
+        }
+        xSemaphoreTake(lcd_mutex, portMAX_DELAY);
+        if (!file) {
+            char path[32];
+            blobPath(key, path, sizeof(path));
+            ART_blob_header_t header = {ART_CACHE_MAGIC, w, h};
+            file = halStorage()->open(path, hal_write);
+            ok = file && file->write((uint8_t *) &header, sizeof(header)) == sizeof(header);
+            written += ok ? sizeof(header) : 0;
+        }
+        if (ok) {
+            ok = file->write(data, len) == len;
+            written += ok ? len : 0;
+        }
+        xSemaphoreGive(lcd_mutex);
+    }
+};
+
+
+/**
+ * Get an off-screen display (w x h, at 0, 0) whose drawing is stored into
+ * cache, e.g. to decode album art without showing it. Not to be used with
+ * lcd_mutex held: it is taken to write to SD.
+ *
+ * @param key   Album ID or image URL
+ * @param w
+ * @param h
+ * @return nullptr if not possible (no SD card, not SPTF_ART_W x SPTF_ART_H, no memory)
+ */
+HalDisplay *artCacheWriterOpen(const char *key, uint16_t w, uint16_t h) {
+    if (!cache_ready || key[0] == '\0' || w != SPTF_ART_W || h != SPTF_ART_H) {
+        return nullptr;
+    }
+
+    uint16_t *strip = (uint16_t *) malloc(ART_CACHE_STRIP_ROWS * w * sizeof(uint16_t));
+    if (!strip) {
+        return nullptr;
+    }
+
+    ART_cache_entry_t *e = findEntry(key);
+    if (e) {
+        xSemaphoreTake(lcd_mutex, portMAX_DELAY);
+        evictEntry(e);
+        saveIndex();
+        xSemaphoreGive(lcd_mutex);
+    }
+    return new ArtCacheWriter(key, w, h, strip);
+}
+
+
+/**
+ * Complete (or drop) an album art drawn into an artCacheWriterOpen() display
+ *
+ * @param writer
+ * @param keep      false to drop it (e.g. decoding failed)
+ * @return false if not stored
+ */
+bool artCacheWriterClose(HalDisplay *writer, bool keep) {
+    ArtCacheWriter *blob = (ArtCacheWriter *) writer;
+    if (keep) {
+        blob->flush(blob->h);
+    }
+
+    uint32_t size = sizeof(ART_blob_header_t) + (uint32_t) blob->w * blob->h * sizeof(uint16_t);
+    keep = keep && blob->ok && blob->written == size;
+
+    xSemaphoreTake(lcd_mutex, portMAX_DELAY);
+    delete blob->file;
+    blob->file = nullptr;
+
+    keep = keep && addEntry(blob->key, size);
+    if (!keep) {
+        char path[32];
+        blobPath(blob->key, path, sizeof(path));
+        halStorage()->remove(path);
+    }
+    xSemaphoreGive(lcd_mutex);
+
+    delete blob;
+    return keep;
+}
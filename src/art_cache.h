@@ -0,0 +1,41 @@
+#ifndef M5SPOT_ART_CACHE_H
+#define M5SPOT_ART_CACHE_H
+
+#include <stdint.h>
+#include "hal/hal.h"
+
+#define ART_CACHE_DIR "/artcache"
+#define ART_CACHE_INDEX "/artcache/index.bin"
+#define ART_CACHE_MAX_ENTRIES 64
+#define ART_CACHE_MAX_BYTES (8 * 1024 * 1024)
+#define ART_CACHE_MAGIC 0x3541354D // "M5A5"
+#define ART_CACHE_BLOCK_ROWS 16     // Highest block drawn at once by the JPEG decoder
+#define ART_CACHE_STRIP_ROWS (2 * ART_CACHE_BLOCK_ROWS)
+
+typedef struct {
+    char key[96];
+    uint32_t size;
+    uint32_t last_used;
+} ART_cache_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t width;
+    uint16_t height;
+} ART_blob_header_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool artCacheBegin();
+bool artCacheHas(const char *key);
+bool artCacheDraw(const char *key, int16_t x, int16_t y);
+bool artCacheStore(const char *key, int16_t x, int16_t y, uint16_t w, uint16_t h);
+bool artCacheReady();
+HalDisplay *artCacheWriterOpen(const char *key, uint16_t w, uint16_t h);
+bool artCacheWriterClose(HalDisplay *writer, bool keep);
+//@formatter:on
+
+#endif // M5SPOT_ART_CACHE_H
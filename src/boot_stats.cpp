@@ -0,0 +1,72 @@
+#include <Arduino.h>
+#include "boot_stats.h"
+
+static const char *phase_names[bp_phase_count] = {
+        "display", "storage", "wifi", "ota", "splash", "server", "tokens", "first_track"
+};
+
+static BOOT_phase_t phases[bp_phase_count];
+static char notes[64] = "";
+
+
+/**
+ * Record the start of a phase
+ *
+ * @param phase
+ */
+void bootPhaseStart(BootPhases phase) {
+    phases[phase].start_ms = millis();
+}
+
+
+/**
+ * Record the end of a phase, only the first time
+ *
+ * @param phase
+ * @return true the first time
+ */
+bool bootPhaseEnd(BootPhases phase) {
+    if (phases[phase].end_ms) {
+        return false;
+    }
+    phases[phase].end_ms = millis();
+    return true;
+}
+
+
+/**
+ * Add a note to the report (e.g. how WiFi was joined)
+ *
+ * @param note
+ */
+void bootNote(const char *note) {
+    if (notes[0]) {
+        strlcat(notes, ", ", sizeof(notes));
+    }
+    strlcat(notes, note, sizeof(notes));
+}
+
+
+/**
+ * Write the boot report, line by line
+ *
+ * @param write
+ * @param ctx
+ */
+void bootStatsWrite(BOOT_write_cb_t write, void *ctx) {
+    char line[80];
+
+    write("phase: start_ms end_ms duration_ms\n", ctx);
+    for (uint8_t i = 0; i < bp_phase_count; i++) {
+        const BOOT_phase_t &p = phases[i];
+        if (p.end_ms) {
+            snprintf(line, sizeof(line), "%s: %u %u %u\n", phase_names[i], p.start_ms, p.end_ms, p.end_ms - p.start_ms);
+        } else {
+            snprintf(line, sizeof(line), "%s: %u - -\n", phase_names[i], p.start_ms);
+        }
+        write(line, ctx);
+    }
+
+    snprintf(line, sizeof(line), "\nnotes: %s\n", notes);
+    write(line, ctx);
+}
@@ -0,0 +1,34 @@
+#ifndef M5SPOT_BOOT_STATS_H
+#define M5SPOT_BOOT_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Boot timing: when each startup phase began and ended (ms since boot,
+ * phases may overlap), up to the first track on screen
+ */
+
+enum BootPhases {
+    bp_display, bp_storage, bp_wifi, bp_ota, bp_splash, bp_server, bp_tokens, bp_first_track, bp_phase_count
+};
+
+typedef struct {
+    uint32_t start_ms;
+    uint32_t end_ms;        // 0 while running (or not run)
+} BOOT_phase_t;
+
+typedef void (*BOOT_write_cb_t)(const char *line, void *ctx);
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void bootPhaseStart(BootPhases phase);
+bool bootPhaseEnd(BootPhases phase);
+void bootNote(const char *note);
+void bootStatsWrite(BOOT_write_cb_t write, void *ctx);
+//@formatter:on
+
+#endif // M5SPOT_BOOT_STATS_H
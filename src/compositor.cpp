@@ -0,0 +1,332 @@
+#include <Arduino.h>
+#include "compositor.h"
+
+
+/**
+ * Clip a rectangle to the layer
+ *
+ * @param layer
+ * @param r
+ * @return false if nothing is left
+ */
+static bool clip(const COMP_layer_t *layer, COMP_rect_t &r) {
+    int16_t x1 = r.x + r.w > layer->area.w ? layer->area.w : r.x + r.w;
+    int16_t y1 = r.y + r.h > layer->area.h ? layer->area.h : r.y + r.h;
+    r.x = r.x < 0 ? 0 : r.x;
+    r.y = r.y < 0 ? 0 : r.y;
+    r.w = x1 - r.x;
+    r.h = y1 - r.y;
+    return r.w > 0 && r.h > 0;
+}
+
+
+/**
+ * Bounding box of two rectangles
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static COMP_rect_t unite(const COMP_rect_t &a, const COMP_rect_t &b) {
+    int16_t x0 = a.x < b.x ? a.x : b.x;
+    int16_t y0 = a.y < b.y ? a.y : b.y;
+    int16_t x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    int16_t y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    return {x0, y0, (int16_t) (x1 - x0), (int16_t) (y1 - y0)};
+}
+
+
+/**
+ * Check if two rectangles overlap or touch
+ *
+ * @param a
+ * @param b
+ * @return
+ */
+static bool touches(const COMP_rect_t &a, const COMP_rect_t &b) {
+    return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+
+/**
+ * Mark a rectangle to be pushed on next flush
+ *
+ * Touching rectangles are merged, when the list is full everything is
+ * merged into the first one.
+ *
+ * @param layer
+ * @param r     In layer coordinates
+ */
+static void markDirty(COMP_layer_t *layer, COMP_rect_t r) {
+    if (!layer->canvas || !clip(layer, r)) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < layer->dirty_count; i++) {
+        if (touches(layer->dirty[i], r)) {
+            layer->dirty[i] = unite(layer->dirty[i], r);
+            return;
+        }
+    }
+
+    if (layer->dirty_count < COMP_MAX_DIRTY) {
+        layer->dirty[layer->dirty_count++] = r;
+        return;
+    }
+
+    for (uint8_t i = 1; i < layer->dirty_count; i++) {
+        r = unite(r, layer->dirty[i]);
+    }
+    layer->dirty[0] = unite(layer->dirty[0], r);
+    layer->dirty_count = 1;
+}
+
+
+/**
+ * Get what to draw on, and the offset to apply
+ *
+ * @param layer
+ * @param dx
+ * @param dy
+ * @return
+ */
+static HalDisplay *target(const COMP_layer_t *layer, int16_t &dx, int16_t &dy) {
+    if (layer->canvas) {
+        dx = dy = 0;
+        return layer->canvas;
+    }
+    dx = layer->area.x;
+    dy = layer->area.y;
+    return halDisplay();
+}
+
+
+/**
+ * Create a layer, filled with its background and fully dirty
+ *
+ * @param layer
+ * @param x
+ * @param y
+ * @param w
+ * @param h
+ * @param background
+ * @return false if there is no memory for the canvas (then the layer draws to the LCD)
+ */
+bool compLayerBegin(COMP_layer_t *layer, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background) {
+    memset(layer, 0, sizeof(COMP_layer_t));
+    layer->canvas = halCreateCanvas(w, h);
+    layer->area = {x, y, w, h};
+    layer->background = background;
+
+    compFillRect(layer, 0, 0, w, h, background);
+    return layer->canvas != nullptr;
+}
+
+
+/**
+ * Mark the whole layer dirty, e.g. after something else was drawn over it
+ *
+ * @param layer
+ */
+void compLayerInvalidate(COMP_layer_t *layer) {
+    layer->dirty_count = 0;
+    markDirty(layer, {0, 0, layer->area.w, layer->area.h});
+}
+
+
+/**
+ * Fill a rectangle
+ *
+ * @param layer
+ * @param x     In layer coordinates
+ * @param y
+ * @param w
+ * @param h
+ * @param color
+ */
+void compFillRect(COMP_layer_t *layer, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    int16_t dx, dy;
+    target(layer, dx, dy)->fillRect(x + dx, y + dy, w, h, color);
+    markDirty(layer, {x, y, w, h});
+}
+
+
+/**
+ * Replace a text: erase it where it was last drawn, then draw the new one
+ *
+ * @param layer
+ * @param bounds    Where the text was drawn, updated ({0, 0, 0, 0} at first)
+ * @param text
+ * @param x         In layer coordinates
+ * @param y
+ * @param font
+ * @param datum
+ * @param color
+ */
+void compText(COMP_layer_t *layer, COMP_rect_t *bounds, const char *text, int16_t x, int16_t y, uint8_t font,
+              HalDatums datum, uint16_t color) {
+    int16_t dx, dy;
+    HalDisplay *lcd = target(layer, dx, dy);
+
+    if (bounds->w && bounds->h) {
+        compFillRect(layer, bounds->x, bounds->y, bounds->w, bounds->h, layer->background);
+    }
+
+    int16_t w = lcd->textWidth(text, font);
+    int16_t h = lcd->fontHeight(font);
+    *bounds = {(int16_t) (x - (datum % 3) * w / 2), (int16_t) (y - (datum / 3) * h / 2), w, h};
+
+    lcd->drawText(text, x + dx, y + dy, font, datum, color);
+    markDirty(layer, *bounds);
+}
+
+
+/**
+ * Marquee window offset in its strip
+ *
+ * Each round starts with a pause, then the text scrolls left until its
+ * next occurrence (after the gap) is where the text was.
+ *
+ * @param marquee
+ * @param cur_millis
+ * @return
+ */
+static int16_t marqueeOffset(const COMP_marquee_t *marquee, uint32_t cur_millis) {
+    int16_t period = marquee->strip->width();
+    uint32_t round_ms = COMP_MARQUEE_PAUSE_MS + (uint32_t) period * 1000 / COMP_MARQUEE_SPEED;
+    uint32_t t = (cur_millis - marquee->start_millis) % round_ms;
+    return t < COMP_MARQUEE_PAUSE_MS ? 0 : (t - COMP_MARQUEE_PAUSE_MS) * COMP_MARQUEE_SPEED / 1000 % period;
+}
+
+
+/**
+ * Copy the marquee window from its strip to the layer
+ *
+ * @param layer
+ * @param marquee
+ */
+static void marqueeBlit(COMP_layer_t *layer, COMP_marquee_t *marquee) {
+    const COMP_rect_t &b = marquee->bounds;
+    const uint16_t *strip = marquee->strip->buffer();
+    int16_t period = marquee->strip->width();
+    int16_t first = b.w < period - marquee->offset ? b.w : period - marquee->offset;
+
+    for (int16_t row = 0; row < b.h; row++) {
+        const uint16_t *line = &strip[row * period];
+        layer->canvas->pushRect(b.x, b.y + row, first, 1, &line[marquee->offset]);
+        if (first < b.w) {
+            layer->canvas->pushRect(b.x + first, b.y + row, b.w - first, 1, line);
+        }
+    }
+    markDirty(layer, b);
+}
+
+
+/**
+ * Replace a text that may scroll
+ *
+ * @param layer
+ * @param marquee   Zeroed at first
+ * @param text
+ * @param x         In layer coordinates, where the text is drawn if it fits
+ * @param y
+ * @param font
+ * @param datum
+ * @param color
+ */
+void compMarqueeText(COMP_layer_t *layer, COMP_marquee_t *marquee, const char *text, int16_t x, int16_t y,
+                     uint8_t font, HalDatums datum, uint16_t color) {
+    delete marquee->strip;
+    marquee->strip = nullptr;
+
+    int16_t window_w = layer->area.w - 2 * COMP_MARQUEE_MARGIN;
+    int16_t w = layer->canvas ? layer->canvas->textWidth(text, font) : 0;
+    if (w <= window_w) {
+        compText(layer, &marquee->bounds, text, x, y, font, datum, color);
+        return;
+    }
+
+    int16_t period = (w < COMP_MARQUEE_MAX_WIDTH ? w : COMP_MARQUEE_MAX_WIDTH) + COMP_MARQUEE_GAP;
+    int16_t h = layer->canvas->fontHeight(font);
+    marquee->strip = halCreateCanvas(period, h);
+    if (!marquee->strip) {
+        compText(layer, &marquee->bounds, text, x, y, font, datum, color);
+        return;
+    }
+    marquee->strip->fillScreen(layer->background);
+    marquee->strip->drawText(text, 0, 0, font, hal_datum_tl, color);
+
+    if (marquee->bounds.w && marquee->bounds.h) {
+        compFillRect(layer, marquee->bounds.x, marquee->bounds.y, marquee->bounds.w, marquee->bounds.h,
+                     layer->background);
+    }
+    marquee->bounds = {COMP_MARQUEE_MARGIN, (int16_t) (y - (datum / 3) * h / 2), window_w, h};
+    marquee->offset = 0;
+    marquee->start_millis = millis();
+    marqueeBlit(layer, marquee);
+}
+
+
+/**
+ * Check if a marquee has to be redrawn
+ *
+ * @param marquee
+ * @param cur_millis
+ * @return
+ */
+bool compMarqueeMoved(const COMP_marquee_t *marquee, uint32_t cur_millis) {
+    return marquee->strip && marqueeOffset(marquee, cur_millis) != marquee->offset;
+}
+
+
+/**
+ * Scroll a marquee to where it should be
+ *
+ * @param layer
+ * @param marquee
+ * @param cur_millis
+ */
+void compMarqueeStep(COMP_layer_t *layer, COMP_marquee_t *marquee, uint32_t cur_millis) {
+    if (!compMarqueeMoved(marquee, cur_millis)) {
+        return;
+    }
+    marquee->offset = marqueeOffset(marquee, cur_millis);
+    marqueeBlit(layer, marquee);
+}
+
+
+/**
+ * Push dirty rectangles to the LCD
+ *
+ * Full width rectangles are pushed at once, others row by row, straight
+ * from the canvas.
+ *
+ * @param layer
+ * @return Bytes sent
+ */
+uint32_t compFlush(COMP_layer_t *layer) {
+    if (!layer->canvas || !layer->dirty_count) {
+        return 0;
+    }
+
+    HalDisplay *lcd = halDisplay();
+    const uint16_t *pixels = layer->canvas->buffer();
+    uint32_t bytes = 0;
+
+    for (uint8_t i = 0; i < layer->dirty_count; i++) {
+        const COMP_rect_t &r = layer->dirty[i];
+        const uint16_t *start = &pixels[r.y * layer->area.w + r.x];
+        if (r.w == layer->area.w) {
+            lcd->pushRect(layer->area.x, layer->area.y + r.y, r.w, r.h, start);
+        } else {
+            for (int16_t row = 0; row < r.h; row++) {
+                lcd->pushRect(layer->area.x + r.x, layer->area.y + r.y + row, r.w, 1, &start[row * layer->area.w]);
+            }
+        }
+        bytes += r.w * r.h * sizeof(uint16_t);
+    }
+
+    layer->dirty_count = 0;
+    layer->pushed_bytes += bytes;
+    return bytes;
+}
@@ -0,0 +1,70 @@
+#ifndef M5SPOT_COMPOSITOR_H
+#define M5SPOT_COMPOSITOR_H
+
+#include "hal/hal.h"
+
+/*
+ * Retained screen layers
+ *
+ * A layer is an off-screen canvas for a region of the screen. Drawing marks
+ * rectangles dirty, flushing pushes only those to the LCD, so the panel
+ * never shows a half drawn region (no flicker) and unchanged pixels are not
+ * sent again. If there is not enough memory for a canvas, the layer draws
+ * straight to the LCD.
+ *
+ * Texts too long for their layer scroll as a marquee: each frame is a copy
+ * of a window of the pre-rasterized strip, no font is involved.
+ */
+
+#define COMP_MAX_DIRTY 4
+#define COMP_MARQUEE_MARGIN 4           // Left & right of scrolling text, in px
+#define COMP_MARQUEE_GAP 48             // Between the end of a text and its next occurrence
+#define COMP_MARQUEE_MAX_WIDTH 800      // Longer texts are cut
+#define COMP_MARQUEE_SPEED 40           // px/s
+#define COMP_MARQUEE_PAUSE_MS 2000      // At the beginning of each round
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t w;
+    int16_t h;
+} COMP_rect_t;
+
+typedef struct {
+    HalCanvas *canvas;
+    COMP_rect_t area;                   // On screen
+    uint16_t background;
+    COMP_rect_t dirty[COMP_MAX_DIRTY];  // In layer coordinates
+    uint8_t dirty_count;
+    uint32_t pushed_bytes;              // Sent to the LCD since begin
+} COMP_layer_t;
+
+/*
+ * Text that scrolls if it does not fit in the layer, from a strip where it
+ * is rasterized once (or drawn as a plain text if it fits)
+ */
+typedef struct {
+    HalCanvas *strip;                   // nullptr if the text fits
+    COMP_rect_t bounds;                 // Where the text (or its window) is, in layer coordinates
+    int16_t offset;                     // Of the window in the strip
+    uint32_t start_millis;
+} COMP_marquee_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool compLayerBegin(COMP_layer_t *layer, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background);
+void compLayerInvalidate(COMP_layer_t *layer);
+void compFillRect(COMP_layer_t *layer, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+void compText(COMP_layer_t *layer, COMP_rect_t *bounds, const char *text, int16_t x, int16_t y, uint8_t font,
+              HalDatums datum, uint16_t color);
+void compMarqueeText(COMP_layer_t *layer, COMP_marquee_t *marquee, const char *text, int16_t x, int16_t y,
+                     uint8_t font, HalDatums datum, uint16_t color);
+bool compMarqueeMoved(const COMP_marquee_t *marquee, uint32_t cur_millis);
+void compMarqueeStep(COMP_layer_t *layer, COMP_marquee_t *marquee, uint32_t cur_millis);
+uint32_t compFlush(COMP_layer_t *layer);
+//@formatter:on
+
+#endif // M5SPOT_COMPOSITOR_H
@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#include "conn_pool.h"
+
+static HTTP_conn_t pool[CONN_POOL_SIZE];
+static HTTP_conn_stats_t stats = {0, 0, 0, 0, 0};
+
+
+/**
+ * Get a connection to host:port, reusing a kept-alive socket when possible
+ *
+ * @param host
+ * @param port
+ * @return Connection, or nullptr if unable to connect
+ */
+HTTP_conn_t *connPoolAcquire(const char *host, uint16_t port) {
+    HTTP_conn_t *conn = nullptr;
+    uint32_t cur_millis = millis();
+
+    // Look for an idle socket already bound to this host
+    for (auto &c : pool) {
+        if (!c.in_use && c.port == port && strcmp(c.host, host) == 0) {
+            conn = &c;
+            break;
+        }
+    }
+
+    if (conn) {
+        if (conn->client.connected() && (cur_millis - conn->last_used_millis < CONN_POOL_IDLE_MS)) {
+            conn->in_use = true;
+            conn->reused = true;
+            conn->last_used_millis = cur_millis;
+            stats.acquired++;
+            stats.reused++;
+            return conn;
+        }
+        // Peer closed the socket or it has been idle for too long
+        conn->client.stop();
+        stats.stale++;
+    } else {
+        // Take a never used slot, else the least recently used idle one
+        for (auto &c : pool) {
+            if (c.in_use) {
+                continue;
+            }
+            if (c.host[0] == '\0') {
+                conn = &c;
+                break;
+            }
+            if (!conn || c.last_used_millis < conn->last_used_millis) {
+                conn = &c;
+            }
+        }
+        if (!conn) {
+            return nullptr;
+        }
+        conn->client.stop();
+        strncpy(conn->host, host, sizeof(conn->host) - 1);
+        conn->host[sizeof(conn->host) - 1] = '\0';
+        conn->port = port;
+    }
+
+    if (!conn->client.connect(host, port)) {
+        conn->client.stop();
+        conn->host[0] = '\0';
+        stats.failures++;
+        return nullptr;
+    }
+
+    conn->in_use = true;
+    conn->reused = false;
+    conn->last_used_millis = millis();
+    stats.acquired++;
+    stats.connects++;
+    return conn;
+}
+
+
+/**
+ * Give a connection back to the pool
+ *
+ * @param conn
+ * @param keep_alive    false if the socket cannot be reused (Connection: close, read error...)
+ */
+void connPoolRelease(HTTP_conn_t *conn, bool keep_alive) {
+    if (!conn) {
+        return;
+    }
+    if (!keep_alive) {
+        conn->client.stop();
+    }
+    conn->last_used_millis = millis();
+    conn->in_use = false;
+}
+
+
+/**
+ * Close a reused socket that turned out to be dead
+ *
+ * @param conn
+ */
+void connPoolMarkStale(HTTP_conn_t *conn) {
+    conn->client.stop();
+    conn->in_use = false;
+    stats.stale++;
+}
+
+
+/**
+ * Get pool usage counters
+ *
+ * @return
+ */
+const HTTP_conn_stats_t &connPoolStats() {
+    return stats;
+}
@@ -0,0 +1,37 @@
+#ifndef M5SPOT_CONN_POOL_H
+#define M5SPOT_CONN_POOL_H
+
+#include "hal/hal.h"
+
+#define CONN_POOL_SIZE 3            // Slots shared by api.spotify.com & accounts.spotify.com
+#define CONN_POOL_IDLE_MS 30000     // Idle sockets older than this are considered stale
+
+typedef struct {
+    char host[32];
+    uint16_t port;
+    HalNetClient client;
+    uint32_t last_used_millis;
+    bool in_use;
+    bool reused;
+} HTTP_conn_t;
+
+typedef struct {
+    uint32_t acquired;
+    uint32_t reused;
+    uint32_t connects;
+    uint32_t stale;
+    uint32_t failures;
+} HTTP_conn_stats_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+HTTP_conn_t *connPoolAcquire(const char *host, uint16_t port);
+void connPoolRelease(HTTP_conn_t *conn, bool keep_alive);
+void connPoolMarkStale(HTTP_conn_t *conn);
+const HTTP_conn_stats_t &connPoolStats();
+//@formatter:on
+
+#endif // M5SPOT_CONN_POOL_H
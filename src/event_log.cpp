@@ -0,0 +1,177 @@
+#include <Arduino.h>
+#include "event_log.h"
+#include "metrics.h"
+
+/*
+ * Entries are stored as a 2 bytes length, a type byte then the text (no
+ * terminator), wrapping around the end of the ring.
+ * Consecutive entries of the same type are sent as one message: lines
+ * joined with '\n' (empty ones included), raw spans concatenated. Infos and errors (JSON) are
+ * sent one by one, in order with the lines.
+ */
+
+#define ENTRY_HEADER_SIZE 3
+
+static uint8_t ring[EVENT_LOG_SIZE];
+static uint16_t head = 0;           // Oldest entry
+static uint16_t used = 0;
+static uint32_t dropped = 0;
+static char batch[EVENT_LOG_BATCH_SIZE];
+static SemaphoreHandle_t mutex = nullptr;
+
+
+/**
+ * Copy bytes into the ring
+ *
+ * @param pos
+ * @param data
+ * @param len
+ */
+static void ringWrite(uint16_t pos, const void *data, uint16_t len) {
+    uint16_t first = min(len, (uint16_t) (EVENT_LOG_SIZE - pos));
+    memcpy(&ring[pos], data, first);
+    memcpy(ring, (const uint8_t *) data + first, len - first);
+}
+
+
+/**
+ * Copy bytes out of the ring
+ *
+ * @param pos
+ * @param data
+ * @param len
+ */
+static void ringRead(uint16_t pos, void *data, uint16_t len) {
+    uint16_t first = min(len, (uint16_t) (EVENT_LOG_SIZE - pos));
+    memcpy(data, &ring[pos], first);
+    memcpy((uint8_t *) data + first, ring, len - first);
+}
+
+
+/**
+ * Read the header of the oldest entry
+ *
+ * @param len
+ * @param type
+ */
+static void peekEntry(uint16_t *len, EventsLogTypes *type) {
+    uint8_t header[ENTRY_HEADER_SIZE];
+    ringRead(head, header, sizeof(header));
+    *len = header[0] | header[1] << 8;
+    *type = (EventsLogTypes) header[2];
+}
+
+
+/**
+ * Remove the oldest entry
+ */
+static void popEntry() {
+    uint16_t len;
+    EventsLogTypes type;
+    peekEntry(&len, &type);
+    head = (head + ENTRY_HEADER_SIZE + len) % EVENT_LOG_SIZE;
+    used -= ENTRY_HEADER_SIZE + len;
+}
+
+
+/**
+ * Create the ring lock, before any other call
+ */
+void eventLogBegin() {
+    mutex = xSemaphoreCreateMutex();
+}
+
+
+/**
+ * Queue a log line, dropping the oldest ones if there is not enough room
+ *
+ * @param data      Truncated to EVENT_LOG_BATCH_SIZE - 1
+ * @param type
+ */
+void eventLogPush(const char *data, EventsLogTypes type) {
+    uint16_t len = strnlen(data, EVENT_LOG_BATCH_SIZE - 1);
+    uint8_t header[ENTRY_HEADER_SIZE] = {(uint8_t) len, (uint8_t) (len >> 8), (uint8_t) type};
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    while (used && EVENT_LOG_SIZE - used < ENTRY_HEADER_SIZE + len) {
+        popEntry();
+        dropped++;
+        metricsCount(mc_event_log_dropped);
+    }
+    uint16_t tail = (head + used) % EVENT_LOG_SIZE;
+    ringWrite(tail, header, sizeof(header));
+    ringWrite((tail + ENTRY_HEADER_SIZE) % EVENT_LOG_SIZE, data, len);
+    used += ENTRY_HEADER_SIZE + len;
+    xSemaphoreGive(mutex);
+}
+
+
+/**
+ * Send queued lines in batches
+ *
+ * The ring is only locked while a batch is copied out, not while it is sent.
+ *
+ * @param send
+ * @param ctx
+ * @param max_batches
+ * @return Number of batches sent
+ */
+uint16_t eventLogDrain(EVENT_LOG_send_cb_t send, void *ctx, uint16_t max_batches) {
+    uint16_t batches = 0;
+
+    while (batches < max_batches) {
+        size_t batch_len = 0;
+        uint16_t batch_entries = 0;     // Empty lines too, sent like any other
+        EventsLogTypes batch_type = log_line;
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        while (used) {
+            uint16_t len;
+            EventsLogTypes type;
+            peekEntry(&len, &type);
+            size_t sep = batch_entries && type == log_line ? 1 : 0;
+            if (batch_entries && (type != batch_type || type > log_raw || batch_len + sep + len >= sizeof(batch))) {
+                break;
+            }
+            if (sep) {
+                batch[batch_len++] = '\n';
+            }
+            ringRead((head + ENTRY_HEADER_SIZE) % EVENT_LOG_SIZE, &batch[batch_len], len);
+            batch_len += len;
+            batch_entries++;
+            batch_type = type;
+            popEntry();
+        }
+        xSemaphoreGive(mutex);
+
+        if (!batch_entries) {
+            break;
+        }
+        batch[batch_len] = '\0';
+        send(batch, batch_type, ctx);
+        batches++;
+    }
+
+    return batches;
+}
+
+
+/**
+ * Forget queued lines
+ */
+void eventLogClear() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    head = 0;
+    used = 0;
+    xSemaphoreGive(mutex);
+}
+
+
+/**
+ * Number of lines dropped since boot
+ *
+ * @return
+ */
+uint32_t eventLogDropped() {
+    return dropped;
+}
@@ -0,0 +1,32 @@
+#ifndef M5SPOT_EVENT_LOG_H
+#define M5SPOT_EVENT_LOG_H
+
+#include "sptf.h"
+
+/*
+ * Browser console log ring
+ *
+ * Log lines are copied into a preallocated ring by the network task, then
+ * sent to the browser in batches from a timer, so logging never waits for
+ * slow clients. When the ring is full, oldest lines are dropped.
+ */
+
+#define EVENT_LOG_SIZE 4096         // Ring size, in bytes
+#define EVENT_LOG_BATCH_SIZE 1024   // Max size of a batch, and of a line
+#define EVENT_LOG_PERIOD_MS 200     // Drain period
+
+typedef void (*EVENT_LOG_send_cb_t)(const char *data, EventsLogTypes type, void *ctx);
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void eventLogBegin();
+void eventLogPush(const char *data, EventsLogTypes type);
+uint16_t eventLogDrain(EVENT_LOG_send_cb_t send, void *ctx, uint16_t max_batches);
+void eventLogClear();
+uint32_t eventLogDropped();
+//@formatter:on
+
+#endif // M5SPOT_EVENT_LOG_H
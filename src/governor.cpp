@@ -0,0 +1,135 @@
+#include <Arduino.h>
+#include "governor.h"
+
+/*
+ * Spotify request governor
+ *
+ * - A token bucket caps the overall request rate of the device
+ * - Each endpoint class is blocked after a 429 or 5xx, for the Retry-After
+ *   delay when Spotify gives one, else for an exponential backoff delay.
+ *   Delays are jittered so that devices sharing the same Spotify app and
+ *   failing together do not retry together.
+ */
+
+static GOV_class_t classes[gov_class_count] = {
+        {5000, 300000, 0, 0, 0, 0}, // gov_token
+        {1000, 60000,  0, 0, 0, 0}, // gov_player_read
+        {1000, 30000,  0, 0, 0, 0}, // gov_player_write
+};
+
+static uint32_t bucket_tokens = GOV_BUCKET_SIZE;
+static uint32_t bucket_millis = 0;
+
+
+/**
+ * Add tokens earned since last refill
+ */
+static void bucketRefill() {
+    uint32_t cur_millis = millis();
+    uint32_t earned = (cur_millis - bucket_millis) / GOV_BUCKET_REFILL_MS;
+    if (earned) {
+        bucket_tokens = bucket_tokens + earned > GOV_BUCKET_SIZE ? GOV_BUCKET_SIZE : bucket_tokens + earned;
+        bucket_millis += earned * GOV_BUCKET_REFILL_MS;
+    }
+    if (bucket_tokens == GOV_BUCKET_SIZE) {
+        bucket_millis = cur_millis;
+    }
+}
+
+
+/**
+ * Get delay before a request of this class is allowed
+ *
+ * @param cls
+ * @return 0 if allowed now
+ */
+uint32_t govWaitMs(GovClasses cls) {
+    uint32_t cur_millis = millis();
+    int32_t blocked = (int32_t) (classes[cls].blocked_until - cur_millis);
+    if (blocked > 0) {
+        return blocked;
+    }
+
+    bucketRefill();
+    if (!bucket_tokens) {
+        return GOV_BUCKET_REFILL_MS - (cur_millis - bucket_millis);
+    }
+    return 0;
+}
+
+
+/**
+ * Ask for permission to send a request
+ *
+ * @param cls
+ * @return false if the request must not be sent now
+ */
+bool govAcquire(GovClasses cls) {
+    if (govWaitMs(cls)) {
+        classes[cls].throttled++;
+        return false;
+    }
+    bucket_tokens--;
+    return true;
+}
+
+
+/**
+ * Report a request result
+ *
+ * @param cls
+ * @param httpCode
+ * @param retry_after_s     Retry-After header value, 0 if none
+ */
+void govReport(GovClasses cls, int httpCode, uint32_t retry_after_s) {
+    GOV_class_t &c = classes[cls];
+
+    if (httpCode != 429 && httpCode < 500) {
+        c.failures = 0;
+        return;
+    }
+
+    if (httpCode == 429) {
+        c.rate_limited++;
+    }
+
+    uint32_t delay_ms;
+    if (retry_after_s) {
+        // Obey Spotify, plus up to one second of jitter
+        delay_ms = retry_after_s * 1000 + random(1000);
+    } else {
+        // Exponential backoff, "equal jitter"
+        delay_ms = c.base_ms << (c.failures < 16 ? c.failures : 16);
+        if (delay_ms > c.max_ms) {
+            delay_ms = c.max_ms;
+        }
+        delay_ms = delay_ms / 2 + random(delay_ms / 2 + 1);
+    }
+
+    if (c.failures < UINT8_MAX) {
+        c.failures++;
+    }
+    c.blocked_until = millis() + delay_ms;
+}
+
+
+/**
+ * Get class counters
+ *
+ * @param cls
+ * @return
+ */
+const GOV_class_t &govStats(GovClasses cls) {
+    return classes[cls];
+}
+
+
+/**
+ * Get the number of requests allowed right away, all classes together
+ *
+ * @return
+ */
+uint32_t govBucketTokens() {
+    bucketRefill();
+    return bucket_tokens;
+}
@@ -0,0 +1,34 @@
+#ifndef M5SPOT_GOVERNOR_H
+#define M5SPOT_GOVERNOR_H
+
+#include <stdint.h>
+
+#define GOV_BUCKET_SIZE 10          // Max burst of requests
+#define GOV_BUCKET_REFILL_MS 1000   // One more request allowed every...
+
+enum GovClasses {
+    gov_token, gov_player_read, gov_player_write, gov_class_count
+};
+
+typedef struct {
+    uint32_t base_ms;       // First backoff delay
+    uint32_t max_ms;        // Backoff delay cap
+    uint32_t blocked_until;
+    uint8_t failures;
+    uint32_t throttled;     // Requests refused locally
+    uint32_t rate_limited;  // 429 received
+} GOV_class_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool govAcquire(GovClasses cls);
+void govReport(GovClasses cls, int httpCode, uint32_t retry_after_s);
+uint32_t govWaitMs(GovClasses cls);
+const GOV_class_t &govStats(GovClasses cls);
+uint32_t govBucketTokens();
+//@formatter:on
+
+#endif // M5SPOT_GOVERNOR_H
@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include "gzip_stream.h"
+
+/*
+ * The gzip wrapper (header, trailer) is parsed here, byte by byte as it
+ * may be split anywhere, the deflate data in between goes to the HAL
+ * inflater. The trailer CRC-32 is not checked (TLS already protects the
+ * body), the inflated size is.
+ */
+
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+
+/**
+ * Move on to the next optional header field present, or to the data
+ *
+ * @param gz
+ * @param after     Last field read
+ */
+static void nextField(GZIP_stream_t *gz, GzipStates after) {
+    if (after < gz_extra_len && (gz->flags & GZIP_FEXTRA)) {
+        gz->state = gz_extra_len;
+        gz->header_len = 0;
+        gz->skip = 0;
+    } else if (after < gz_name && (gz->flags & GZIP_FNAME)) {
+        gz->state = gz_name;
+    } else if (after < gz_comment && (gz->flags & GZIP_FCOMMENT)) {
+        gz->state = gz_comment;
+    } else if (after < gz_header_crc && (gz->flags & GZIP_FHCRC)) {
+        gz->state = gz_header_crc;
+        gz->skip = 2;
+    } else {
+        gz->state = gz_data;
+        gz->header_len = 0;
+    }
+}
+
+
+/**
+ * Initialize a stream
+ *
+ * @param gz
+ * @param out_cb    Called for each inflated span
+ * @param ctx       User context passed to out_cb
+ * @return false if there is no inflater (heap too short)
+ */
+bool gzipStreamInit(GZIP_stream_t *gz, GZIP_out_cb_t out_cb, void *ctx) {
+    gz->state = gz_header;
+    gz->flags = 0;
+    gz->header_len = 0;
+    gz->skip = 0;
+    gz->in_size = 0;
+    gz->out_size = 0;
+    gz->out_cb = out_cb;
+    gz->ctx = ctx;
+    gz->inflater = halInflater();
+    if (!gz->inflater) {
+        gz->state = gz_error;
+        return false;
+    }
+    gz->inflater->reset();
+    return true;
+}
+
+
+/**
+ * Decode a compressed span
+ *
+ * @param gz
+ * @param data
+ * @param len
+ * @return false if the stream is not valid gzip (further spans are ignored)
+ */
+bool gzipStreamFeed(GZIP_stream_t *gz, const char *data, size_t len) {
+    const uint8_t *in = (const uint8_t *) data;
+    gz->in_size += len;
+
+    while (len && gz->state != gz_error) {
+        switch (gz->state) {
+
+            case gz_header:
+                gz->header[gz->header_len++] = *in++;
+                len--;
+                if (gz->header_len == 10) {
+                    // Magic, then deflate method
+                    if (gz->header[0] != 0x1F || gz->header[1] != 0x8B || gz->header[2] != 8) {
+                        gz->state = gz_error;
+                        break;
+                    }
+                    gz->flags = gz->header[3];
+                    nextField(gz, gz_header);
+                }
+                break;
+
+            case gz_extra_len:
+                gz->skip |= *in++ << (8 * gz->header_len++);
+                len--;
+                if (gz->header_len == 2) {
+                    gz->state = gz_extra;
+                }
+                break;
+
+            case gz_extra:
+            case gz_header_crc: {
+                size_t n = len < gz->skip ? len : gz->skip;
+                in += n;
+                len -= n;
+                gz->skip -= n;
+                if (gz->skip == 0) {
+                    nextField(gz, gz->state);
+                }
+                break;
+            }
+
+            case gz_name:
+            case gz_comment: {
+                // Zero terminated
+                const uint8_t *end = (const uint8_t *) memchr(in, 0, len);
+                size_t n = end ? end - in + 1 : len;
+                in += n;
+                len -= n;
+                if (end) {
+                    nextField(gz, gz->state);
+                }
+                break;
+            }
+
+            case gz_data: {
+                size_t n = len;
+                HalInflateResults result = gz->inflater->inflate(in, &n, [](const char *out, size_t out_len, void *ctx) {
+                    GZIP_stream_t *gz = (GZIP_stream_t *) ctx;
+                    gz->out_size += out_len;
+                    gz->out_cb(out, out_len, gz->ctx);
+                }, gz);
+                in += n;
+                len -= n;
+                if (result == hal_inflate_done) {
+                    gz->state = gz_trailer;
+                } else if (result == hal_inflate_error) {
+                    gz->state = gz_error;
+                }
+                break;
+            }
+
+            case gz_trailer:
+                gz->header[gz->header_len++] = *in++;
+                len--;
+                if (gz->header_len == 8) {
+                    uint32_t size = gz->header[4] | gz->header[5] << 8 | gz->header[6] << 16
+                                    | (uint32_t) gz->header[7] << 24;
+                    gz->state = size == gz->out_size ? gz_done : gz_error;
+                }
+                break;
+
+            case gz_done:
+                // Ignore anything after the (first) member
+                len = 0;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return gz->state != gz_error;
+}
+
+
+/**
+ * Check whether the whole stream was decoded
+ *
+ * @param gz
+ * @return
+ */
+bool gzipStreamDone(const GZIP_stream_t *gz) {
+    return gz->state == gz_done;
+}
@@ -0,0 +1,46 @@
+#ifndef M5SPOT_GZIP_STREAM_H
+#define M5SPOT_GZIP_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal/hal.h"
+
+/*
+ * Streaming gzip (RFC 1952) decoder
+ *
+ * Compressed spans are fed as they are read from the socket, inflated
+ * spans are handed to the output callback right away: the body is never
+ * held in full, neither compressed nor inflated. The inflater is shared
+ * (see halInflater()), one stream can be decoded at a time.
+ */
+
+enum GzipStates {
+    gz_header, gz_extra_len, gz_extra, gz_name, gz_comment, gz_header_crc, gz_data, gz_trailer, gz_done, gz_error
+};
+
+typedef void (*GZIP_out_cb_t)(const char *data, size_t len, void *ctx);
+
+typedef struct {
+    GzipStates state;
+    uint8_t flags;
+    uint8_t header[10];     // Fixed header, then trailer (CRC-32 & size)
+    uint8_t header_len;
+    uint16_t skip;          // Bytes of extra field or header CRC left
+    uint32_t in_size;       // Compressed
+    uint32_t out_size;      // Inflated
+    HalInflater *inflater;
+    GZIP_out_cb_t out_cb;
+    void *ctx;
+} GZIP_stream_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool gzipStreamInit(GZIP_stream_t *gz, GZIP_out_cb_t out_cb, void *ctx);
+bool gzipStreamFeed(GZIP_stream_t *gz, const char *data, size_t len);
+bool gzipStreamDone(const GZIP_stream_t *gz);
+//@formatter:on
+
+#endif // M5SPOT_GZIP_STREAM_H
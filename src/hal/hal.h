@@ -0,0 +1,138 @@
+#ifndef M5SPOT_HAL_H
+#define M5SPOT_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Hardware abstraction layer
+ *
+ * Display, off-screen canvases, storage, settings, inflater, heap and network
+ * client used by the portable modules (sptf, compositor, art_cache, conn_pool,
+ * settings, gzip_stream). The clock is the Arduino one (millis(),
+ * micros(), delay()), provided by the native shims off target.
+ *
+ * - hal_esp32.cpp: M5.Lcd, SD, NVS, ROM inflater (miniz) and WiFiClientSecure
+ * - native/hal_linux.cpp: in-memory framebuffer, directory, zlib and POSIX sockets
+ */
+
+#define HAL_BLACK 0x0000
+#define HAL_WHITE 0xFFFF
+
+// Same values as TFT_eSPI datums
+enum HalDatums {
+    hal_datum_tl, hal_datum_tc, hal_datum_tr,
+    hal_datum_ml, hal_datum_mc, hal_datum_mr,
+    hal_datum_bl, hal_datum_bc, hal_datum_br
+};
+
+enum HalFileModes {
+    hal_read, hal_write
+};
+
+enum HalInflateResults {
+    hal_inflate_more, hal_inflate_done, hal_inflate_error
+};
+
+#define HAL_INFLATE_WINDOW_SIZE 32768
+
+typedef void (*HAL_inflate_cb_t)(const char *data, size_t len, void *ctx);
+
+class HalDisplay {
+public:
+    virtual int16_t width() = 0;
+    virtual int16_t height() = 0;
+    virtual void fillScreen(uint16_t color) = 0;
+    virtual void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) = 0;
+    virtual void drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) = 0;
+    // Pixels are RGB565 in LCD byte order (big endian)
+    virtual void pushRect(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *pixels) = 0;
+    virtual void readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *pixels) = 0;
+    virtual int16_t textWidth(const char *text, uint8_t font) = 0;
+    virtual int16_t fontHeight(uint8_t font) = 0;
+};
+
+// Off-screen display, delete to free
+class HalCanvas : public HalDisplay {
+public:
+    virtual ~HalCanvas() {}
+    // width() * height() pixels, in LCD byte order: rows can be pushed as is
+    virtual const uint16_t *buffer() = 0;
+};
+
+class HalFile {
+public:
+    virtual ~HalFile() {}
+    virtual size_t size() = 0;
+    virtual size_t read(uint8_t *buff, size_t len) = 0;
+    virtual size_t write(const uint8_t *buff, size_t len) = 0;
+};
+
+class HalStorage {
+public:
+    virtual bool ready() = 0;
+    virtual bool exists(const char *path) = 0;
+    virtual bool mkdir(const char *path) = 0;
+    virtual bool remove(const char *path) = 0;
+    // nullptr if unable to open, delete to close
+    virtual HalFile *open(const char *path, HalFileModes mode) = 0;
+};
+
+// Non-volatile key/blob store, a blob is replaced as a whole or not at all
+class HalNvs {
+public:
+    // Blob size (may be more than size, then nothing is read), 0 if no such key
+    virtual size_t read(const char *key, void *data, size_t size) = 0;
+    virtual bool write(const char *key, const void *data, size_t size) = 0;
+};
+
+// Raw deflate (RFC 1951) decoder, inflating into its own 32 KB window
+// (halInflater() may not have one when heap is short: then do without gzip)
+class HalInflater {
+public:
+    virtual void reset() = 0;
+    // Inflated spans go to out_cb, len is set to the input consumed (less than given once done)
+    virtual HalInflateResults inflate(const uint8_t *in, size_t *len, HAL_inflate_cb_t out_cb, void *ctx) = 0;
+};
+
+typedef struct {
+    uint32_t free;
+    uint32_t largest_free_block;
+    uint32_t min_free;          // Low-water mark since boot
+} HAL_heap_t;
+
+#ifdef ARDUINO
+#include <WiFiClientSecure.h>
+typedef WiFiClientSecure HalNetClient;
+#else
+#include "../native/posix_client.h"
+typedef PosixClient HalNetClient;
+#endif
+
+
+/**
+ * RGB888 to RGB565
+ *
+ * @param r
+ * @param g
+ * @param b
+ * @return
+ */
+inline uint16_t halColor565(uint8_t r, uint8_t g, uint8_t b) {
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+HalDisplay *halDisplay();
+HalCanvas *halCreateCanvas(int16_t w, int16_t h);
+HalStorage *halStorage();
+HalNvs *halNvs();
+HalInflater *halInflater();
+void halHeap(HAL_heap_t *heap);
+//@formatter:on
+
+#endif // M5SPOT_HAL_H
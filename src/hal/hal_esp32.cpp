@@ -0,0 +1,327 @@
+#include <M5Stack.h>
+#include <esp_heap_caps.h>
+#include <Preferences.h>
+#include <rom/miniz.h>
+#include <new>
+#include "hal.h"
+
+/*
+ * M5Stack implementation of the hardware abstraction layer
+ */
+
+// Inflater (~43 KB: 11 KB of Huffman tables, 32 KB window) is only taken if
+// this much heap is left for TLS records & the web server after it...
+#define INFLATER_HEAP_RESERVE 40960
+#define INFLATER_RETRY_MS 60000         // ...otherwise heap is checked again after this long
+
+class M5Display : public HalDisplay {
+public:
+    int16_t width() override {
+        return M5.Lcd.width();
+    }
+
+    int16_t height() override {
+        return M5.Lcd.height();
+    }
+
+    void fillScreen(uint16_t color) override {
+        M5.Lcd.fillScreen(color);
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) override {
+        M5.Lcd.fillRect(x, y, w, h, color);
+    }
+
+    void drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) override {
+        M5.Lcd.setTextColor(color);
+        M5.Lcd.setTextFont(font);
+        M5.Lcd.setTextSize(1);
+        M5.Lcd.setTextDatum(datum);
+        M5.Lcd.drawString(text, x, y);
+    }
+
+    void pushRect(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *pixels) override {
+        M5.Lcd.pushRect(x, y, w, h, (uint16_t *) pixels);
+    }
+
+    void readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *pixels) override {
+        M5.Lcd.readRect(x, y, w, h, pixels);
+    }
+
+    int16_t textWidth(const char *text, uint8_t font) override {
+        return M5.Lcd.textWidth(text, font);
+    }
+
+    int16_t fontHeight(uint8_t font) override {
+        return M5.Lcd.fontHeight(font);
+    }
+};
+
+// 16 bits sprites keep pixels byte swapped, i.e. in LCD byte order
+class M5Canvas : public HalCanvas {
+public:
+    M5Canvas() : sprite(&M5.Lcd) {}
+
+    ~M5Canvas() override {
+        sprite.deleteSprite();
+    }
+
+    bool begin(int16_t w, int16_t h) {
+        sprite.setColorDepth(16);
+        return sprite.createSprite(w, h) != nullptr;
+    }
+
+    int16_t width() override {
+        return sprite.width();
+    }
+
+    int16_t height() override {
+        return sprite.height();
+    }
+
+    void fillScreen(uint16_t color) override {
+        sprite.fillSprite(color);
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) override {
+        sprite.fillRect(x, y, w, h, color);
+    }
+
+    void drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) override {
+        sprite.setTextColor(color);
+        sprite.setTextFont(font);
+        sprite.setTextSize(1);
+        sprite.setTextDatum(datum);
+        sprite.drawString(text, x, y);
+    }
+
+    void pushRect(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *pixels) override {
+        sprite.pushImage(x, y, w, h, (uint16_t *) pixels);
+    }
+
+    void readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *pixels) override {
+        const uint16_t *buff = buffer();
+        for (int32_t row = 0; row < h; row++) {
+            memcpy(&pixels[row * w], &buff[(y + row) * sprite.width() + x], w * sizeof(uint16_t));
+        }
+    }
+
+    int16_t textWidth(const char *text, uint8_t font) override {
+        return sprite.textWidth(text, font);
+    }
+
+    int16_t fontHeight(uint8_t font) override {
+        return sprite.fontHeight(font);
+    }
+
+    const uint16_t *buffer() override {
+        return (const uint16_t *) sprite.getPointer();
+    }
+
+private:
+    TFT_eSprite sprite;
+};
+
+class SDFile : public HalFile {
+public:
+    explicit SDFile(File file) : file(file) {}
+
+    ~SDFile() override {
+        file.close();
+    }
+
+    size_t size() override {
+        return file.size();
+    }
+
+    size_t read(uint8_t *buff, size_t len) override {
+        return file.read(buff, len);
+    }
+
+    size_t write(const uint8_t *buff, size_t len) override {
+        return file.write(buff, len);
+    }
+
+private:
+    File file;
+};
+
+class SDStorage : public HalStorage {
+public:
+    bool ready() override {
+        return SD.cardType() != CARD_NONE;
+    }
+
+    bool exists(const char *path) override {
+        return SD.exists(path);
+    }
+
+    bool mkdir(const char *path) override {
+        return SD.mkdir(path);
+    }
+
+    bool remove(const char *path) override {
+        return SD.remove(path);
+    }
+
+    HalFile *open(const char *path, HalFileModes mode) override {
+        File file = SD.open(path, mode == hal_write ? FILE_WRITE : FILE_READ);
+        return file ? new SDFile(file) : nullptr;
+    }
+};
+
+// NVS writes a new blob before erasing the old one: an interrupted write leaves the old one
+class M5Nvs : public HalNvs {
+public:
+    size_t read(const char *key, void *data, size_t size) override {
+        if (!begin()) {
+            return 0;
+        }
+        size_t len = prefs.getBytesLength(key);
+        if (len && len <= size) {
+            prefs.getBytes(key, data, len);
+        }
+        return len;
+    }
+
+    bool write(const char *key, const void *data, size_t size) override {
+        return begin() && prefs.putBytes(key, data, size) == size;
+    }
+
+private:
+    Preferences prefs;
+    bool started = false;
+
+    bool begin() {
+        if (!started) {
+            started = prefs.begin("m5spot", false);
+        }
+        return started;
+    }
+};
+
+// tinfl of the ROM, inflating into a circular dictionary
+class M5Inflater : public HalInflater {
+public:
+    void reset() override {
+        tinfl_init(&decomp);
+        dict_ofs = 0;
+    }
+
+    HalInflateResults inflate(const uint8_t *in, size_t *len, HAL_inflate_cb_t out_cb, void *ctx) override {
+        size_t in_ofs = 0;
+        while (true) {
+            size_t in_bytes = *len - in_ofs;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - dict_ofs;
+            tinfl_status status = tinfl_decompress(&decomp, in + in_ofs, &in_bytes, dict, dict + dict_ofs, &out_bytes,
+                                                   TINFL_FLAG_HAS_MORE_INPUT);
+            in_ofs += in_bytes;
+            if (out_bytes) {
+                out_cb((const char *) dict + dict_ofs, out_bytes, ctx);
+            }
+            dict_ofs = (dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+            if (status != TINFL_STATUS_HAS_MORE_OUTPUT) {
+                *len = in_ofs;
+                return status == TINFL_STATUS_DONE ? hal_inflate_done
+                                                   : status < TINFL_STATUS_DONE ? hal_inflate_error : hal_inflate_more;
+            }
+        }
+    }
+
+private:
+    tinfl_decompressor decomp;
+    size_t dict_ofs = 0;
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+};
+
+static M5Display display;
+static SDStorage storage;
+static M5Nvs nvs;
+
+
+/**
+ * Get the display
+ *
+ * @return
+ */
+HalDisplay *halDisplay() {
+    return &display;
+}
+
+
+/**
+ * Create an off-screen canvas (a sprite)
+ *
+ * @param w
+ * @param h
+ * @return nullptr if out of memory
+ */
+HalCanvas *halCreateCanvas(int16_t w, int16_t h) {
+    M5Canvas *canvas = new M5Canvas();
+    if (!canvas->begin(w, h)) {
+        delete canvas;
+        return nullptr;
+    }
+    return canvas;
+}
+
+
+/**
+ * Get the storage (SD card)
+ *
+ * @return
+ */
+HalStorage *halStorage() {
+    return &storage;
+}
+
+
+/**
+ * Get the settings store (NVS partition)
+ *
+ * @return
+ */
+HalNvs *halNvs() {
+    return &nvs;
+}
+
+
+/**
+ * Get the inflater, allocated on first use then kept (a 43 KB block freed
+ * and taken again after each response would fragment the heap)
+ *
+ * Only allocated if it fits in one block with INFLATER_HEAP_RESERVE free
+ * besides; until then, callers go without (no gzip responses), and heap
+ * is checked again every INFLATER_RETRY_MS at most.
+ *
+ * @return nullptr if not affordable
+ */
+HalInflater *halInflater() {
+    static M5Inflater *inflater = nullptr;
+    static bool checked = false;
+    static uint32_t checked_millis = 0;
+
+    if (!inflater && (!checked || millis() - checked_millis >= INFLATER_RETRY_MS)) {
+        checked = true;
+        checked_millis = millis();
+        HAL_heap_t heap;
+        halHeap(&heap);
+        if (heap.largest_free_block >= sizeof(M5Inflater) && heap.free >= sizeof(M5Inflater) + INFLATER_HEAP_RESERVE) {
+            inflater = new(std::nothrow) M5Inflater();
+        }
+    }
+    return inflater;
+}
+
+
+/**
+ * Get heap usage (8 bits capable memory, i.e. what malloc() uses)
+ *
+ * @param heap
+ */
+void halHeap(HAL_heap_t *heap) {
+    heap->free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heap->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    heap->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+}
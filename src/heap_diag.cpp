@@ -0,0 +1,114 @@
+#include <Arduino.h>
+#include "hal/hal.h"
+#include "heap_diag.h"
+#include "arena.h"
+
+/*
+ * Heap diagnostics
+ *
+ * What the hot paths still allocate from the heap (mostly copies made by
+ * libraries) is reported by call sites with heapTrack(), per cycle buffers
+ * come from the arena. Heap state is sampled every hour by the
+ * network task into a ring, so /heapstats shows how free memory and
+ * fragmentation evolve on long running units.
+ */
+
+static const char *site_names[hs_site_count] = {
+        "token", "event_serialize", "album_art"
+};
+
+static HEAP_site_t sites[hs_site_count];
+static HEAP_sample_t history[HEAP_HISTORY_SIZE];
+static uint16_t history_len = 0;
+static uint16_t history_next = 0;
+static uint32_t last_sample_millis = 0;
+static uint32_t uptime_s = 0;
+
+
+/**
+ * Fragmentation, in %: how much of the free heap can't be had in one block
+ *
+ * @param free
+ * @param largest_free_block
+ * @return
+ */
+static uint8_t fragmentation(uint32_t free, uint32_t largest_free_block) {
+    return free ? 100 - (uint64_t) largest_free_block * 100 / free : 0;
+}
+
+
+/**
+ * Record an allocation
+ *
+ * @param site
+ * @param bytes
+ */
+void heapTrack(HeapSites site, size_t bytes) {
+    HEAP_site_t &s = sites[site];
+    s.count++;
+    s.bytes += bytes;
+    if (bytes > s.max_bytes) {
+        s.max_bytes = bytes;
+    }
+}
+
+
+/**
+ * Sample heap state into history, once per HEAP_HISTORY_PERIOD_MS
+ * (and right away on first call)
+ */
+void heapDiagLoop() {
+    uint32_t cur_millis = millis();
+    if (history_len && cur_millis - last_sample_millis < HEAP_HISTORY_PERIOD_MS) {
+        return;
+    }
+    uptime_s += history_len ? (cur_millis - last_sample_millis) / 1000 : cur_millis / 1000;
+    last_sample_millis = cur_millis;
+
+    HAL_heap_t heap;
+    halHeap(&heap);
+
+    history[history_next] = {uptime_s, heap.free, heap.largest_free_block, heap.min_free};
+    history_next = (history_next + 1) % HEAP_HISTORY_SIZE;
+    if (history_len < HEAP_HISTORY_SIZE) {
+        history_len++;
+    }
+}
+
+
+/**
+ * Write the diagnostics report, line by line
+ *
+ * @param write
+ * @param ctx
+ */
+void heapDiagWrite(HEAP_write_cb_t write, void *ctx) {
+    char line[128];
+    HAL_heap_t heap;
+    halHeap(&heap);
+
+    snprintf(line, sizeof(line), "free: %u\nlargest_free_block: %u\nmin_free: %u\nfragmentation: %u%%\n",
+             heap.free, heap.largest_free_block, heap.min_free,
+             fragmentation(heap.free, heap.largest_free_block));
+    write(line, ctx);
+
+    const ARENA_stats_t &arena = arenaStats();
+    snprintf(line, sizeof(line), "\narena_size: %u\narena_high_water: %u\narena_overflows: %u\narena_resets: %u\n",
+             (unsigned) ARENA_SIZE, arena.high_water, arena.overflows, arena.resets);
+    write(line, ctx);
+
+    write("\nsite: count bytes max_bytes\n", ctx);
+    for (uint8_t i = 0; i < hs_site_count; i++) {
+        snprintf(line, sizeof(line), "%s: %u %u %u\n", site_names[i], sites[i].count, sites[i].bytes,
+                 sites[i].max_bytes);
+        write(line, ctx);
+    }
+
+    write("\nuptime_s: free largest_free_block min_free fragmentation\n", ctx);
+    for (uint16_t i = 0; i < history_len; i++) {
+        const HEAP_sample_t &h = history[(history_next + HEAP_HISTORY_SIZE - history_len + i) % HEAP_HISTORY_SIZE];
+        snprintf(line, sizeof(line), "%u: %u %u %u %u%%\n", h.uptime_s, h.free, h.largest_free_block, h.min_free,
+                 fragmentation(h.free, h.largest_free_block));
+        write(line, ctx);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef M5SPOT_HEAP_DIAG_H
+#define M5SPOT_HEAP_DIAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Heap diagnostics: fragmentation, low-water mark, allocations of the hot
+ * paths by call site, arena usage, and a history of samples to follow
+ * trends over days
+ */
+
+#define HEAP_HISTORY_SIZE 168               // One week...
+#define HEAP_HISTORY_PERIOD_MS 3600000      // ...of hourly samples
+
+enum HeapSites {
+    hs_token, hs_event_serialize, hs_album_art, hs_site_count
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t max_bytes;     // Biggest single allocation
+} HEAP_site_t;
+
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t free;
+    uint32_t largest_free_block;
+    uint32_t min_free;
+} HEAP_sample_t;
+
+typedef void (*HEAP_write_cb_t)(const char *line, void *ctx);
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void heapTrack(HeapSites site, size_t bytes);
+void heapDiagLoop();
+void heapDiagWrite(HEAP_write_cb_t write, void *ctx);
+//@formatter:on
+
+#endif // M5SPOT_HEAP_DIAG_H
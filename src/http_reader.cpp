@@ -0,0 +1,369 @@
+#include <Arduino.h>
+#include "http_reader.h"
+
+/*
+ * HTTP/1.1 response reader
+ *
+ * Bytes are read from the socket into a ring buffer. Header lines and body
+ * chunks are handed to the callbacks as spans pointing into that buffer;
+ * only a header line wrapping around the end of the ring is copied.
+ */
+
+#define HR_MASK (HTTP_READER_BUFF_SIZE - 1)
+
+
+/**
+ * Find the end of the next line
+ *
+ * @param r
+ * @param eol   Position of '\n'
+ * @return false if there is no complete line yet
+ */
+static bool findEOL(HTTP_reader_t *r, uint32_t *eol) {
+    for (uint32_t p = r->rd; p != r->wr; p++) {
+        if (r->buff[p & HR_MASK] == '\n') {
+            *eol = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Get the next line as a contiguous span, without its CRLF
+ *
+ * @param r
+ * @param line
+ * @param len
+ * @return false if there is no complete line yet
+ */
+static bool nextLine(HTTP_reader_t *r, const char **line, uint16_t *len) {
+    uint32_t eol;
+    if (!findEOL(r, &eol)) {
+        return false;
+    }
+
+    uint32_t size = eol - r->rd;
+    uint32_t start = r->rd & HR_MASK;
+
+    if (start + size <= HTTP_READER_BUFF_SIZE) {
+        *line = &r->buff[start];
+    } else {
+        // Line wraps around the end of the ring
+        if (size > HTTP_READER_LINE_SIZE) {
+            size = HTTP_READER_LINE_SIZE;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            r->line[i] = r->buff[(r->rd + i) & HR_MASK];
+        }
+        *line = r->line;
+    }
+
+    if (size && (*line)[size - 1] == '\r') {
+        size--;
+    }
+    *len = size;
+    r->rd = eol + 1;
+    return true;
+}
+
+
+/**
+ * Handle a response header line
+ *
+ * @param r
+ * @param line
+ * @param len
+ */
+static void parseHeader(HTTP_reader_t *r, const char *line, uint16_t len) {
+    HTTP_header_t header = {line, len, 0, line, len};
+
+    if (r->state == hr_status) {
+        // HTTP/1.x nnn Reason
+        if (len >= 12 && strncmp(line, "HTTP/1.", 7) == 0) {
+            r->keep_alive = line[7] == '1';
+            r->httpCode = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+        }
+    } else {
+        const char *colon = (const char *) memchr(line, ':', len);
+        if (!colon) {
+            return;
+        }
+        header.name_len = colon - line;
+        header.value = colon + 1;
+        while (header.value < line + len && *header.value == ' ') {
+            header.value++;
+        }
+        header.value_len = line + len - header.value;
+
+        if (header.name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+            r->content_length = strtol(header.value, nullptr, 10);
+        } else if (header.name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+            r->chunked = header.value_len >= 7 && strncasecmp(header.value + header.value_len - 7, "chunked", 7) == 0;
+        } else if (header.name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+            r->keep_alive = !(header.value_len == 5 && strncasecmp(header.value, "close", 5) == 0);
+        }
+    }
+
+    if (r->header_cb) {
+        r->header_cb(header, r->ctx);
+    }
+}
+
+
+/**
+ * Choose how the body is delimited, once all headers are read
+ *
+ * @param r
+ */
+static void endOfHeaders(HTTP_reader_t *r) {
+    if (r->httpCode >= 100 && r->httpCode < 200) {
+        // Interim response, the real one follows
+        r->state = hr_status;
+        r->content_length = -1;
+        r->chunked = false;
+    } else if (r->httpCode == 204 || r->httpCode == 304) {
+        r->state = hr_done;
+    } else if (r->chunked) {
+        r->state = hr_chunk_size;
+    } else if (r->content_length >= 0) {
+        r->remaining = r->content_length;
+        r->state = r->remaining ? hr_body_length : hr_done;
+    } else {
+        // Body delimited by the server closing the connection
+        r->keep_alive = false;
+        r->state = hr_body_close;
+    }
+}
+
+
+/**
+ * Hand buffered body bytes to the body callback
+ *
+ * @param r
+ * @param max_len
+ * @return Number of bytes consumed
+ */
+static uint32_t emitBody(HTTP_reader_t *r, uint32_t max_len) {
+    uint32_t len = r->wr - r->rd;
+    uint32_t start = r->rd & HR_MASK;
+    if (len > max_len) {
+        len = max_len;
+    }
+    if (start + len > HTTP_READER_BUFF_SIZE) {
+        // Only up to the ring end, the rest comes with the next call
+        len = HTTP_READER_BUFF_SIZE - start;
+    }
+    if (len && r->body_cb) {
+        r->body_cb(&r->buff[start], len, r->ctx);
+    }
+    r->rd += len;
+    r->body_size += len;
+    return len;
+}
+
+
+/**
+ * Initialize reader
+ *
+ * @param r
+ * @param header_cb     Called for each header line (may be nullptr)
+ * @param body_cb       Called for each body span (may be nullptr)
+ * @param ctx           User context passed to callbacks
+ */
+void httpReaderInit(HTTP_reader_t *r, HTTP_header_cb_t header_cb, HTTP_body_cb_t body_cb, void *ctx) {
+    r->rd = 0;
+    r->wr = 0;
+    r->state = hr_status;
+    r->httpCode = 0;
+    r->content_length = -1;
+    r->remaining = 0;
+    r->body_size = 0;
+    r->chunked = false;
+    r->keep_alive = true;
+    r->header_cb = header_cb;
+    r->body_cb = body_cb;
+    r->ctx = ctx;
+}
+
+
+/**
+ * Get ready for the next response on the same connection (pipelined
+ * requests): bytes read beyond the previous response are kept
+ *
+ * @param r
+ * @param ctx   User context passed to callbacks
+ */
+void httpReaderNext(HTTP_reader_t *r, void *ctx) {
+    uint32_t rd = r->rd;
+    uint32_t wr = r->wr;
+    httpReaderInit(r, r->header_cb, r->body_cb, ctx);
+    r->rd = rd;
+    r->wr = wr;
+}
+
+
+/**
+ * Get the free contiguous area of the ring buffer
+ *
+ * @param r
+ * @param dest
+ * @return Area size
+ */
+size_t httpReaderWritable(HTTP_reader_t *r, char **dest) {
+    uint32_t start = r->wr & HR_MASK;
+    uint32_t space = HTTP_READER_BUFF_SIZE - (r->wr - r->rd);
+    *dest = &r->buff[start];
+    return space < HTTP_READER_BUFF_SIZE - start ? space : HTTP_READER_BUFF_SIZE - start;
+}
+
+
+/**
+ * Declare bytes written into the area given by httpReaderWritable()
+ *
+ * @param r
+ * @param len
+ */
+void httpReaderCommit(HTTP_reader_t *r, size_t len) {
+    r->wr += len;
+}
+
+
+/**
+ * Parse as much buffered data as possible
+ *
+ * @param r
+ * @return false if nothing could be done without more data
+ */
+bool httpReaderProcess(HTTP_reader_t *r) {
+    bool progress = false;
+    const char *line;
+    uint16_t len;
+
+    while (r->state != hr_done) {
+        switch (r->state) {
+
+            case hr_status:
+            case hr_headers:
+                if (!nextLine(r, &line, &len)) {
+                    return progress;
+                }
+                if (len == 0) {
+                    if (r->state == hr_headers) {
+                        endOfHeaders(r);
+                    }
+                } else {
+                    parseHeader(r, line, len);
+                    r->state = hr_headers;
+                }
+                break;
+
+            case hr_body_length:
+            case hr_chunk_data:
+                if (r->rd == r->wr) {
+                    return progress;
+                }
+                r->remaining -= emitBody(r, r->remaining);
+                if (r->remaining == 0) {
+                    r->state = r->state == hr_chunk_data ? hr_chunk_end : hr_done;
+                }
+                break;
+
+            case hr_body_close:
+                if (r->rd == r->wr) {
+                    return progress;
+                }
+                emitBody(r, UINT32_MAX);
+                break;
+
+            case hr_chunk_size:
+                if (!nextLine(r, &line, &len)) {
+                    return progress;
+                }
+                if (len == 0) {
+                    break;
+                }
+                r->remaining = strtoul(line, nullptr, 16);
+                r->state = r->remaining ? hr_chunk_data : hr_trailer;
+                break;
+
+            case hr_chunk_end:
+                // CRLF closing chunk data
+                if (!nextLine(r, &line, &len)) {
+                    return progress;
+                }
+                r->state = hr_chunk_size;
+                break;
+
+            case hr_trailer:
+                if (!nextLine(r, &line, &len)) {
+                    return progress;
+                }
+                if (len == 0) {
+                    r->state = hr_done;
+                }
+                break;
+
+            default:
+                break;
+        }
+        progress = true;
+    }
+
+    return progress;
+}
+
+
+/**
+ * Read a whole response from client
+ *
+ * Instead of sleeping for a fixed delay when no data is available,
+ * the reader yields for a single tick and checks the socket again.
+ *
+ * @param r
+ * @param client
+ * @param timeout_ms    Maximum delay without receiving anything
+ * @return
+ */
+HttpReaderResults httpReaderRun(HTTP_reader_t *r, Client &client, uint32_t timeout_ms) {
+    uint32_t lastAvailableMillis = millis();
+
+    while (true) {
+        httpReaderProcess(r);
+        if (r->state == hr_done) {
+            return hr_complete;
+        }
+
+        char *dest;
+        size_t space = httpReaderWritable(r, &dest);
+        if (space == 0) {
+            // A header line larger than the whole buffer
+            return hr_error;
+        }
+
+        int availableSize = client.available();
+        if (availableSize > 0) {
+            int readSize = client.read((uint8_t *) dest, space < (size_t) availableSize ? space : availableSize);
+            if (readSize > 0) {
+                httpReaderCommit(r, readSize);
+                lastAvailableMillis = millis();
+                continue;
+            }
+        }
+
+        if (!client.connected()) {
+            if (r->state == hr_body_close) {
+                r->state = hr_done;
+                return hr_complete;
+            }
+            return hr_closed;
+        }
+
+        if (millis() - lastAvailableMillis > timeout_ms) {
+            return hr_timeout;
+        }
+
+        vTaskDelay(1);
+    }
+}
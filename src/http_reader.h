@@ -0,0 +1,63 @@
+#ifndef M5SPOT_HTTP_READER_H
+#define M5SPOT_HTTP_READER_H
+
+#include <Client.h>
+
+#define HTTP_READER_BUFF_SIZE 2048  // Must be a power of 2
+#define HTTP_READER_LINE_SIZE 256   // Scratch line for headers wrapping around the ring end
+
+enum HttpReaderStates {
+    hr_status, hr_headers, hr_body_length, hr_body_close,
+    hr_chunk_size, hr_chunk_data, hr_chunk_end, hr_trailer, hr_done
+};
+
+enum HttpReaderResults {
+    hr_complete, hr_timeout, hr_closed, hr_error
+};
+
+/*
+ * Header line, pointing into the reader buffer (valid during the callback only).
+ * For the status line, name_len is 0 and value is the whole line.
+ */
+typedef struct {
+    const char *line;
+    uint16_t len;
+    uint16_t name_len;
+    const char *value;
+    uint16_t value_len;
+} HTTP_header_t;
+
+typedef void (*HTTP_header_cb_t)(const HTTP_header_t &header, void *ctx);
+typedef void (*HTTP_body_cb_t)(const char *data, size_t len, void *ctx);
+
+typedef struct {
+    char buff[HTTP_READER_BUFF_SIZE];
+    char line[HTTP_READER_LINE_SIZE];
+    uint32_t rd;
+    uint32_t wr;
+    HttpReaderStates state;
+    int httpCode;
+    int32_t content_length;
+    uint32_t remaining;
+    uint32_t body_size;
+    bool chunked;
+    bool keep_alive;
+    HTTP_header_cb_t header_cb;
+    HTTP_body_cb_t body_cb;
+    void *ctx;
+} HTTP_reader_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void httpReaderInit(HTTP_reader_t *r, HTTP_header_cb_t header_cb, HTTP_body_cb_t body_cb, void *ctx);
+void httpReaderNext(HTTP_reader_t *r, void *ctx);
+HttpReaderResults httpReaderRun(HTTP_reader_t *r, Client &client, uint32_t timeout_ms);
+bool httpReaderProcess(HTTP_reader_t *r);
+size_t httpReaderWritable(HTTP_reader_t *r, char **dest);
+void httpReaderCommit(HTTP_reader_t *r, size_t len);
+//@formatter:on
+
+#endif // M5SPOT_HTTP_READER_H
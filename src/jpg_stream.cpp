@@ -0,0 +1,172 @@
+#include <M5Stack.h>
+#include <rom/tjpgd.h>
+#include "hal/hal.h"
+#include "jpg_stream.h"
+
+/*
+ * Progressive JPEG drawing
+ *
+ * TJpgDec (in ESP32 ROM) pulls bytes from the network stream as it needs them
+ * and each decoded MCU block is pushed to the LCD right away, so album art
+ * shows up while it is still downloading, without any intermediate file.
+ * It can be decoded off screen into a canvas just the same (prefetch).
+ *
+ * Images are scaled down by TJpgDec (1/2, 1/4 or 1/8) as much as possible
+ * while still covering the target box, then centered and cropped to it.
+ * Decoding stops below the box.
+ */
+
+typedef struct {
+    HalDisplay *display;
+    Stream *stream;
+    int32_t remaining;      // -1 if size is unknown
+    int16_t x;              // Of the decoded image, may be outside of the box
+    int16_t y;
+    int16_t box_x;
+    int16_t box_y;
+    int16_t box_w;
+    int16_t box_h;
+    bool timeout;
+} JPG_stream_ctx_t;
+
+static uint8_t work[JPG_STREAM_WORK_SIZE];
+
+
+/**
+ * TJpgDec input function: read (or skip if buff is NULL) len bytes from stream
+ *
+ * @param jd
+ * @param buff
+ * @param len
+ * @return Number of bytes read
+ */
+static UINT jpgStreamInput(JDEC *jd, BYTE *buff, UINT len) {
+    JPG_stream_ctx_t *ctx = (JPG_stream_ctx_t *) jd->device;
+
+    if (ctx->remaining >= 0 && len > (UINT) ctx->remaining) {
+        len = ctx->remaining;
+    }
+
+    UINT done = 0;
+    uint32_t lastAvailableMillis = millis();
+
+    while (done < len) {
+        int availableSize = ctx->stream->available();
+        if (availableSize <= 0) {
+            if (millis() - lastAvailableMillis > JPG_STREAM_TIMEOUT_MS) {
+                ctx->timeout = true;
+                break;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+        lastAvailableMillis = millis();
+
+        UINT chunk = len - done < (UINT) availableSize ? len - done : availableSize;
+        if (buff) {
+            chunk = ctx->stream->readBytes(&buff[done], chunk);
+        } else {
+            for (UINT i = 0; i < chunk; i++) {
+                ctx->stream->read();
+            }
+        }
+        done += chunk;
+    }
+
+    if (ctx->remaining >= 0) {
+        ctx->remaining -= done;
+    }
+    return done;
+}
+
+
+/**
+ * TJpgDec output function: push the part of a decoded block that is in the box to the display
+ *
+ * @param jd
+ * @param bitmap    RGB888 pixels
+ * @param rect
+ * @return 0 to stop decoding once below the box
+ */
+static UINT jpgStreamOutput(JDEC *jd, void *bitmap, JRECT *rect) {
+    JPG_stream_ctx_t *ctx = (JPG_stream_ctx_t *) jd->device;
+
+    int16_t left = ctx->x + rect->left;
+    int16_t top = ctx->y + rect->top;
+    if (top >= ctx->box_y + ctx->box_h) {
+        return 0;
+    }
+
+    uint16_t w = rect->right - rect->left + 1;
+    uint16_t h = rect->bottom - rect->top + 1;
+    uint8_t *rgb = (uint8_t *) bitmap;
+
+    // Convert in place, RGB565 in LCD byte order takes less room than RGB888
+    uint16_t *pixels = (uint16_t *) bitmap;
+    for (uint32_t i = 0; i < (uint32_t) w * h; i++, rgb += 3) {
+        uint16_t c = M5.Lcd.color565(rgb[0], rgb[1], rgb[2]);
+        pixels[i] = (c >> 8) | (c << 8);
+    }
+
+    // Crop to the box
+    int16_t x0 = max(left, ctx->box_x);
+    int16_t y0 = max(top, ctx->box_y);
+    int16_t x1 = min(left + w, ctx->box_x + ctx->box_w);
+    int16_t y1 = min(top + h, ctx->box_y + ctx->box_h);
+    if (x0 >= x1 || y0 >= y1) {
+        return 1;
+    }
+
+    const uint16_t *start = &pixels[(y0 - top) * w + (x0 - left)];
+    if (x1 - x0 == w) {
+        ctx->display->pushRect(x0, y0, w, y1 - y0, start);
+    } else {
+        for (int16_t row = 0; row < y1 - y0; row++) {
+            ctx->display->pushRect(x0, y0 + row, x1 - x0, 1, &start[row * w]);
+        }
+    }
+    return 1;
+}
+
+
+/**
+ * Decode a JPEG from a stream and draw it progressively into a box
+ *
+ * Boxes not covered by the image are cleared first.
+ *
+ * @param display   LCD, or canvas
+ * @param stream
+ * @param size      JPEG size, or -1 if unknown
+ * @param x         Box
+ * @param y
+ * @param w
+ * @param h
+ * @return
+ */
+JpgStreamResults jpgStreamDraw(HalDisplay *display, Stream *stream, int32_t size, int16_t x, int16_t y, int16_t w,
+                               int16_t h) {
+    JDEC jd;
+    JPG_stream_ctx_t ctx = {display, stream, size, x, y, x, y, w, h, false};
+
+    if (jd_prepare(&jd, jpgStreamInput, work, sizeof(work), &ctx) != JDR_OK) {
+        return ctx.timeout ? jpg_timeout : jpg_prepare_error;
+    }
+
+    uint8_t scale = 0;
+    while (scale < 3 && (jd.width >> (scale + 1)) >= w && (jd.height >> (scale + 1)) >= h) {
+        scale++;
+    }
+    int16_t scaled_w = jd.width >> scale;
+    int16_t scaled_h = jd.height >> scale;
+    ctx.x = x + (w - scaled_w) / 2;
+    ctx.y = y + (h - scaled_h) / 2;
+    if (scaled_w < w || scaled_h < h) {
+        display->fillRect(x, y, w, h, HAL_WHITE);
+    }
+
+    JRESULT res = jd_decomp(&jd, jpgStreamOutput, scale);
+    if (ctx.timeout) {
+        return jpg_timeout;
+    }
+    return (res == JDR_OK || res == JDR_INTR) ? jpg_ok : jpg_decode_error;
+}
@@ -0,0 +1,23 @@
+#ifndef M5SPOT_JPG_STREAM_H
+#define M5SPOT_JPG_STREAM_H
+
+#include <Stream.h>
+
+class HalDisplay;
+
+#define JPG_STREAM_WORK_SIZE 3100   // TJpgDec work area
+#define JPG_STREAM_TIMEOUT_MS 5000
+
+enum JpgStreamResults {
+    jpg_ok, jpg_prepare_error, jpg_decode_error, jpg_timeout
+};
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+JpgStreamResults jpgStreamDraw(HalDisplay *display, Stream *stream, int32_t size, int16_t x, int16_t y, int16_t w, int16_t h);
+//@formatter:on
+
+#endif // M5SPOT_JPG_STREAM_H
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <string.h>
+#include "json_stream.h"
+
+/*
+ * Minimal push parser: scalars are reported through the callback as they are
+ * read, nothing but the current path and the current value is kept in memory.
+ * Strings longer than JSON_STREAM_VALUE_SIZE are truncated.
+ */
+
+
+/**
+ * Append chars to the current path, silently truncating it
+ *
+ * @param js
+ * @param str
+ * @param len
+ */
+static void pathAppend(JSON_stream_t *js, const char *str, size_t len) {
+    size_t room = JSON_STREAM_PATH_SIZE - 1 - js->path_len;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(&js->path[js->path_len], str, len);
+    js->path_len += len;
+    js->path[js->path_len] = '\0';
+}
+
+
+/**
+ * Append a byte to the current value
+ *
+ * @param js
+ * @param c
+ */
+static void valueAppend(JSON_stream_t *js, char c) {
+    if (js->value_len < JSON_STREAM_VALUE_SIZE - 1) {
+        js->value[js->value_len++] = c;
+    } else {
+        js->truncated = true;
+    }
+}
+
+
+/**
+ * Append an unicode code point to the current value, UTF-8 encoded
+ *
+ * @param js
+ * @param cp
+ */
+static void valueAppendCodePoint(JSON_stream_t *js, uint32_t cp) {
+    if (cp < 0x80) {
+        valueAppend(js, (char) cp);
+    } else if (cp < 0x800) {
+        valueAppend(js, (char) (0xC0 | (cp >> 6)));
+        valueAppend(js, (char) (0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        valueAppend(js, (char) (0xE0 | (cp >> 12)));
+        valueAppend(js, (char) (0x80 | ((cp >> 6) & 0x3F)));
+        valueAppend(js, (char) (0x80 | (cp & 0x3F)));
+    } else {
+        valueAppend(js, (char) (0xF0 | (cp >> 18)));
+        valueAppend(js, (char) (0x80 | ((cp >> 12) & 0x3F)));
+        valueAppend(js, (char) (0x80 | ((cp >> 6) & 0x3F)));
+        valueAppend(js, (char) (0x80 | (cp & 0x3F)));
+    }
+}
+
+
+/**
+ * Report the current scalar value
+ *
+ * @param js
+ * @param type
+ */
+static void emitValue(JSON_stream_t *js, JsonStreamTypes type) {
+    js->value[js->value_len] = '\0';
+    if (js->cb) {
+        js->cb(js, js->path, js->value, type);
+    }
+    js->value_len = 0;
+    js->truncated = false;
+    js->state = js->depth ? js_after_value : js_done;
+}
+
+
+/**
+ * Open an object or an array
+ *
+ * @param js
+ * @param is_array
+ * @return
+ */
+static bool pushLevel(JSON_stream_t *js, bool is_array) {
+    if (js->depth >= JSON_STREAM_MAX_DEPTH) {
+        return false;
+    }
+    if (is_array) {
+        pathAppend(js, "[]", 2);
+    }
+    JSON_level_t &level = js->levels[js->depth++];
+    level.is_array = is_array;
+    level.base_len = js->path_len;
+    level.index = 0;
+    js->state = is_array ? js_value_or_end : js_key_or_end;
+    return true;
+}
+
+
+/**
+ * Close an object or an array
+ *
+ * @param js
+ * @param is_array
+ * @return
+ */
+static bool popLevel(JSON_stream_t *js, bool is_array) {
+    if (!js->depth || js->levels[js->depth - 1].is_array != is_array) {
+        return false;
+    }
+    js->depth--;
+    js->state = js->depth ? js_after_value : js_done;
+    return true;
+}
+
+
+/**
+ * Initialize parser
+ *
+ * @param js
+ * @param cb    Called for each scalar value
+ * @param ctx   User context, available as js->ctx in the callback
+ */
+void jsonStreamInit(JSON_stream_t *js, JSON_value_cb_t cb, void *ctx) {
+    memset(js, 0, sizeof(JSON_stream_t));
+    js->cb = cb;
+    js->ctx = ctx;
+    js->state = js_value;
+}
+
+
+/**
+ * Feed parser with the next bytes of the document
+ *
+ * @param js
+ * @param data
+ * @param len
+ * @return false on syntax error
+ */
+bool jsonStreamFeed(JSON_stream_t *js, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        switch (js->state) {
+
+            case js_string:
+                if (c == '"') {
+                    if (js->is_key) {
+                        JSON_level_t &level = js->levels[js->depth - 1];
+                        js->path_len = level.base_len;
+                        js->path[js->path_len] = '\0';
+                        if (js->path_len) {
+                            pathAppend(js, ".", 1);
+                        }
+                        pathAppend(js, js->value, js->value_len);
+                        js->value_len = 0;
+                        js->truncated = false;
+                        js->state = js_colon;
+                    } else {
+                        emitValue(js, json_string);
+                    }
+                } else if (c == '\\') {
+                    js->state = js_string_esc;
+                } else {
+                    valueAppend(js, c);
+                }
+                continue;
+
+            case js_string_esc:
+                js->state = js_string;
+                switch (c) {
+                    case 'b': valueAppend(js, '\b'); break;
+                    case 'f': valueAppend(js, '\f'); break;
+                    case 'n': valueAppend(js, '\n'); break;
+                    case 'r': valueAppend(js, '\r'); break;
+                    case 't': valueAppend(js, '\t'); break;
+                    case 'u':
+                        js->u_count = 0;
+                        js->u_code = 0;
+                        js->state = js_string_u;
+                        break;
+                    default:
+                        valueAppend(js, c);
+                }
+                continue;
+
+            case js_string_u: {
+                uint8_t nibble;
+                if (c >= '0' && c <= '9') {
+                    nibble = c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    nibble = c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    nibble = c - 'A' + 10;
+                } else {
+                    js->state = js_error;
+                    return false;
+                }
+                js->u_code = (js->u_code << 4) | nibble;
+                if (++js->u_count == 4) {
+                    js->state = js_string;
+                    if (js->u_code >= 0xD800 && js->u_code < 0xDC00) {
+                        js->u_high = js->u_code;
+                    } else if (js->u_code >= 0xDC00 && js->u_code < 0xE000 && js->u_high) {
+                        valueAppendCodePoint(js, 0x10000 + ((js->u_high - 0xD800) << 10) + (js->u_code - 0xDC00));
+                        js->u_high = 0;
+                    } else {
+                        valueAppendCodePoint(js, js->u_code);
+                        js->u_high = 0;
+                    }
+                }
+                continue;
+            }
+
+            case js_literal:
+                if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E') {
+                    valueAppend(js, c);
+                    continue;
+                }
+                js->value[js->value_len] = '\0';
+                if (js->value[0] == 't' || js->value[0] == 'f') {
+                    emitValue(js, json_bool);
+                } else if (js->value[0] == 'n') {
+                    emitValue(js, json_null);
+                } else {
+                    emitValue(js, json_number);
+                }
+                // Current char still has to be processed
+                break;
+
+            default:
+                break;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+
+        switch (js->state) {
+
+            case js_value_or_end:
+                if (c == ']') {
+                    if (!popLevel(js, true)) {
+                        js->state = js_error;
+                        return false;
+                    }
+                    continue;
+                }
+                // fall through
+
+            case js_value:
+                if (c == '{') {
+                    if (!pushLevel(js, false)) {
+                        js->state = js_error;
+                        return false;
+                    }
+                } else if (c == '[') {
+                    if (!pushLevel(js, true)) {
+                        js->state = js_error;
+                        return false;
+                    }
+                } else if (c == '"') {
+                    js->is_key = false;
+                    js->value_len = 0;
+                    js->u_high = 0;
+                    js->state = js_string;
+                } else if ((c >= '0' && c <= '9') || c == '-' || c == 't' || c == 'f' || c == 'n') {
+                    js->value_len = 0;
+                    valueAppend(js, c);
+                    js->state = js_literal;
+                } else {
+                    js->state = js_error;
+                    return false;
+                }
+                break;
+
+            case js_key_or_end:
+                if (c == '}') {
+                    if (!popLevel(js, false)) {
+                        js->state = js_error;
+                        return false;
+                    }
+                    break;
+                }
+                // fall through
+
+            case js_key:
+                if (c != '"') {
+                    js->state = js_error;
+                    return false;
+                }
+                js->is_key = true;
+                js->value_len = 0;
+                js->u_high = 0;
+                js->state = js_string;
+                break;
+
+            case js_colon:
+                if (c != ':') {
+                    js->state = js_error;
+                    return false;
+                }
+                js->state = js_value;
+                break;
+
+            case js_after_value: {
+                JSON_level_t &level = js->levels[js->depth - 1];
+                if (c == ',') {
+                    if (level.is_array) {
+                        level.index++;
+                        js->path_len = level.base_len;
+                        js->path[js->path_len] = '\0';
+                        js->state = js_value;
+                    } else {
+                        js->state = js_key;
+                    }
+                } else if (c == '}' || c == ']') {
+                    if (!popLevel(js, c == ']')) {
+                        js->state = js_error;
+                        return false;
+                    }
+                } else {
+                    js->state = js_error;
+                    return false;
+                }
+                break;
+            }
+
+            case js_done:
+            case js_error:
+            default:
+                js->state = js_error;
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Check if a whole document has been parsed
+ *
+ * @param js
+ * @return
+ */
+bool jsonStreamDone(const JSON_stream_t *js) {
+    return js->state == js_done;
+}
+
+
+/**
+ * Get the index of the current element of an enclosing array
+ *
+ * @param js
+ * @param array_nr  0 for the outermost array, 1 for the next one...
+ * @return Element index, or 0xFFFF if there is no such array
+ */
+uint16_t jsonStreamIndex(const JSON_stream_t *js, uint8_t array_nr) {
+    for (uint8_t i = 0; i < js->depth; i++) {
+        if (js->levels[i].is_array) {
+            if (array_nr == 0) {
+                return js->levels[i].index;
+            }
+            array_nr--;
+        }
+    }
+    return 0xFFFF;
+}
+
+
+/**
+ * Escape a string to be written as a JSON string value (without the quotes)
+ *
+ * @param dest
+ * @param size
+ * @param src
+ * @return Length written, truncated on a whole char
+ */
+size_t jsonEscape(char *dest, size_t size, const char *src) {
+    size_t len = 0;
+    if (!size) {
+        return 0;
+    }
+    for (; *src; src++) {
+        char esc[7];
+        unsigned char c = (unsigned char) *src;
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\', esc[1] = c, esc[2] = '\0';
+        } else if (c == '\n') {
+            strcpy(esc, "\\n");
+        } else if (c == '\r') {
+            strcpy(esc, "\\r");
+        } else if (c == '\t') {
+            strcpy(esc, "\\t");
+        } else if (c < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+        } else {
+            esc[0] = c, esc[1] = '\0';
+        }
+        size_t esc_len = strlen(esc);
+        if (len + esc_len >= size) {
+            break;
+        }
+        memcpy(&dest[len], esc, esc_len);
+        len += esc_len;
+    }
+    dest[len] = '\0';
+    return len;
+}
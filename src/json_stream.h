@@ -0,0 +1,64 @@
+#ifndef M5SPOT_JSON_STREAM_H
+#define M5SPOT_JSON_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JSON_STREAM_MAX_DEPTH 12
+#define JSON_STREAM_PATH_SIZE 96
+#define JSON_STREAM_VALUE_SIZE 400 // Fits access tokens
+
+enum JsonStreamTypes {
+    json_string, json_number, json_bool, json_null
+};
+
+enum JsonStreamStates {
+    js_value, js_value_or_end, js_key_or_end, js_key, js_colon, js_after_value,
+    js_string, js_string_esc, js_string_u, js_literal, js_done, js_error
+};
+
+struct JSON_stream_t;
+
+/*
+ * Called for every scalar value, with its path from the root, e.g.
+ * "item.artists[].name". Array elements are not numbered in the path,
+ * use jsonStreamIndex() to know which element the value belongs to.
+ */
+typedef void (*JSON_value_cb_t)(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type);
+
+typedef struct {
+    bool is_array;
+    uint16_t base_len;
+    uint16_t index;
+} JSON_level_t;
+
+struct JSON_stream_t {
+    JSON_value_cb_t cb;
+    void *ctx;
+    JsonStreamStates state;
+    bool is_key;
+    bool truncated;
+    uint8_t depth;
+    uint8_t u_count;
+    uint16_t u_code;
+    uint16_t u_high;
+    uint16_t path_len;
+    uint16_t value_len;
+    JSON_level_t levels[JSON_STREAM_MAX_DEPTH];
+    char path[JSON_STREAM_PATH_SIZE];
+    char value[JSON_STREAM_VALUE_SIZE];
+};
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void jsonStreamInit(JSON_stream_t *js, JSON_value_cb_t cb, void *ctx);
+bool jsonStreamFeed(JSON_stream_t *js, const char *data, size_t len);
+bool jsonStreamDone(const JSON_stream_t *js);
+uint16_t jsonStreamIndex(const JSON_stream_t *js, uint8_t array_nr = 0);
+size_t jsonEscape(char *dest, size_t size, const char *src);
+//@formatter:on
+
+#endif // M5SPOT_JSON_STREAM_H
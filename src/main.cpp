@@ -12,11 +12,27 @@ pio init --ide clion --board m5stack-core-esp32
 #include <EEPROM.h>
 #include <ArduinoOTA.h>
 #include <ESPAsyncWebServer.h>
-#include <ArduinoJson.h>
 #include <base64.h>
+#include <rom/crc.h>
 #include "main.h"
+#include "hal/hal.h"
+#include "conn_pool.h"
+#include "art_cache.h"
+#include "jpg_stream.h"
+#include "metrics.h"
+#include "heap_diag.h"
+#include "arena.h"
+#include "json_stream.h"
+#include "event_log.h"
+#include "boot_stats.h"
+#include "settings.h"
 #include "config.h"
 
+// Fast boot options, may be set in config.h
+#ifndef M5S_SPLASH_MS
+#define M5S_SPLASH_MS 0     // Infos screen duration, 0 to only display it if a button is held at boot
+#endif
+
 #ifdef WITH_APDS9960
 #include <SparkFun_APDS9960.h>
 SparkFun_APDS9960 apds = SparkFun_APDS9960();
@@ -29,23 +45,16 @@ WiFiMulti wifiMulti;
 AsyncWebServer server(80);
 AsyncEventSource events("/events");
 
-String auth_code;
-String access_token;
-String refresh_token;
-
-uint32_t token_lifetime_ms = 0;
-uint32_t token_millis = 0;
-uint32_t last_curplay_millis = 0;
-uint32_t next_curplay_millis = 0;
-
-bool getting_token = false;
 bool ota_in_progress = false;
-bool sptf_is_playing = true;
-bool send_events = true;
+bool send_events = false;           // Console enabled, and someone to send to
+bool events_enabled = true;         // Console enabled by user
 
-uint16_t sptf_green = M5.Lcd.color565(30, 215, 96);
+WEB_asset_t web_index = {"/index.html.gz", "text/html", WEB_CACHE_PAGE, ""};
+WEB_asset_t web_favicon = {"/favicon.ico.gz", "image/x-icon", WEB_CACHE_STATIC, ""};
 
-SptfActions sptfAction = Iddle;
+// Prefetched album art (network task only)
+static HalCanvas *art_staging = nullptr;
+static char art_staged_key[96] = "";
 
 
 /**
@@ -53,9 +62,24 @@ SptfActions sptfAction = Iddle;
  */
 void setup() {
 
+    sptf_config.client_id = SPTF_CLIENT_ID;
+    sptf_config.client_secret = SPTF_CLIENT_SECRET;
+
+    eventLogBegin();
+
+    //-----------------------------------------------
+    // Load settings, from EEPROM the first time
+    //-----------------------------------------------
+    if (!settingsBegin()) {
+        migrateEeprom();
+    }
+    settings.boot_count++;  // Saved with WiFi settings
+    sptf_config.polling_delay = settings.polling_delay ? settings.polling_delay : SPTF_POLLING_DELAY;
+
     //-----------------------------------------------
     // Initialize M5Stack
     //-----------------------------------------------
+    bootPhaseStart(bp_display);
     M5.begin();
     M5.Lcd.fillScreen(BLACK);
     M5.Lcd.setTextColor(sptf_green);
@@ -63,6 +87,22 @@ void setup() {
     char title[17];
     snprintf(title, sizeof(title), "M5Spot v%s", M5S_VERSION);
 
+    //-----------------------------------------------
+    // Start WiFi association, the rest of the init runs meanwhile
+    //-----------------------------------------------
+    bootPhaseStart(bp_wifi);
+    WiFi.mode(WIFI_STA);
+#ifdef M5S_STATIC_IP
+    WiFi.config(IPAddress(M5S_STATIC_IP), IPAddress(M5S_GATEWAY), IPAddress(M5S_SUBNET), IPAddress(M5S_DNS));
+#endif
+
+    // Fast path: straight to the access point of last time, no scan
+    bool wifi_cached = settings.wifi.channel && settings.wifi.ap < sizeof(AP_LIST) / sizeof(AP_LIST[0]);
+    if (wifi_cached) {
+        const APlist_t &ap = AP_LIST[settings.wifi.ap];
+        WiFi.begin(ap.ssid, ap.passphrase, settings.wifi.channel, settings.wifi.bssid);
+    }
+
 #ifdef WITH_APDS9960
     //-----------------------------------------------
     // Initialize APDS-9960
@@ -86,13 +126,23 @@ void setup() {
     //-----------------------------------------------
     // Initialize SPIFFS
     //-----------------------------------------------
+    bootPhaseStart(bp_storage);
 
     if (!SPIFFS.begin()) {
         m5sEpitaph("Unable to begin SPIFFS");
     }
 
     //-----------------------------------------------
-    // Initialize Wifi
+    // Initialize album art cache
+    //-----------------------------------------------
+
+    if (!artCacheBegin()) {
+        M5S_DBG("No SD card, album art cache disabled\n");
+    }
+    bootPhaseEnd(bp_storage);
+
+    //-----------------------------------------------
+    // Display logo, and wait for WiFi
     //-----------------------------------------------
 
     M5.Lcd.drawJpgFile(SPIFFS, "/logo128.jpg", 96, 50, 128, 128);
@@ -106,26 +156,59 @@ void setup() {
     M5.Lcd.setTextSize(1);
     M5.Lcd.setTextDatum(BC_DATUM);
     M5.Lcd.drawString("Connecting to WiFi...", 160, 215);
+    bootPhaseEnd(bp_display);
 
-    WiFi.mode(WIFI_STA);
-    for (auto i : AP_LIST) {
-        wifiMulti.addAP(i.ssid, i.passphrase);
+    if (wifi_cached) {
+        uint32_t wifi_millis = millis();
+        while (WiFi.status() != WL_CONNECTED && millis() - wifi_millis < WIFI_FAST_TIMEOUT_MS) {
+            delay(10);
+        }
+        bootNote(WiFi.isConnected() ? "wifi cached" : "wifi cache missed");
     }
 
-    uint8_t count = 20;
-    while (count-- && (wifiMulti.run() != WL_CONNECTED)) {
-        delay(500);
+    // Slow path: scan for all known access points
+    if (!WiFi.isConnected()) {
+        // Give up the cached access point, WiFiMulti only starts if idle
+        if (wifi_cached) {
+            WiFi.disconnect();
+        }
+        for (auto i : AP_LIST) {
+            wifiMulti.addAP(i.ssid, i.passphrase);
+        }
+
+        uint8_t count = 20;
+        while (count-- && (wifiMulti.run() != WL_CONNECTED)) {
+            delay(500);
+        }
+        bootNote("wifi scan");
     }
 
     if (!WiFi.isConnected()) {
         m5sEpitaph("Unable to connect to WiFi");
     }
+    bootPhaseEnd(bp_wifi);
+
+    // Remember where we are for next boot
+    settingsLock();
+    settings.wifi.channel = WiFi.channel();
+    memcpy(settings.wifi.bssid, WiFi.BSSID(), sizeof(settings.wifi.bssid));
+    for (uint8_t i = 0; i < sizeof(AP_LIST) / sizeof(AP_LIST[0]); i++) {
+        if (WiFi.SSID() == AP_LIST[i].ssid) {
+            settings.wifi.ap = i;
+        }
+    }
+    settingsCommit();
+    settingsUnlock();
 
     WiFi.setHostname("M5Spot");
 
+    // Wall clock, for access token expiry across reboots
+    configTime(0, 0, "pool.ntp.org", "time.google.com");
+
     //-----------------------------------------------
     // Initialize OTA handlers
     //-----------------------------------------------
+    bootPhaseStart(bp_ota);
 
     ArduinoOTA.onStart([]() {
         ota_in_progress = true;
@@ -157,61 +240,38 @@ void setup() {
     ArduinoOTA.setHostname("M5Spot");
     ArduinoOTA.begin();
     MDNS.addService("http", "tcp", 80);
+    bootPhaseEnd(bp_ota);
 
     //-----------------------------------------------
-    // Display some infos
+    // Display some infos, if configured or if a button is held
     //-----------------------------------------------
-
-    M5.Lcd.fillScreen(BLACK);
-    M5.Lcd.drawJpgFile(SPIFFS, "/logo128d.jpg", 96, 50, 128, 128);
-
-    M5.Lcd.setFreeFont(&FreeSansBoldOblique12pt7b);
-    M5.Lcd.setTextColor(sptf_green);
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setTextDatum(TC_DATUM);
-    M5.Lcd.drawString(title, 160, 10);
-
-    M5.Lcd.setFreeFont(&FreeMono9pt7b);
-    M5.Lcd.setTextColor(WHITE);
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setCursor(0, 75);
-    M5.Lcd.printf(" SSID:      %s\n", WiFi.SSID().c_str());
-    M5.Lcd.printf(" IP:        %s\n", WiFi.localIP().toString().c_str());
-    M5.Lcd.printf(" STA MAC:   %s\n", WiFi.macAddress().c_str());
-    M5.Lcd.printf(" AP MAC:    %s\n", WiFi.softAPmacAddress().c_str());
-    M5.Lcd.printf(" Chip size: %s\n", prettyBytes(ESP.getFlashChipSize()).c_str());
-    M5.Lcd.printf(" Free heap: %s\n", prettyBytes(ESP.getFreeHeap()).c_str());
-
-    M5.Lcd.setFreeFont(&FreeSans9pt7b);
-    M5.Lcd.setTextColor(sptf_green);
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setTextDatum(BC_DATUM);
-    M5.Lcd.drawString("Press any button to continue...", 160, 230);
-
-    uint32_t pause = millis();
-    while (true) {
-        m5.update();
-        ArduinoOTA.handle();
-        if (m5.BtnA.wasPressed() || m5.BtnB.wasPressed() || m5.BtnC.wasPressed() || (millis() - pause > 20000)) {
-            break;
-        }
-        yield();
+    m5.update();
+    bool splash = M5S_SPLASH_MS > 0 || m5.BtnA.isPressed() || m5.BtnB.isPressed() || m5.BtnC.isPressed();
+    if (splash) {
+        showSplash(title);
     }
 
     //-----------------------------------------------
     // Initialize HTTP server handlers
     //-----------------------------------------------
+    bootPhaseStart(bp_server);
     events.onConnect([](AsyncEventSourceClient *client) {
         M5S_DBG("\n> [%d] events.onConnect\n", micros());
+        send_events = events_enabled;
     });
     server.addHandler(&events);
 
-    server.serveStatic("/favicon.ico", SPIFFS, "/favicon.ico");
+    server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
+        webSendAsset(request, &web_favicon);
+    });
 
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
         uint32_t ts = micros();
         M5S_DBG("\n> [%d] server.on /\n", ts);
-        if (access_token == "" && !getting_token) {
+        settingsLock();
+        bool authorized = access_token != "";
+        settingsUnlock();
+        if (!authorized && !getting_token) {
             getting_token = true;
             char auth_url[300] = "";
             snprintf(auth_url, sizeof(auth_url),
@@ -225,7 +285,7 @@ void setup() {
             M5S_DBG("  [%d] Redirect to: %s\n", ts, auth_url);
             request->redirect(auth_url);
         } else {
-            request->send(SPIFFS, "/index.html");
+            webSendAsset(request, &web_index);
         }
     });
 
@@ -236,11 +296,10 @@ void setup() {
             AsyncWebParameter *p = request->getParam(i);
             if (p->name() == "code") {
                 auth_code = p->value();
-                sptfAction = GetToken;
                 break;
             }
         }
-        if (sptfAction == GetToken) {
+        if (auth_code != "" && cmdQueuePush(&web_cmd_queue, GetToken)) {
             request->redirect("/");
         } else {
             request->send(204);
@@ -248,17 +307,17 @@ void setup() {
     });
 
     server.on("/next", HTTP_GET, [](AsyncWebServerRequest *request) {
-        sptfAction = Next;
+        cmdQueuePush(&web_cmd_queue, Next);
         request->send(204);
     });
 
     server.on("/previous", HTTP_GET, [](AsyncWebServerRequest *request) {
-        sptfAction = Previous;
+        cmdQueuePush(&web_cmd_queue, Previous);
         request->send(204);
     });
 
     server.on("/toggle", HTTP_GET, [](AsyncWebServerRequest *request) {
-        sptfAction = Toggle;
+        cmdQueuePush(&web_cmd_queue, Toggle);
         request->send(204);
     });
 
@@ -266,11 +325,45 @@ void setup() {
         request->send(200, "text/plain", String(ESP.getFreeHeap()));
     });
 
+    server.on("/heapstats", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        heapDiagWrite([](const char *line, void *ctx) {
+            ((AsyncResponseStream *) ctx)->print(line);
+        }, response);
+        request->send(response);
+    });
+
+    server.on("/bootstats", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        bootStatsWrite([](const char *line, void *ctx) {
+            ((AsyncResponseStream *) ctx)->print(line);
+        }, response);
+        request->send(response);
+    });
+
+    server.on("/connstats", HTTP_GET, [](AsyncWebServerRequest *request) {
+        const HTTP_conn_stats_t &stats = connPoolStats();
+        char buff[160];
+        snprintf(buff, sizeof(buff),
+                 "acquired: %u\nreused: %u\nconnects: %u\nstale: %u\nfailures: %u\n",
+                 stats.acquired, stats.reused, stats.connects, stats.stale, stats.failures
+        );
+        request->send(200, "text/plain", buff);
+    });
+
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        metricsWrite([](const char *line, void *ctx) {
+            ((AsyncResponseStream *) ctx)->print(line);
+        }, response);
+        request->send(response);
+    });
+
     server.on("/resettoken", HTTP_GET, [](AsyncWebServerRequest *request) {
-        access_token = "";
-        refresh_token = "";
+        // Tokens in use are the network task's, settings are deleted here too
+        // in case it is busy until the restart
+        cmdQueuePush(&web_cmd_queue, ResetToken);
         deleteRefreshToken();
-        sptfAction = Iddle;
         request->send(200, "text/plain", "Tokens deleted, M5Spot will restart");
         uint32_t start = millis();
         while (true) {
@@ -292,9 +385,29 @@ void setup() {
         }
     });
 
+    // async_tcp task: the network task may be saving tokens meanwhile
+    server.on("/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char buff[160];
+
+        settingsLock();
+        if (request->hasParam("polling_delay")) {
+            long polling_delay = request->getParam("polling_delay")->value().toInt();
+            settings.polling_delay = constrain(polling_delay, 0, 60000);
+            sptf_config.polling_delay = settings.polling_delay ? settings.polling_delay : SPTF_POLLING_DELAY;
+            settingsCommit();
+        }
+        snprintf(buff, sizeof(buff),
+                 "version: %u\npolling_delay: %u\nwifi_ap: %u\nwifi_channel: %u\nboot_count: %u\ntoken_refreshes: %u\n",
+                 settings.version, sptf_config.polling_delay, settings.wifi.ap, settings.wifi.channel,
+                 settings.boot_count, settings.token_refreshes);
+        settingsUnlock();
+
+        request->send(200, "text/plain", buff);
+    });
+
     server.on("/toggleevents", HTTP_GET, [](AsyncWebServerRequest *request) {
-        send_events = !send_events;
-        request->send(200, "text/plain", send_events ? "1" : "0");
+        events_enabled = !events_enabled;
+        request->send(200, "text/plain", events_enabled ? "1" : "0");
     });
 
     server.onNotFound([](AsyncWebServerRequest *request) {
@@ -303,21 +416,37 @@ void setup() {
 
     server.begin();
 
+    bootPhaseEnd(bp_server);
+
     //-----------------------------------------------
-    // Get refresh token from EEPROM
+    // Get tokens from settings
     //-----------------------------------------------
-    refresh_token = readRefreshToken();
+    bootPhaseStart(bp_tokens);
+    settingsLock();
+    refresh_token = settings.refresh_token;
+    settingsUnlock();
+
+    // Access token is reused if not expired (checked later if SNTP is not done yet)
+    if (refresh_token != "" && sptfRestoreToken(settings.access_token, settings.access_token_expires_at)) {
+        M5S_DBG("Access token restored\n");
+    }
+
+    bootPhaseEnd(bp_tokens);
 
     //-----------------------------------------------
-    // End of setup
+    // End of setup (the logo is still there, unless infos were displayed)
     //-----------------------------------------------
-    M5.Lcd.fillScreen(BLACK);
-    M5.Lcd.drawJpgFile(SPIFFS, "/logo128.jpg", 96, 50, 128, 128);
+    if (splash) {
+        M5.Lcd.fillScreen(BLACK);
+        M5.Lcd.drawJpgFile(SPIFFS, "/logo128.jpg", 96, 50, 128, 128);
 
-    M5.Lcd.setFreeFont(&FreeSansBoldOblique12pt7b);
-    M5.Lcd.setTextSize(1);
-    M5.Lcd.setTextDatum(TC_DATUM);
-    M5.Lcd.drawString(title, 160, 10);
+        M5.Lcd.setFreeFont(&FreeSansBoldOblique12pt7b);
+        M5.Lcd.setTextSize(1);
+        M5.Lcd.setTextDatum(TC_DATUM);
+        M5.Lcd.drawString(title, 160, 10);
+    } else {
+        M5.Lcd.fillRect(0, 180, 320, 60, BLACK);
+    }
 
     M5.Lcd.setTextDatum(BC_DATUM);
     if (refresh_token == "") {
@@ -332,33 +461,30 @@ void setup() {
 
         sptfAction = CurrentlyPlaying;
     }
+
+    //-----------------------------------------------
+    // Start network task, all Spotify I/O happens there
+    //-----------------------------------------------
+    lcd_mutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(sptfNetTask, "sptfNet", 12288, nullptr, 1, nullptr, 0);
+
+    // Boot timing is logged once the first track is drawn (sptfDisplayPlaying)
 }
 
 /**
- * Main loop
+ * Main loop (UI task, core 1)
+ *
+ * Never waits for the network: inputs are queued to the network task
+ * and the display is refreshed from the latest playback state snapshot.
  */
 void loop() {
 
-    uint32_t cur_millis = millis();
-
-
     // OTA handler
     ArduinoOTA.handle();
     if (ota_in_progress) {
         return;
     }
 
-    // Refreh Spotify access token either on M5Spot startup or at token expiration delay
-    // The number of requests is limited to 1 every 5 seconds
-    if (refresh_token != ""
-        && (token_millis == 0 || (cur_millis - token_millis >= token_lifetime_ms))) {
-        static uint32_t gettoken_millis = 0;
-        if (cur_millis - gettoken_millis >= 5000) {
-            sptfGetToken(refresh_token);
-            gettoken_millis = cur_millis;
-        }
-    }
-
 #ifdef WITH_APDS9960
         // Gesture event handler
         if (isr_flag == 1) {
@@ -369,44 +495,27 @@ void loop() {
         }
 #endif
 
+    // Browser console
+    eventsLoop();
+
     // M5Stack handler
     m5.update();
     if (m5.BtnA.wasPressed()) {
-        sptfAction = Previous;
+        cmdQueuePush(&ui_cmd_queue, Previous);
     }
 
     if (m5.BtnB.wasPressed()) {
-        sptfAction = Toggle;
+        cmdQueuePush(&ui_cmd_queue, Toggle);
     }
 
     if (m5.BtnC.wasPressed()) {
-        sptfAction = Next;
+        cmdQueuePush(&ui_cmd_queue, Next);
     }
 
-    // Spotify action handler
-    switch (sptfAction) {
-        case Iddle:
-            break;
-        case GetToken:
-            sptfGetToken(auth_code, gt_authorization_code);
-            break;
-        case CurrentlyPlaying:
-            if (next_curplay_millis && (cur_millis >= next_curplay_millis)) {
-                sptfCurrentlyPlaying();
-            } else if (cur_millis - last_curplay_millis >= SPTF_POLLING_DELAY) {
-                sptfCurrentlyPlaying();
-            }
-            break;
-        case Next:
-            sptfNext();
-            break;
-        case Previous:
-            sptfPrevious();
-            break;
-        case Toggle:
-            sptfToggle();
-            break;
-    }
+    // Display handler
+    sptfDisplayPlaying();
+
+    delay(5);
 }
 
 
@@ -424,6 +533,93 @@ void progressBar(uint8_t y, uint8_t val, uint16_t width, uint16_t height, uint16
 }
 
 
+/**
+ * Display some infos until a button is pressed, or M5S_SPLASH_MS
+ * (20 s if 0, i.e. if shown because a button was held at boot)
+ *
+ * @param title
+ */
+void showSplash(const char *title) {
+    bootPhaseStart(bp_splash);
+    uint32_t timeout_ms = M5S_SPLASH_MS ? M5S_SPLASH_MS : 20000;
+
+    M5.Lcd.fillScreen(BLACK);
+
+    M5.Lcd.drawJpgFile(SPIFFS, "/logo128d.jpg", 96, 50, 128, 128);
+
+    M5.Lcd.setFreeFont(&FreeSansBoldOblique12pt7b);
+    M5.Lcd.setTextColor(sptf_green);
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setTextDatum(TC_DATUM);
+    M5.Lcd.drawString(title, 160, 10);
+
+    M5.Lcd.setFreeFont(&FreeMono9pt7b);
+    M5.Lcd.setTextColor(WHITE);
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setCursor(0, 75);
+    M5.Lcd.printf(" SSID:      %s\n", WiFi.SSID().c_str());
+    M5.Lcd.printf(" IP:        %s\n", WiFi.localIP().toString().c_str());
+    M5.Lcd.printf(" STA MAC:   %s\n", WiFi.macAddress().c_str());
+    M5.Lcd.printf(" AP MAC:    %s\n", WiFi.softAPmacAddress().c_str());
+    M5.Lcd.printf(" Chip size: %s\n", prettyBytes(ESP.getFlashChipSize()).c_str());
+    M5.Lcd.printf(" Free heap: %s\n", prettyBytes(ESP.getFreeHeap()).c_str());
+
+    M5.Lcd.setFreeFont(&FreeSans9pt7b);
+    M5.Lcd.setTextColor(sptf_green);
+    M5.Lcd.setTextSize(1);
+    M5.Lcd.setTextDatum(BC_DATUM);
+    M5.Lcd.drawString("Press any button to continue...", 160, 230);
+
+    uint32_t pause = millis();
+    while (true) {
+        m5.update();
+        ArduinoOTA.handle();
+        if (m5.BtnA.wasPressed() || m5.BtnB.wasPressed() || m5.BtnC.wasPressed() || (millis() - pause > timeout_ms)) {
+            break;
+        }
+        yield();
+    }
+
+    bootPhaseEnd(bp_splash);
+}
+
+
+/**
+ * Send a batch of log lines to browser
+ *
+ * @param data
+ * @param type
+ * @param ctx
+ */
+static void eventsSendBatch(const char *data, EventsLogTypes type, void *ctx) {
+    static const char *names[] = {"line", "raw", "info", "error"};
+    heapTrack(hs_event_serialize, strlen(data) + 1);
+    events.send(data, names[type]);
+}
+
+
+/**
+ * Drain the log ring to browser, every EVENT_LOG_PERIOD_MS
+ *
+ * Nothing is logged while no browser is connected. While clients are not
+ * keeping up, lines stay in the ring, which drops the oldest ones.
+ */
+void eventsLoop() {
+    static uint32_t events_millis = 0;
+    if (millis() - events_millis < EVENT_LOG_PERIOD_MS) {
+        return;
+    }
+    events_millis = millis();
+
+    send_events = events_enabled && events.count() > 0;
+    if (!send_events) {
+        eventLogClear();
+    } else if (events.avgPacketsWaiting() < EVENTS_MAX_PACKETS_WAITING) {
+        eventLogDrain(eventsSendBatch, nullptr, EVENTS_MAX_PACKETS_WAITING);
+    }
+}
+
+
 /**
  * Send log to browser
  *
@@ -432,29 +628,49 @@ void progressBar(uint8_t y, uint8_t val, uint16_t width, uint16_t height, uint16
  */
 void eventsSendLog(const char *logData, EventsLogTypes type) {
     if(!send_events) return;
-    events.send(logData, type == log_line ? "line" : "raw");
+    eventLogPush(logData, type);
 }
 
 
 /**
- * Send infos to browser
+ * Serialize a message to JSON in the arena, then queue it for browser
+ *
+ * Only called from the network task, which owns the arena.
  *
+ * @param type
+ * @param code      Left out if 0
  * @param msg
- * @param payload
+ * @param payload   Left out if empty
  */
-void eventsSendInfo(const char *msg, const char *payload) {
-    if(!send_events) return;
+static void eventsSendJson(EventsLogTypes type, int code, const char *msg, const char *payload) {
+    // Escaped strings are truncated so that the JSON stays whole in a ring entry
+    size_t size = min(min(64 + (strlen(msg) + strlen(payload)) * 6, (size_t) EVENT_LOG_BATCH_SIZE), arenaAvailable());
+    char *json = size >= 64 ? (char *) arenaAlloc(size) : nullptr;
+    if (!json) {
+        return;
+    }
 
-    DynamicJsonBuffer jsonBuffer(256);
-    JsonObject &json = jsonBuffer.createObject();
-    json["msg"] = msg;
+    size_t len = code ? snprintf(json, size, "{\"code\":%d,\"msg\":\"", code) : snprintf(json, size, "{\"msg\":\"");
+    len += jsonEscape(&json[len], size - len - 17, msg);
     if (strlen(payload)) {
-        json["payload"] = payload;
+        len += strlcpy(&json[len], "\",\"payload\":\"", size - len);
+        len += jsonEscape(&json[len], size - len - 3, payload);
     }
+    strlcpy(&json[len], "\"}", size - len);
+
+    eventLogPush(json, type);
+}
+
 
-    String info;
-    json.printTo(info);
-    events.send(info.c_str(), "info");
+/**
+ * Send infos to browser
+ *
+ * @param msg
+ * @param payload
+ */
+void eventsSendInfo(const char *msg, const char *payload) {
+    if(!send_events) return;
+    eventsSendJson(log_info, 0, msg, payload);
 }
 
 
@@ -467,18 +683,7 @@ void eventsSendInfo(const char *msg, const char *payload) {
  */
 void eventsSendError(int code, const char *msg, const char *payload) {
     if(!send_events) return;
-
-    DynamicJsonBuffer jsonBuffer(256);
-    JsonObject &json = jsonBuffer.createObject();
-    json["code"] = code;
-    json["msg"] = msg;
-    if (strlen(payload)) {
-        json["payload"] = payload;
-    }
-
-    String error;
-    json.printTo(error);
-    events.send(error.c_str(), "error");
+    eventsSendJson(log_error, code, msg, payload);
 }
 
 
@@ -503,139 +708,167 @@ String b64Encode(String str) {
 
 
 /**
- * Write refresh token to EEPROM
+ * Write refresh token to settings
  */
 void writeRefreshToken() {
     M5S_DBG("\n> [%d] writeRefreshToken()\n", micros());
 
-    EEPROM.begin(256);
+    settingsLock();
+    if (!settingsSetString(settings.refresh_token, sizeof(settings.refresh_token), refresh_token.c_str())) {
+        M5S_DBG("  Refresh token too long, truncated\n");
+    }
+    settingsCommit();
+    settingsUnlock();
+}
 
-    String tmpTok;
-    tmpTok.reserve(refresh_token.length() + 6);
-    tmpTok = "rtok:";
-    tmpTok += refresh_token;
 
-    uint16_t i = 0, addr = 0, tt_len = tmpTok.length();
-    for (i = 0; addr < 256 && i < tt_len; i++, addr++) {
-        EEPROM.write(addr, (uint8_t) tmpTok.charAt(i));
-    }
+/**
+ * Write access token to settings, with its expiry
+ *
+ * @param expires_at    Wall clock time (s)
+ */
+void writeAccessToken(uint32_t expires_at) {
+    M5S_DBG("\n> [%d] writeAccessToken(%u)\n", micros(), expires_at);
 
-    EEPROM.write(addr, '\0');
-    EEPROM.end();
+    // Not worth restoring if truncated
+    settingsLock();
+    if (!settingsSetString(settings.access_token, sizeof(settings.access_token), access_token.c_str())) {
+        settings.access_token[0] = '\0';
+    }
+    settings.access_token_expires_at = expires_at;
+    settings.token_refreshes++;
+    settingsCommit();
+    settingsUnlock();
 }
 
 
 /**
- * Delete refresh token from EEPROM
+ * Delete refresh & access tokens from settings
  */
 void deleteRefreshToken() {
     M5S_DBG("\n> [%d] deleteRefreshToken()\n", micros());
 
-    EEPROM.begin(256);
-    EEPROM.write(0, '\0'); // Deleting only the first character is enough to make the key invalid
-    EEPROM.end();
+    settingsLock();
+    settingsSetString(settings.refresh_token, sizeof(settings.refresh_token), "");
+    settingsSetString(settings.access_token, sizeof(settings.access_token), "");
+    settings.access_token_expires_at = 0;
+    settingsCommit();
+    settingsUnlock();
 }
 
 
 /**
- * Read refresh token from EEPROM
+ * Move the refresh token from EEPROM (older firmwares) to settings, then
+ * erase EEPROM
  *
- * @return String
+ * Layout: "rtok:" + null terminated refresh token at 0, nothing else was
+ * ever kept in EEPROM.
  */
-String readRefreshToken() {
-    M5S_DBG("\n> [%d] readRefreshToken()\n", micros());
-
-    String tok;
-    tok.reserve(150);
+void migrateEeprom() {
+    M5S_DBG("\n> [%d] migrateEeprom()\n", micros());
 
-    EEPROM.begin(1024);
+    if (!EEPROM.begin(EEPROM_SIZE)) {
+        return;
+    }
+    const uint8_t *eeprom = EEPROM.getDataPtr();
+    bool found = false;
 
-    for (int i = 0; i < 5; i++) {
-        tok += String(char(EEPROM.read(i)));
+    const uint8_t *rtok = eeprom;
+    if (memcmp(rtok, "rtok:", 5) == 0 && memchr(rtok + 5, '\0', EEPROM_REFRESH_TOKEN_SIZE - 5)) {
+        settingsSetString(settings.refresh_token, sizeof(settings.refresh_token), (const char *) rtok + 5);
+        found = true;
     }
 
-    if (tok == "rtok:") {
-        tok = "";
-        char c;
-        uint16_t addr = 5;
-        while (addr < 256) {
-            c = char(EEPROM.read(addr++));
-            if (c == '\0') {
-                break;
-            } else {
-                tok += c;
-            }
-            yield();
+    // Erased once saved: a power failure in between leaves a copy, never loses tokens
+    if (settingsCommit() && found) {
+        for (uint16_t addr = 0; addr < EEPROM_SIZE; addr++) {
+            EEPROM.write(addr, 0);
         }
-    } else {
-        tok = "";
     }
-
     EEPROM.end();
+}
 
-    return tok;
+
+/**
+ * Send a web console asset, or 304 if the browser has it already
+ *
+ * Assets are gzipped at build time, and sent as is.
+ *
+ * @param request
+ * @param asset
+ */
+void webSendAsset(AsyncWebServerRequest *request, WEB_asset_t *asset) {
+    // Strong ETag: changes with the content, e.g. after uploading a new file system
+    if (!asset->etag[0]) {
+        File file = SPIFFS.open(asset->path, "r");
+        if (!file) {
+            request->send(404);
+            return;
+        }
+        uint32_t crc = 0;
+        uint8_t buff[256];
+        size_t len;
+        while ((len = file.read(buff, sizeof(buff))) > 0) {
+            crc = crc32_le(crc, buff, len);
+        }
+        file.close();
+        snprintf(asset->etag, sizeof(asset->etag), "\"%08x\"", crc);
+    }
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset->etag) {
+        response = request->beginResponse(304);
+    } else {
+        response = request->beginResponse(SPIFFS, asset->path, asset->content_type);
+        response->addHeader("Content-Encoding", "gzip");
+    }
+    response->addHeader("ETag", asset->etag);
+    response->addHeader("Cache-Control", asset->cache_control);
+    request->send(response);
 }
 
 
 /**
- * Display album art
+ * Download album art, decoding it into a box as it comes
  *
  * @param url
+ * @param display   LCD, or canvas
+ * @param x         Box (SPTF_ART_W x SPTF_ART_H)
+ * @param y
+ * @return false on failure
  */
-void sptfDisplayAlbumArt(String url) {
+static bool downloadAlbumArt(const char *url, HalDisplay *display, int16_t x, int16_t y) {
     uint32_t ts = micros();
-    M5S_DBG("\n> [%d] sptfDisplayAlbumArt(%s)\n", ts, url.c_str());
-
     HTTPClient http;
 
-    http.begin(url);
+    metricsCount(mc_album_art_downloads);
+    heapTrack(hs_album_art, strlen(url) + 1);
+    http.begin(String(url));
     int httpCode = http.GET();
+    uint32_t render_us = micros();
+    metricsObserve(me_album_art, mp_ttfb, render_us - ts);
 
+    bool ok = false;
     if (httpCode > 0) {
         if (httpCode == HTTP_CODE_OK) {
 
-            const char filename[] = "/albart.jpg";
-
-            SD.remove(filename);
-
-            File file = SD.open(filename, FILE_APPEND);
-            if (!file) {
-                M5S_DBG("  [%d] File open failed\n", ts);
-                eventsSendError(500, "File open failed");
-                http.end();
-                return;
-            }
-
             WiFiClient *stream = http.getStreamPtr();
             int jpgSize = http.getSize();
             if (jpgSize < 0) {
                 M5S_DBG("  [%d] Unable to get JPEG size\n", ts);
                 eventsSendError(500, "Unable to get JPEG size");
                 http.end();
-                return;
+                return false;
             }
-            uint16_t buffSize = 1024;
-            uint8_t buff[buffSize] = {0};
-
-            while (http.connected() && jpgSize > 0) {
-                int availableSize = stream->available();
-                if (availableSize > 0) {
 
-                    // Read data from stream into buffer
-                    int B = stream->readBytes(buff, (size_t) min(availableSize, buffSize));
-
-                    // Write buffer to file
-                    file.write(buff, (size_t) B);
-
-                    jpgSize -= B;
-                }
-                delay(10);
+            // Decode while downloading
+            JpgStreamResults res = jpgStreamDraw(display, stream, jpgSize, x, y, SPTF_ART_W, SPTF_ART_H);
+            metricsObserve(me_album_art, mp_render, micros() - render_us);
+            ok = res == jpg_ok;
+            if (!ok) {
+                M5S_DBG("  [%d] Unable to decode album art (%d)\n", ts, res);
+                eventsSendError(500, "Unable to decode album art");
             }
-            file.close();
-
-            // Display album art
-            M5.Lcd.fillScreen(WHITE);
-            M5.Lcd.drawJpgFile(SD, filename, 10, 30);
 
         } else {
             M5S_DBG("  [%d] Unable to get album art: %s\n", ts, http.errorToString(httpCode).c_str());
@@ -647,363 +880,128 @@ void sptfDisplayAlbumArt(String url) {
     }
 
     http.end();
+    return ok;
 }
 
 
 /**
- * HTTP request
- *
- * @param host
- * @param port
- * @param headers
- * @param content
- * @return
+ * Clear the boot screen, once: new album arts are drawn over the previous one
  */
-HTTP_response_t httpRequest(const char *host, uint16_t port, const char *headers, const char *content) {
-    uint32_t ts = micros();
-    M5S_DBG("\n> [%d] httpRequest(%s, %d, ...)\n", ts, host, port);
-
-    WiFiClientSecure client;
-
-    if (!client.connect(host, port)) {
-        return {503, "Service unavailable (unable to connect)"};
+static void clearBootScreen() {
+    static bool cleared = false;
+    if (!cleared) {
+        M5.Lcd.fillScreen(WHITE);
+        cleared = true;
     }
+}
 
-    /*
-     * Send HTTP request
-     */
 
-    M5S_DBG("  [%d] Request:\n%s%s\n", ts, headers, content);
-    eventsSendLog(">>>> REQUEST");
-    eventsSendLog(headers);
-    eventsSendLog(content);
+/**
+ * Display album art
+ *
+ * Album arts already seen are blitted from the SD cache, or from the staging
+ * canvas if prefetched; others are decoded as they are downloaded. Then they
+ * are added to the cache (if any SD card).
+ *
+ * @param url
+ * @param cache_key     Album ID, or image URL if unknown
+ */
+void sptfDisplayAlbumArt(const char *url, const char *cache_key) {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfDisplayAlbumArt(%s, %s)\n", ts, url, cache_key);
+
+    clearBootScreen();
 
-    client.print(headers);
-    if (strlen(content)) {
-        client.print(content);
+    if (artCacheDraw(cache_key, SPTF_ART_X, SPTF_ART_Y)) {
+        M5S_DBG("  [%d] Album art cache hit\n", ts);
+        metricsCount(mc_album_art_cache_hits);
+        metricsObserve(me_album_art, mp_render, micros() - ts);
+        return;
     }
 
-    /*
-     * Get HTTP response
-     */
-
-    uint32_t timeout = millis();
-    while (!client.available()) {
-        if (millis() - timeout > 5000) {
-            client.stop();
-            return {503, "Service unavailable (timeout)"};
-        }
-        yield();
+    if (art_staged_key[0] && strcmp(art_staged_key, cache_key) == 0) {
+        M5S_DBG("  [%d] Album art prefetched\n", ts);
+        halDisplay()->pushRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, art_staging->buffer());
+        metricsCount(mc_album_art_prefetch_hits);
+        metricsObserve(me_album_art, mp_render, micros() - ts);
+        artCacheStore(cache_key, SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H);
+        return;
     }
 
-    M5S_DBG("  [%d] Response:\n", ts);
-    eventsSendLog("<<<< RESPONSE");
-
-    HTTP_response_t response = {0, ""};
-    boolean EOH = false;
-    uint32_t contentLength = 0;
-    uint16_t buffSize = 1024;
-    uint32_t readSize = 0;
-    uint32_t totatlReadSize = 0;
-    uint32_t lastAvailableMillis = millis();
-    char buff[buffSize];
-
-    // !HERE
-    // client.setNoDelay(false);
-
-    while (client.connected()) {
-        int availableSize = client.available();
-        if (availableSize) {
-            lastAvailableMillis = millis();
-
-            if (!EOH) {
-                // Read response headers
-                readSize = client.readBytesUntil('\n', buff, buffSize);
-                buff[readSize - 1] = '\0'; // replace /r by \0
-                M5S_DBG("%s\n", buff);
-                eventsSendLog(buff);
-                if (startsWith(buff, "HTTP/1.")) {
-                    buff[12] = '\0';
-                    response.httpCode = atoi(&buff[9]);
-                    if (response.httpCode == 204) {
-                        break;
-                    }
-                } else if (startsWith(buff, "Content-Length:")) {
-                    contentLength = atoi(&buff[16]);
-                    if (contentLength == 0) {
-                        break;
-                    }
-                    response.payload.reserve(contentLength + 1);
-                } else if (buff[0] == '\0') {
-                    // End of headers
-                    EOH = true;
-                    M5S_DBG("<EOH>\n");
-                    eventsSendLog("");
-                }
-            } else {
-                // Read response content
-                readSize = client.readBytes(buff, min(buffSize - 1, availableSize));
-                buff[readSize] = '\0';
-                M5S_DBG(buff);
-                eventsSendLog(buff, log_raw);
-                response.payload += buff;
-                totatlReadSize += readSize;
-                if (totatlReadSize >= contentLength) {
-                    break;
-                }
-            }
-        } else {
-            if ((millis() - lastAvailableMillis) > 5000) {
-                response = {504, "Response timeout"};
-                break;
-            }
-            delay(100);
-        }
+    if (downloadAlbumArt(url, halDisplay(), SPTF_ART_X, SPTF_ART_Y)) {
+        artCacheStore(cache_key, SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H);
+    } else {
+        M5.Lcd.fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, WHITE);
     }
-    client.stop();
+}
 
-    M5S_DBG("\n< [%d] HEAP: %d\n", ts, ESP.getFreeHeap());
 
-    return response;
+/**
+ * Clear album art, for tracks without any
+ */
+void sptfClearAlbumArt() {
+    clearBootScreen();
+    M5.Lcd.fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, WHITE);
 }
 
 
 /**
- * Call Spotify API
+ * Check whether prefetched album art can be kept until shown: in the staging
+ * canvas (PSRAM), or else in the SD cache
  *
- * @param method
- * @param endpoint
  * @return
  */
-HTTP_response_t sptfApiRequest(const char *method, const char *endpoint, const char *content) {
-    uint32_t ts = micros();
-    M5S_DBG("\n> [%d] sptfApiRequest(%s, %s, %s)\n", ts, method, endpoint, content);
-
-    char headers[512];
-    snprintf(headers, sizeof(headers),
-             "%s /v1/me/player%s HTTP/1.1\r\n"
-             "Host: api.spotify.com\r\n"
-             "Authorization: Bearer %s\r\n"
-             "Content-Length: %d\r\n"
-             "Connection: close\r\n\r\n",
-             method, endpoint, access_token.c_str(), strlen(content)
-    );
-
-    return httpRequest("api.spotify.com", 443, headers, content);
+bool sptfCanPrefetchAlbumArt() {
+    return psramFound() || artCacheReady();
 }
 
 
 /**
- * Get Spotify token
+ * Get album art ready for sptfDisplayAlbumArt(), without showing it: decoded
+ * into the staging canvas or, without PSRAM, straight into the SD cache
+ * (unless already there)
  *
- * @param code          Either an authorization code or a refresh token
- * @param grant_type    [gt_authorization_code|gt_refresh_token]
+ * @param url
+ * @param cache_key     Album ID, or image URL if unknown
+ * @return false if not available (no memory, download error)
  */
-void sptfGetToken(const String &code, GrantTypes grant_type) {
+bool sptfPrefetchAlbumArt(const char *url, const char *cache_key) {
     uint32_t ts = micros();
-    M5S_DBG("\n> [%d] sptfGetToken(%s, %s)\n", ts, code.c_str(), grant_type == gt_authorization_code ? "authorization" : "refresh");
-
-    bool success = false;
+    M5S_DBG("\n> [%d] sptfPrefetchAlbumArt(%s, %s)\n", ts, url, cache_key);
 
-    char requestContent[512];
-    if (grant_type == gt_authorization_code) {
-        snprintf(requestContent, sizeof(requestContent),
-                 "grant_type=authorization_code"
-                 "&redirect_uri=http%%3A%%2F%%2Fm5spot.local%%2Fcallback%%2F"
-                 "&code=%s",
-                 code.c_str()
-        );
-    } else {
-        snprintf(requestContent, sizeof(requestContent),
-                 "grant_type=refresh_token&refresh_token=%s",
-                 code.c_str()
-        );
+    if (artCacheHas(cache_key) || strcmp(art_staged_key, cache_key) == 0) {
+        return true;
     }
 
-    uint8_t basicAuthSize = sizeof(SPTF_CLIENT_ID) + sizeof(SPTF_CLIENT_SECRET);
-    char basicAuth[basicAuthSize];
-    snprintf(basicAuth, basicAuthSize, "%s:%s", SPTF_CLIENT_ID, SPTF_CLIENT_SECRET);
-
-    char requestHeaders[768];
-    snprintf(requestHeaders, sizeof(requestHeaders),
-             "POST /api/token HTTP/1.1\r\n"
-             "Host: accounts.spotify.com\r\n"
-             "Authorization: Basic %s\r\n"
-             "Content-Length: %d\r\n"
-             "Content-Type: application/x-www-form-urlencoded\r\n"
-             "Connection: close\r\n\r\n",
-             b64Encode(basicAuth).c_str(), strlen(requestContent)
-    );
-
-    HTTP_response_t response = httpRequest("accounts.spotify.com", 443, requestHeaders, requestContent);
-
-    if (response.httpCode == 200) {
-
-        DynamicJsonBuffer jsonInBuffer(572);
-        //StaticJsonBuffer<572> jsonInBuffer;
-        JsonObject &json = jsonInBuffer.parseObject(response.payload);
-
-        if (json.success()) {
-            access_token = json["access_token"].as<String>();
-            if (access_token != "") {
-                token_lifetime_ms = (json["expires_in"].as<uint32_t>() - 300) * 1000;
-                token_millis = millis();
-                success = true;
-                if (json.containsKey("refresh_token")) {
-                    refresh_token = json["refresh_token"].as<String>();
-                    writeRefreshToken();
-                }
-            }
-        } else {
-            M5S_DBG("  [%d] Unable to parse response payload:\n  %s\n", ts, response.payload.c_str());
-            eventsSendError(500, "Unable to parse response payload", response.payload.c_str());
+    // Full size canvas (123 KB) only from PSRAM, DRAM can't spare it on boards
+    // without: there, decoded a strip at a time into the SD cache
+    if (!psramFound()) {
+        HalDisplay *writer = artCacheWriterOpen(cache_key, SPTF_ART_W, SPTF_ART_H);
+        if (!writer) {
+            M5S_DBG("  [%d] Unable to write album art to cache\n", ts);
+            return false;
         }
-    } else {
-        M5S_DBG("  [%d] %d - %s\n", ts, response.httpCode, response.payload.c_str());
-        eventsSendError(response.httpCode, "Spotify error", response.payload.c_str());
+        return artCacheWriterClose(writer, downloadAlbumArt(url, writer, 0, 0));
     }
 
-    if (success) {
-        sptfAction = CurrentlyPlaying;
-    }
-
-    getting_token = false;
-}
-
-
-/**
- * Get information about the Spotify user's current playback
- */
-void sptfCurrentlyPlaying() {
-    uint32_t ts = micros();
-    M5S_DBG("\n> [%d] sptfCurrentlyPlaying()\n", ts);
-
-    last_curplay_millis = millis();
-    next_curplay_millis = 0;
-
-    HTTP_response_t response = sptfApiRequest("GET", "/currently-playing");
-
-    if (response.httpCode == 200) {
-
-        DynamicJsonBuffer jsonBuffer(5120);
-
-        JsonObject &json = jsonBuffer.parse(response.payload);
-
-        if (json.success()) {
-            sptf_is_playing = json["is_playing"];
-            uint32_t progress_ms = json["progress_ms"];
-            uint32_t duration_ms = json["item"]["duration_ms"];
-
-            // Check if current song is about to end
-            if (sptf_is_playing) {
-                uint32_t remaining_ms = duration_ms - progress_ms;
-                if (remaining_ms < SPTF_POLLING_DELAY) {
-                    // Refresh at the end of current song,
-                    // without considering remaining polling delay
-                    next_curplay_millis = millis() + remaining_ms + 200;
-                }
-            }
-
-            // Get song ID
-            const char *id = json["item"]["id"];
-            static char previousId[32] = {0};
-
-            // If song has changed, refresh display
-            if (strcmp(id, previousId) != 0) {
-                strncpy(previousId, id, sizeof(previousId));
-
-                // Display album art
-                sptfDisplayAlbumArt(json["item"]["album"]["images"][1]["url"]);
-
-                // Display song name
-                M5.Lcd.fillRect(0, 0, 320, 30, 0xffffff);
-                M5.Lcd.setTextColor(BLACK);
-                M5.Lcd.setTextFont(2);
-                M5.Lcd.setTextSize(1);
-                M5.Lcd.setTextDatum(TC_DATUM);
-                M5.Lcd.drawString(json["item"]["name"].as<String>(), 160, 2);
-
-                // Display artists names
-                JsonArray &arr = json["item"]["artists"];
-                String artists;
-                artists.reserve(150);
-                bool first = true;
-                for (auto &a : arr) {
-                    if (first) {
-                        artists += a["name"].as<String>();
-                        first = false;
-                    } else {
-                        artists += ", ";
-                        artists += a["name"].as<String>();
-                    }
-                }
-                M5.Lcd.setTextFont(1);
-                M5.Lcd.setTextSize(1);
-                M5.Lcd.setTextDatum(BC_DATUM);
-                M5.Lcd.drawString(artists, 160, 28);
-
-                // Display progress bar background
-                M5.Lcd.fillRect(0, 235, 320, 5, WHITE);
-
-            }
-
-            M5.Lcd.fillRect(0, 235, ceil((float) 320 * ((float) progress_ms / duration_ms)), 5, sptf_green);
-
-        } else {
-            M5S_DBG("  [%d] Unable to parse response payload:\n  %s\n", ts, response.payload.c_str());
-            eventsSendError(500, "Unable to parse response payload", response.payload.c_str());
+    // Kept once allocated, so that it does not fragment the heap
+    if (!art_staging) {
+        art_staging = halCreateCanvas(SPTF_ART_W, SPTF_ART_H);
+        if (!art_staging) {
+            M5S_DBG("  [%d] No memory for the staging canvas\n", ts);
+            return false;
         }
-    } else if (response.httpCode == 204) {
-        // No content
-    } else {
-        M5S_DBG("  [%d] %d - %s\n", ts, response.httpCode, response.payload.c_str());
-        eventsSendError(response.httpCode, "Spotify error", response.payload.c_str());
     }
 
-    M5S_DBG("< [%d] HEAP: %d\n", ts, ESP.getFreeHeap());
-}
-
-/**
- * Spotify next track
- */
-void sptfNext() {
-    HTTP_response_t response = sptfApiRequest("POST", "/next");
-    if (response.httpCode == 204) {
-        next_curplay_millis = millis() + 200;
-    } else {
-        eventsSendError(response.httpCode, "Spotify error", response.payload.c_str());
+    art_staged_key[0] = '\0';
+    if (!downloadAlbumArt(url, art_staging, 0, 0)) {
+        return false;
     }
-    sptfAction = CurrentlyPlaying;
-};
-
-
-/**
- * Spotify previous track
- */
-void sptfPrevious() {
-    HTTP_response_t response = sptfApiRequest("POST", "/previous");
-    if (response.httpCode == 204) {
-        next_curplay_millis = millis() + 200;
-    } else {
-        eventsSendError(response.httpCode, "Spotify error", response.payload.c_str());
-    }
-    sptfAction = CurrentlyPlaying;
-};
+    strlcpy(art_staged_key, cache_key, sizeof(art_staged_key));
+    return true;
+}
 
 
-/**
- * Spotify toggle pause/play
- */
-void sptfToggle() {
-    HTTP_response_t response = sptfApiRequest("PUT", sptf_is_playing ? "/pause" : "/play");
-    if (response.httpCode == 204) {
-        sptf_is_playing = !sptf_is_playing;
-        next_curplay_millis = millis() + 200;
-    } else {
-        eventsSendError(response.httpCode, "Spotify error", response.payload.c_str());
-    }
-    sptfAction = CurrentlyPlaying;
-};
 
 
 #ifdef WITH_APDS9960
@@ -1018,38 +1016,23 @@ void IRAM_ATTR interruptRoutine() {
  * Gesture handler
  */
 void handleGesture() {
-
-    HTTP_response_t response;
-
     if (apds.isGestureAvailable()) {
         switch (apds.readGesture()) {
             case DIR_UP:
                 Serial.println("> Gesture UP");
-                response = sptfApiRequest("PUT", sptf_is_playing ? "/pause" : "/play");
-                if (response.httpCode == 204) {
-                    sptf_is_playing = !sptf_is_playing;
-                }
+                cmdQueuePush(&ui_cmd_queue, Toggle);
                 break;
             case DIR_DOWN:
                 Serial.println("> Gesture DOWN");
-                response = sptfApiRequest("PUT", sptf_is_playing ? "/pause" : "/play");
-                if (response.httpCode == 204) {
-                    sptf_is_playing = !sptf_is_playing;
-                }
+                cmdQueuePush(&ui_cmd_queue, Toggle);
                 break;
             case DIR_LEFT:
                 Serial.println("> Gesture LEFT");
-                response = sptfApiRequest("POST", "/previous");
-                if (response.httpCode == 204) {
-                    next_curplay_millis = millis() + 200;
-                }
+                cmdQueuePush(&ui_cmd_queue, Previous);
                 break;
             case DIR_RIGHT:
                 Serial.println("> Gesture RIGHT");
-                response = sptfApiRequest("POST", "/next");
-                if (response.httpCode == 204) {
-                    next_curplay_millis = millis() + 200;
-                }
+                cmdQueuePush(&ui_cmd_queue, Next);
                 break;
             case DIR_NEAR:
                 Serial.println("> Gesture NEAR");
@@ -1103,4 +1086,4 @@ void m5sEpitaph(const char *errMsg) {
         ArduinoOTA.handle();
         yield();
     }
-}
\ No newline at end of file
+}
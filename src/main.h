@@ -1,39 +1,34 @@
 #ifndef M5SPOT_MAIN_H
 #define M5SPOT_MAIN_H
 
-#define min(X, Y) (((X)<(Y))?(X):(Y))
-#define startsWith(STR, SEARCH) (strncmp(STR, SEARCH, strlen(SEARCH)) == 0)
+#include "sptf.h"
 
-//@formatter:off
-#ifdef DEBUG_M5SPOT
-#define M5S_DBG(...) Serial.printf( __VA_ARGS__ )
-#else
-#define M5S_DBG(...)
-#endif
-//@formatter:on
+#define EVENTS_MAX_PACKETS_WAITING 4    // Per client, before holding log lines back in the ring
 
-typedef struct {
-    int httpCode;
-    String payload;
-} HTTP_response_t;
+// EEPROM of older firmwares, migrated to settings
+#define EEPROM_SIZE 1024
+#define EEPROM_REFRESH_TOKEN_SIZE 256   // At 0
 
-enum SptfActions {
-    Iddle, GetToken, CurrentlyPlaying, Next, Previous, Toggle
-};
+#define WIFI_FAST_TIMEOUT_MS 3000       // Before scanning, if the last access point can't be joined
 
-enum GrantTypes {
-    gt_authorization_code, gt_refresh_token
-};
-
-enum EventsLogTypes {
-    log_line, log_raw
-};
+// Web console, built by tools/build_web.py
+#define WEB_CACHE_PAGE "no-cache"                   // Revalidated (304) on every load...
+#define WEB_CACHE_STATIC "public, max-age=604800"   // ...static assets only once a week
 
 typedef struct {
     const char *ssid;
     const char *passphrase;
 } APlist_t;
 
+typedef struct {
+    const char *path;           // Gzipped, in SPIFFS
+    const char *content_type;
+    const char *cache_control;
+    char etag[12];              // Quoted CRC32 of the file, computed on first request
+} WEB_asset_t;
+
+class AsyncWebServerRequest;
+
 
 /*
  * Function declarations
@@ -41,28 +36,17 @@ typedef struct {
 //@formatter:off
 void progressBar(uint8_t y, uint8_t val, uint16_t width = 200, uint16_t height = 7, uint16_t color = WHITE);
 
-void eventsSendLog(const char *logData, EventsLogTypes type = log_line);
-void eventsSendInfo(const char *msg, const char* payload = "");
-void eventsSendError(int code, const char *msg, const char *payload = "");
+void migrateEeprom();
 
-HTTP_response_t httpRequest(const char *host, uint16_t port, const char *headers, const char *content = "");
-HTTP_response_t sptfApiRequest(const char *method, const char *endpoint, const char *content = "");
-void sptfGetToken(const String &code, GrantTypes grant_type = gt_refresh_token);
-void sptfCurrentlyPlaying();
-void sptfNext();
-void sptfPrevious();
-void sptfToggle();
-void sptfDisplayAlbumArt(String url);
-
-void writeRefreshToken();
-void deleteRefreshToken();
-String readRefreshToken();
+void showSplash(const char *title);
 
 void handleGesture();
 void IRAM_ATTR interruptRoutine();
 
+void eventsLoop();
+void webSendAsset(AsyncWebServerRequest *request, WEB_asset_t *asset);
+
 void m5sEpitaph(const char *errMsg);
-String b64Encode(String str);
 String prettyBytes(uint32_t bytes);
 //@formatter:on
 
@@ -0,0 +1,186 @@
+#include <Arduino.h>
+#include "metrics.h"
+
+/*
+ * Request timing metrics
+ *
+ * Fixed bucket histograms per endpoint & phase, so recording is a few
+ * increments and memory use is known upfront. Writers are the network task
+ * (requests) and the UI task (rendering), the web server only reads.
+ */
+
+static const uint32_t bucket_ms[METRICS_BUCKET_COUNT] = METRICS_BUCKETS_MS;
+
+static const char *endpoint_names[me_endpoint_count] = {
+        "token", "currently_playing", "queue", "command", "album_art", "ui"
+};
+
+static const char *phase_names[mp_phase_count] = {
+        "connect", "ttfb", "body", "parse", "render"
+};
+
+static const char *counter_names[mc_counter_count] = {
+        "m5spot_token_refreshes_total",
+        "m5spot_token_failures_total",
+        "m5spot_album_art_downloads_total",
+        "m5spot_album_art_cache_hits_total",
+        "m5spot_event_log_dropped_total",
+        "m5spot_settings_writes_total",
+        "m5spot_settings_writes_skipped_total",
+        "m5spot_http_body_bytes_total",             // As received
+        "m5spot_http_body_decoded_bytes_total",     // Inflated, if gzip
+        "m5spot_prefetch_swaps_total",              // Next track shown before Spotify reported it
+        "m5spot_album_art_prefetch_hits_total",
+        "m5spot_album_art_prefetch_failures_total"  // No staging canvas (no PSRAM), or download error
+};
+
+static METRICS_histogram_t histograms[me_endpoint_count][mp_phase_count];
+static uint32_t counters[mc_counter_count];
+static METRICS_http_code_t http_codes[METRICS_MAX_HTTP_CODES];
+
+
+/**
+ * Get the endpoint of a request, from its request line
+ *
+ * @param request_line  e.g. "GET /v1/me/player/currently-playing HTTP/1.1"
+ * @return
+ */
+MetricsEndpoints metricsEndpoint(const char *request_line) {
+    const char *path = strchr(request_line, ' ');
+    if (!path) {
+        return me_command;
+    }
+    if (strncmp(path, " /api/token", 11) == 0) {
+        return me_token;
+    }
+    if (strncmp(path, " /v1/me/player/currently-playing", 32) == 0) {
+        return me_currently_playing;
+    }
+    if (strncmp(path, " /v1/me/player/queue", 20) == 0) {
+        return me_queue;
+    }
+    return me_command;
+}
+
+
+/**
+ * Record a phase duration
+ *
+ * @param endpoint
+ * @param phase
+ * @param us
+ */
+void metricsObserve(MetricsEndpoints endpoint, MetricsPhases phase, uint32_t us) {
+    METRICS_histogram_t &h = histograms[endpoint][phase];
+
+    uint8_t i = 0;
+    while (i < METRICS_BUCKET_COUNT && us > bucket_ms[i] * 1000) {
+        i++;
+    }
+    h.buckets[i]++;
+    h.count++;
+    h.sum_us += us;
+}
+
+
+/**
+ * Increment a counter
+ *
+ * @param counter
+ */
+void metricsCount(MetricsCounters counter) {
+    counters[counter]++;
+}
+
+
+/**
+ * Add to a counter
+ *
+ * @param counter
+ * @param value
+ */
+void metricsAdd(MetricsCounters counter, uint32_t value) {
+    counters[counter] += value;
+}
+
+
+/**
+ * Count an HTTP error, by code
+ *
+ * Once all slots are taken, other codes are counted as 0.
+ *
+ * @param code
+ */
+void metricsCountHttpCode(int code) {
+    for (uint8_t i = 0; i < METRICS_MAX_HTTP_CODES - 1; i++) {
+        METRICS_http_code_t &c = http_codes[i];
+        if (c.count == 0 || c.code == code) {
+            c.code = code;
+            c.count++;
+            return;
+        }
+    }
+    METRICS_http_code_t &other = http_codes[METRICS_MAX_HTTP_CODES - 1];
+    other.code = 0;
+    other.count++;
+}
+
+
+/**
+ * Write all metrics in Prometheus text format, line by line
+ *
+ * Histograms which never got any observation are left out.
+ *
+ * @param write
+ * @param ctx
+ */
+void metricsWrite(METRICS_write_cb_t write, void *ctx) {
+    char line[160];
+
+    write("# HELP m5spot_phase_seconds Request & rendering phase durations\n", ctx);
+    write("# TYPE m5spot_phase_seconds histogram\n", ctx);
+
+    for (uint8_t e = 0; e < me_endpoint_count; e++) {
+        for (uint8_t p = 0; p < mp_phase_count; p++) {
+            const METRICS_histogram_t &h = histograms[e][p];
+            if (!h.count) {
+                continue;
+            }
+
+            uint32_t cumulated = 0;
+            for (uint8_t i = 0; i <= METRICS_BUCKET_COUNT; i++) {
+                cumulated += h.buckets[i];
+                char le[16];
+                if (i < METRICS_BUCKET_COUNT) {
+                    snprintf(le, sizeof(le), "%g", bucket_ms[i] / 1000.0);
+                } else {
+                    strcpy(le, "+Inf");
+                }
+                snprintf(line, sizeof(line), "m5spot_phase_seconds_bucket{endpoint=\"%s\",phase=\"%s\",le=\"%s\"} %u\n",
+                         endpoint_names[e], phase_names[p], le, cumulated);
+                write(line, ctx);
+            }
+
+            snprintf(line, sizeof(line), "m5spot_phase_seconds_sum{endpoint=\"%s\",phase=\"%s\"} %.6f\n",
+                     endpoint_names[e], phase_names[p], h.sum_us / 1000000.0);
+            write(line, ctx);
+            snprintf(line, sizeof(line), "m5spot_phase_seconds_count{endpoint=\"%s\",phase=\"%s\"} %u\n",
+                     endpoint_names[e], phase_names[p], h.count);
+            write(line, ctx);
+        }
+    }
+
+    write("# HELP m5spot_http_errors_total Failed HTTP requests, by status code (0: other codes)\n", ctx);
+    write("# TYPE m5spot_http_errors_total counter\n", ctx);
+    for (auto &c : http_codes) {
+        if (c.count) {
+            snprintf(line, sizeof(line), "m5spot_http_errors_total{code=\"%d\"} %u\n", c.code, c.count);
+            write(line, ctx);
+        }
+    }
+
+    for (uint8_t c = 0; c < mc_counter_count; c++) {
+        snprintf(line, sizeof(line), "# TYPE %s counter\n%s %u\n", counter_names[c], counter_names[c], counters[c]);
+        write(line, ctx);
+    }
+}
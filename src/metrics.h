@@ -0,0 +1,63 @@
+#ifndef M5SPOT_METRICS_H
+#define M5SPOT_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Request timing histograms & counters, served in Prometheus text format
+ */
+
+#define METRICS_BUCKETS_MS {5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000}
+#define METRICS_BUCKET_COUNT 11
+#define METRICS_MAX_HTTP_CODES 12
+
+enum MetricsEndpoints {
+    me_token, me_currently_playing, me_queue, me_command, me_album_art, me_ui, me_endpoint_count
+};
+
+/*
+ * - connect: new connection, TCP & TLS handshake (WiFiClientSecure does both at once)
+ * - ttfb: request sent to first response byte
+ * - body: response read, parsing excluded
+ * - parse: JSON parsing (streamed, while reading the body)
+ * - render: drawing on LCD
+ */
+enum MetricsPhases {
+    mp_connect, mp_ttfb, mp_body, mp_parse, mp_render, mp_phase_count
+};
+
+enum MetricsCounters {
+    mc_token_refreshes, mc_token_failures, mc_album_art_downloads, mc_album_art_cache_hits, mc_event_log_dropped,
+    mc_settings_writes, mc_settings_writes_skipped, mc_http_body_bytes, mc_http_body_decoded_bytes,
+    mc_prefetch_swaps, mc_album_art_prefetch_hits, mc_album_art_prefetch_failures,
+    mc_counter_count
+};
+
+typedef struct {
+    uint32_t buckets[METRICS_BUCKET_COUNT + 1];   // Last one is +Inf
+    uint32_t count;
+    uint64_t sum_us;
+} METRICS_histogram_t;
+
+typedef struct {
+    int code;
+    uint32_t count;
+} METRICS_http_code_t;
+
+typedef void (*METRICS_write_cb_t)(const char *line, void *ctx);
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+MetricsEndpoints metricsEndpoint(const char *request_line);
+void metricsObserve(MetricsEndpoints endpoint, MetricsPhases phase, uint32_t us);
+void metricsCount(MetricsCounters counter);
+void metricsAdd(MetricsCounters counter, uint32_t value);
+void metricsCountHttpCode(int code);
+void metricsWrite(METRICS_write_cb_t write, void *ctx);
+//@formatter:on
+
+#endif // M5SPOT_METRICS_H
@@ -0,0 +1,189 @@
+#ifndef M5SPOT_NATIVE_ARDUINO_H
+#define M5SPOT_NATIVE_ARDUINO_H
+
+/*
+ * Minimal Arduino core & FreeRTOS API for the native (Linux) environment
+ *
+ * Only what the portable modules use: clock, random, Serial.printf,
+ * String, and mutexes/tasks mapped onto std::mutex/std::thread.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+
+/*
+ * Clock
+ */
+
+// Since first call, like since boot on the device
+inline uint64_t nativeClockUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    static uint64_t start = now;
+    return now - start;
+}
+
+inline uint32_t micros() {
+    return (uint32_t) nativeClockUs();
+}
+
+inline uint32_t millis() {
+    return (uint32_t) (nativeClockUs() / 1000);
+}
+
+void delay(uint32_t ms);
+
+inline void yield() {
+}
+
+/*
+ * Random
+ */
+
+inline long random(long max) {
+    return max > 0 ? ::random() % max : 0;
+}
+
+inline long random(long min, long max) {
+    return max > min ? min + ::random() % (max - min) : min;
+}
+
+/*
+ * Serial & ESP
+ */
+
+class NativeSerial {
+public:
+    int printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+    void println(const char *str);
+};
+
+class NativeEsp {
+public:
+    uint32_t getFreeHeap() {
+        return 0;
+    }
+};
+
+extern NativeSerial Serial;
+extern NativeEsp ESP;
+
+/*
+ * FreeRTOS
+ */
+
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+
+void vTaskDelay(TickType_t ticks);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack_size, void *param,
+                                   uint32_t priority, TaskHandle_t *handle, int core);
+
+/*
+ * strlcpy/strlcat, missing from older glibc
+ */
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+#endif
+
+/*
+ * String
+ */
+
+class String {
+public:
+    String(const char *str = "") : str(str ? str : "") {}
+
+    String(const std::string &str) : str(str) {}
+
+    explicit String(int value) : str(std::to_string(value)) {}
+
+    explicit String(unsigned int value) : str(std::to_string(value)) {}
+
+    explicit String(long value) : str(std::to_string(value)) {}
+
+    explicit String(unsigned long value) : str(std::to_string(value)) {}
+
+    const char *c_str() const {
+        return str.c_str();
+    }
+
+    unsigned int length() const {
+        return str.length();
+    }
+
+    bool reserve(unsigned int size) {
+        str.reserve(size);
+        return true;
+    }
+
+    char charAt(unsigned int index) const {
+        return index < str.length() ? str[index] : 0;
+    }
+
+    int indexOf(char c) const {
+        size_t pos = str.find(c);
+        return pos == std::string::npos ? -1 : (int) pos;
+    }
+
+    void remove(unsigned int index, unsigned int count) {
+        str.erase(index, count);
+    }
+
+    String &operator+=(const String &rhs) {
+        str += rhs.str;
+        return *this;
+    }
+
+    String &operator+=(const char *rhs) {
+        str += rhs;
+        return *this;
+    }
+
+    String &operator+=(char c) {
+        str += c;
+        return *this;
+    }
+
+    bool operator==(const String &rhs) const {
+        return str == rhs.str;
+    }
+
+    bool operator==(const char *rhs) const {
+        return str == rhs;
+    }
+
+    bool operator!=(const String &rhs) const {
+        return str != rhs.str;
+    }
+
+    bool operator!=(const char *rhs) const {
+        return str != rhs;
+    }
+
+private:
+    std::string str;
+};
+
+#endif // M5SPOT_NATIVE_ARDUINO_H
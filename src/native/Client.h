@@ -0,0 +1,24 @@
+#ifndef M5SPOT_NATIVE_CLIENT_H
+#define M5SPOT_NATIVE_CLIENT_H
+
+#include <Arduino.h>
+
+/*
+ * Arduino Client interface, as used by the portable modules
+ */
+class Client {
+public:
+    virtual ~Client() {}
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(const uint8_t *buff, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read(uint8_t *buff, size_t size) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+
+    size_t print(const char *str) {
+        return write((const uint8_t *) str, strlen(str));
+    }
+};
+
+#endif // M5SPOT_NATIVE_CLIENT_H
@@ -0,0 +1,82 @@
+#include <stdarg.h>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <Arduino.h>
+
+NativeSerial Serial;
+NativeEsp ESP;
+
+
+int NativeSerial::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
+
+
+void NativeSerial::println(const char *str) {
+    puts(str);
+}
+
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+
+void vTaskDelay(TickType_t ticks) {
+    delay(ticks * portTICK_PERIOD_MS);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new std::timed_mutex();
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+    std::timed_mutex *m = (std::timed_mutex *) mutex;
+    if (ticks == portMAX_DELAY) {
+        m->lock();
+        return pdTRUE;
+    }
+    return m->try_lock_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS)) ? pdTRUE : pdFALSE;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+    ((std::timed_mutex *) mutex)->unlock();
+    return pdTRUE;
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack_size, void *param,
+                                   uint32_t priority, TaskHandle_t *handle, int core) {
+    std::thread(task, param).detach();
+    return pdPASS;
+}
+
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t dst_len = strnlen(dst, size);
+    if (dst_len == size) {
+        return size + strlen(src);
+    }
+    return dst_len + strlcpy(dst + dst_len, src, size - dst_len);
+}
+#endif
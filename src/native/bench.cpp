@@ -0,0 +1,415 @@
+// Program of the native build, left out of unit tests (which have their own main)
+#ifndef PIO_UNIT_TESTING
+
+#include <vector>
+#include <algorithm>
+#include <Arduino.h>
+#include "../sptf.h"
+#include "../governor.h"
+#include "../art_cache.h"
+#include "../metrics.h"
+#include "../heap_diag.h"
+#include "../arena.h"
+#include "../event_log.h"
+#include "../settings.h"
+#include "hal_linux.h"
+#include "mock_spotify.h"
+#include "fixtures.h"
+
+/*
+ * Native benchmark
+ *
+ * - Micro benchmarks, run the device code paths against canned Spotify
+ *   responses: response reading & parsing, token parsing, command
+ *   coalescing and rendering.
+ *   Usage: program [iterations]
+ * - End to end, run the network loop against the mock Spotify server
+ *   with a scripted user, and report poll latencies & API calls per hour.
+ *   Usage: program e2e [seconds] [latency_ms] [rate_limit_pct] [error_pct] [token_lifetime_s] [command_lag_ms]
+ *   (set M5SPOT_METRICS to also dump the /metrics & /heapstats output)
+ *
+ * Correctness is covered by the unit tests (test/, pio test -e native),
+ * this only measures.
+ */
+
+static ReplayClient client;
+
+
+/**
+ * Report a benchmark result
+ *
+ * @param name
+ * @param iterations
+ * @param elapsed_us
+ * @param extra
+ */
+static void report(const char *name, uint32_t iterations, uint64_t elapsed_us, const char *extra = "") {
+    printf("%-28s %8u iter %10.2f us/iter  %s\n", name, iterations, (double) elapsed_us / iterations, extra);
+}
+
+
+static uint64_t nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Read & parse a currently-playing response
+ *
+ * @param name
+ * @param response
+ * @param iterations
+ */
+static void benchPlaying(const char *name, const std::string &response, uint32_t iterations, bool gzip = false) {
+    static HTTP_reader_t reader;
+    SPTF_playing_t playing;
+    JSON_stream_t js;
+    GZIP_stream_t gz;
+
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        memset(&playing, 0, sizeof(playing));
+        jsonStreamInit(&js, sptfParsePlaying, &playing);
+        HTTP_body_cb_t json_cb = [](const char *data, size_t len, void *ctx) {
+            jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+        };
+        if (gzip) {
+            gzipStreamInit(&gz, json_cb, &js);
+            httpReaderInit(&reader, nullptr, [](const char *data, size_t len, void *ctx) {
+                gzipStreamFeed((GZIP_stream_t *) ctx, data, len);
+            }, &gz);
+        } else {
+            httpReaderInit(&reader, nullptr, json_cb, &js);
+        }
+        client.rewind(response.data(), response.size());
+        httpReaderRun(&reader, client, 1000);
+        sptfPickAlbumArt(&playing, SPTF_ART_W, SPTF_ART_H);
+    }
+    uint64_t elapsed = nowUs() - start;
+
+    char extra[32];
+    snprintf(extra, sizeof(extra), "%.1f MB/s", (double) response.size() * iterations / elapsed);
+    report(name, iterations, elapsed, extra);
+}
+
+
+/**
+ * Parse a token response
+ *
+ * @param iterations
+ */
+static void benchToken(uint32_t iterations) {
+    std::string json = fixtureTokenJson();
+    SPTF_token_t token;
+    JSON_stream_t js;
+
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        arenaReset();
+        token = {nullptr, nullptr, 0};
+        jsonStreamInit(&js, sptfParseToken, &token);
+        jsonStreamFeed(&js, json.data(), json.size());
+    }
+    report("token parse", iterations, nowUs() - start);
+}
+
+
+/**
+ * Coalesce bursts of commands
+ *
+ * @param iterations
+ */
+static void benchActions(uint32_t iterations) {
+    const uint8_t burst[] = {Next, Next, Previous, Toggle, Toggle, Next, GetToken, GetToken};
+    ACTION_queue_t q;
+    SPTF_action_t action;
+    uint32_t popped = 0;
+
+    memset(&q, 0, sizeof(q));
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint8_t cmd : burst) {
+            actionQueuePush(&q, cmd);
+        }
+        while (actionQueuePop(&q, &action)) {
+            popped++;
+        }
+    }
+    char extra[64];
+    snprintf(extra, sizeof(extra), "%.2f actions/burst, %u merged", (double) popped / iterations, q.merged);
+    report("action coalescing", iterations, nowUs() - start, extra);
+}
+
+
+/**
+ * Render the playing screen, a new track every 100 frames
+ *
+ * @param iterations
+ */
+static void benchRender(uint32_t iterations) {
+    LinuxDisplay *lcd = linuxDisplay();
+    SPTF_state_t state;
+
+    memset(&state, 0, sizeof(state));
+    state.is_playing = false;
+    state.duration_ms = 320357;
+    strlcpy(state.name, "One More Time", sizeof(state.name));
+    strlcpy(state.artists, "Daft Punk, Romanthony", sizeof(state.artists));
+
+    lcd->calls = 0;
+    lcd->pixels = 0;
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (i % 100 == 0) {
+            snprintf(state.id, sizeof(state.id), "track%u", i / 100);
+            state.progress_ms = 0;
+        }
+        state.progress_ms += 1000;
+        stateBufferWrite(&sptf_state, state);
+        sptfDisplayPlaying();
+    }
+    char extra[64];
+    snprintf(extra, sizeof(extra), "%.1f LCD bytes/frame, %.2f calls/frame",
+             (double) lcd->pixels * 2 / iterations, (double) lcd->calls / iterations);
+    report("render playing", iterations, nowUs() - start, extra);
+}
+
+
+/**
+ * Draw album art, from cache after the first time
+ *
+ * @param iterations
+ */
+static void benchAlbumArt(uint32_t iterations) {
+    artCacheBegin();
+
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "album%u", i % 8);
+        sptfDisplayAlbumArt("", key);
+    }
+    report("album art (8 albums)", iterations, nowUs() - start);
+}
+
+
+/**
+ * Count a batch of log lines
+ *
+ * @param data
+ * @param type
+ * @param ctx
+ */
+static void countBatch(const char *data, EventsLogTypes type, void *ctx) {
+    (*(uint32_t *) ctx)++;
+}
+
+
+/**
+ * Log a response worth of lines (headers, then body spans), drained every
+ * 4 responses as if by a slow client
+ *
+ * @param iterations
+ */
+static void benchEventLog(uint32_t iterations) {
+    const char *header = "content-type: application/json; charset=utf-8";
+    std::string body(256, 'B');
+    uint32_t batches = 0;
+
+    eventLogBegin();
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        eventLogPush("<<<< RESPONSE", log_line);
+        for (uint8_t h = 0; h < 12; h++) {
+            eventLogPush(header, log_line);
+        }
+        for (uint8_t b = 0; b < 4; b++) {
+            eventLogPush(body.c_str(), log_raw);
+        }
+        if (i % 4 == 3) {
+            eventLogDrain(countBatch, &batches, 4);
+        }
+    }
+    eventLogDrain(countBatch, &batches, 0xFFFF);
+    char extra[64];
+    snprintf(extra, sizeof(extra), "%.2f batches/response, %u dropped", (double) batches / iterations,
+             eventLogDropped());
+    report("event log", iterations, nowUs() - start, extra);
+}
+
+
+/**
+ * Settings: commits of unchanged values (every iteration) and of new
+ * tokens (1 in 100)
+ *
+ * @param iterations
+ */
+static void benchSettings(uint32_t iterations) {
+    char token[64];
+
+    settingsBegin();
+    uint64_t start = nowUs();
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (i % 100 == 0) {
+            snprintf(token, sizeof(token), "token-%u", i);
+            settingsSetString(settings.access_token, sizeof(settings.access_token), token);
+        }
+        settings.polling_delay = 15000;
+        settingsCommit();
+    }
+    report("settings commit", iterations, nowUs() - start);
+}
+
+
+/**
+ * Print latency percentiles
+ *
+ * @param name
+ * @param samples   In us
+ */
+static void reportLatencies(const char *name, std::vector<uint32_t> &samples) {
+    if (samples.empty()) {
+        printf("%-20s no samples\n", name);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    printf("%-20s %6zu samples  p50 %7.1f ms  p90 %7.1f ms  p99 %7.1f ms  max %7.1f ms\n", name, n,
+           samples[n / 2] / 1000.0, samples[n * 9 / 10] / 1000.0, samples[n * 99 / 100] / 1000.0,
+           samples[n - 1] / 1000.0);
+}
+
+
+/**
+ * Run the network & UI loops against the mock server, with a scripted user:
+ * every 30 s, Next at 10 s, then pause at 20 s and play at 22 s
+ *
+ * @param seconds
+ * @param mock
+ */
+static void benchEndToEnd(uint32_t seconds, const MOCK_config_t &mock) {
+    uint16_t port = mockSpotifyStart(mock);
+    if (!port) {
+        printf("Unable to start mock server\n");
+        return;
+    }
+
+    sptf_config.client_id = "mock-client";
+    sptf_config.client_secret = "mock-secret";
+    sptf_config.api_host = "127.0.0.1";
+    sptf_config.api_port = port;
+    sptf_config.accounts_host = "127.0.0.1";
+    sptf_config.accounts_port = port;
+    refresh_token = "mock-refresh";
+    sptfAction = CurrentlyPlaying;
+    settingsBegin();
+
+    printf("Mock server on port %u: latency %u+%u ms, 429 %u%%, 503 %u%%, token %u s, tracks %u ms, "
+           "command lag %u ms\n", port, mock.latency_ms, mock.jitter_ms, mock.rate_limit_pct, mock.error_pct,
+           mock.token_lifetime_s, mock.track_ms, mock.command_lag_ms);
+
+    std::vector<uint32_t> poll_us, command_us, token_us, screen_us;
+    uint32_t start = millis();
+    uint32_t last_second = 0;
+    SPTF_state_t shown = {};
+    uint8_t pending_cmd = 0;            // Until the state handed over to the UI shows it
+    uint32_t pending_us = 0;
+
+    while (millis() - start < seconds * 1000) {
+        uint32_t second = (millis() - start) / 1000;
+        if (second != last_second) {
+            last_second = second;
+            if (second % 30 == 10) {
+                pending_cmd = Next;
+            } else if (second % 30 == 20 || second % 30 == 22) {
+                pending_cmd = Toggle;
+            }
+            if (second % 30 == 10 || second % 30 == 20 || second % 30 == 22) {
+                cmdQueuePush(&ui_cmd_queue, pending_cmd);
+                stateBufferRead(&sptf_state, &shown);
+                pending_us = micros();
+            }
+        }
+
+        MOCK_stats_t before = mockSpotifyStats();
+        uint32_t t0 = micros();
+        sptfNetLoop();
+        uint32_t elapsed = micros() - t0;
+        MOCK_stats_t after = mockSpotifyStats();
+
+        if (after.tokens != before.tokens) {
+            token_us.push_back(elapsed);
+        } else if (after.commands != before.commands) {
+            command_us.push_back(elapsed);
+        } else if (after.polls != before.polls) {
+            poll_us.push_back(elapsed);
+        }
+
+        SPTF_state_t state;
+        if (pending_cmd && stateBufferRead(&sptf_state, &state)
+            && (pending_cmd == Toggle ? state.is_playing != shown.is_playing : strcmp(state.id, shown.id) != 0)) {
+            screen_us.push_back(micros() - pending_us);
+            pending_cmd = 0;
+        }
+
+        sptfDisplayPlaying();
+        delay(10);
+    }
+
+    MOCK_stats_t stats = mockSpotifyStats();
+    reportLatencies("poll latency", poll_us);
+    reportLatencies("command latency", command_us);
+    reportLatencies("token latency", token_us);
+    reportLatencies("command to screen", screen_us);
+    printf("Follow-up delay: %u ms (pipelined up to the command round trip: %u ms)\n", sptf_follow_up_ms, sptf_command_ms);
+    printf("API calls: %u in %u s, %.0f calls/hour (token %u, polls %u, queue %u, commands %u)\n",
+           stats.requests, seconds, stats.requests * 3600.0 / seconds, stats.tokens, stats.polls, stats.queues,
+           stats.commands);
+    printf("Faults: %u rate limited, %u errors, %u unauthorized, %u connections\n",
+           stats.rate_limited, stats.errors, stats.unauthorized, stats.connections);
+    printf("Body bytes sent: %.0f per call\n", stats.requests ? (double) stats.body_bytes / stats.requests : 0.0);
+
+    if (getenv("M5SPOT_METRICS")) {
+        metricsWrite([](const char *line, void *ctx) {
+            fputs(line, stdout);
+        }, nullptr);
+        heapDiagWrite([](const char *line, void *ctx) {
+            fputs(line, stdout);
+        }, nullptr);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    lcd_mutex = xSemaphoreCreateMutex();
+
+    if (argc > 1 && strcmp(argv[1], "e2e") == 0) {
+        MOCK_config_t mock = {0, 80, 40, 0, 2, 0, 3600, 30000, 100};
+        uint32_t seconds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 60;
+        if (argc > 3) mock.latency_ms = strtoul(argv[3], nullptr, 10);
+        if (argc > 4) mock.rate_limit_pct = strtoul(argv[4], nullptr, 10);
+        if (argc > 5) mock.error_pct = strtoul(argv[5], nullptr, 10);
+        if (argc > 6) mock.token_lifetime_s = strtoul(argv[6], nullptr, 10);
+        if (argc > 7) mock.command_lag_ms = strtoul(argv[7], nullptr, 10);
+        benchEndToEnd(seconds, mock);
+        return 0;
+    }
+
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+
+    benchPlaying("currently-playing (length)", fixturePlayingResponse(false), iterations);
+    benchPlaying("currently-playing (chunked)", fixturePlayingResponse(true), iterations);
+    benchPlaying("currently-playing (gzip)", fixturePlayingResponse(true, true), iterations, true);
+    benchToken(iterations);
+    benchActions(iterations);
+    benchRender(iterations);
+    benchAlbumArt(min(iterations, (uint32_t) 200));
+    benchEventLog(iterations);
+    benchSettings(iterations);
+
+    return 0;
+}
+
+#endif // PIO_UNIT_TESTING
@@ -0,0 +1,68 @@
+#include "fixtures.h"
+#include "mock_spotify.h"
+
+
+/**
+ * Build a currently-playing response, the way Spotify sends it (chunked)
+ *
+ * @param chunked
+ * @param gzip
+ * @return
+ */
+std::string fixturePlayingResponse(bool chunked, bool gzip) {
+    std::string json = "{\n  \"timestamp\" : 1546300800000,\n  \"context\" : null,\n  \"progress_ms\" : 42000,\n"
+                       "  \"item\" : {\n    \"album\" : {\n      \"album_type\" : \"album\",\n"
+                       "      \"artists\" : [ { \"name\" : \"Daft Punk\", \"id\" : \"4tZwfgrHOc3mvqYlEYSvVi\" } ],\n"
+                       "      \"available_markets\" : [ ";
+    for (int i = 0; i < 79; i++) {
+        char market[16];
+        snprintf(market, sizeof(market), "%s\"%c%c\"", i ? ", " : "", 'A' + i % 26, 'A' + i / 26);
+        json += market;
+    }
+    json += " ],\n      \"id\" : \"2noRn2Aes5aoNVsU6iWThc\",\n      \"images\" : [ ";
+    const int sizes[] = {640, 300, 64};
+    for (int i = 0; i < 3; i++) {
+        char image[160];
+        snprintf(image, sizeof(image),
+                 "%s{\n        \"height\" : %d,\n        \"url\" : \"https://i.scdn.co/image/ab67616d0000b273%04d\",\n"
+                 "        \"width\" : %d\n      }", i ? ", " : "", sizes[i], sizes[i], sizes[i]);
+        json += image;
+    }
+    json += " ],\n      \"name\" : \"Discovery\"\n    },\n"
+            "    \"artists\" : [ { \"name\" : \"Daft Punk\" }, { \"name\" : \"Romanthony\" } ],\n"
+            "    \"duration_ms\" : 320357,\n    \"explicit\" : false,\n    \"id\" : \"" FIXTURE_TRACK_ID "\",\n"
+            "    \"name\" : \"One More Time\",\n    \"popularity\" : 75\n  },\n"
+            "  \"currently_playing_type\" : \"track\",\n  \"is_playing\" : true\n}";
+
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\n"
+                           "Cache-Control: private, max-age=0\r\nConnection: keep-alive\r\n";
+    if (gzip) {
+        json = mockGzip(json.data(), json.size());
+        response += "Content-Encoding: gzip\r\n";
+    }
+    if (chunked) {
+        response += "Transfer-Encoding: chunked\r\n\r\n";
+        for (size_t i = 0; i < json.size(); i += 1000) {
+            size_t n = min(json.size() - i, (size_t) 1000);
+            char size[16];
+            snprintf(size, sizeof(size), "%zx\r\n", n);
+            response += size + json.substr(i, n) + "\r\n";
+        }
+        response += "0\r\n\r\n";
+    } else {
+        response += "Content-Length: " + std::to_string(json.size()) + "\r\n\r\n" + json;
+    }
+    return response;
+}
+
+
+/**
+ * Build a token response
+ *
+ * @return
+ */
+std::string fixtureTokenJson() {
+    return "{\"access_token\":\"" + std::string(FIXTURE_ACCESS_TOKEN_LEN, 'A') + "\",\"token_type\":\"Bearer\","
+           "\"expires_in\":3600,\"refresh_token\":\"" + std::string(131, 'R') + "\","
+           "\"scope\":\"user-read-private user-read-currently-playing\"}";
+}
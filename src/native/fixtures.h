@@ -0,0 +1,69 @@
+#ifndef M5SPOT_NATIVE_FIXTURES_H
+#define M5SPOT_NATIVE_FIXTURES_H
+
+#include <string>
+#include <Arduino.h>
+#include "Client.h"
+#include "../sptf.h"
+
+/*
+ * Canned Spotify responses, and a client replaying them, shared by the
+ * benchmark and the unit tests (test/)
+ */
+
+#define FIXTURE_TRACK_ID "0DiWol3AO6WpXZgp0goxAV"
+#define FIXTURE_ACCESS_TOKEN_LEN 300
+
+/*
+ * Client replaying a canned response, in TCP segment sized reads
+ */
+class ReplayClient : public Client {
+public:
+    const char *data = "";
+    size_t len = 0;
+    size_t pos = 0;
+    size_t segment = 1460;
+
+    void rewind(const char *d, size_t l) {
+        data = d;
+        len = l;
+        pos = 0;
+    }
+
+    int connect(const char *host, uint16_t port) override {
+        return 1;
+    }
+
+    size_t write(const uint8_t *buff, size_t size) override {
+        return size;
+    }
+
+    int available() override {
+        return (int) min(len - pos, segment);
+    }
+
+    int read(uint8_t *buff, size_t size) override {
+        size_t n = min(size, (size_t) available());
+        memcpy(buff, data + pos, n);
+        pos += n;
+        return n ? (int) n : -1;
+    }
+
+    uint8_t connected() override {
+        return pos < len;
+    }
+
+    void stop() override {
+    }
+};
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+std::string fixturePlayingResponse(bool chunked, bool gzip = false);
+std::string fixtureTokenJson();
+//@formatter:on
+
+#endif // M5SPOT_NATIVE_FIXTURES_H
@@ -0,0 +1,413 @@
+#include <Arduino.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "hal_linux.h"
+
+/*
+ * Linux implementation of the hardware abstraction layer
+ */
+
+class LinuxFile : public HalFile {
+public:
+    LinuxFile(FILE *file, size_t *space) : file(file), space(space) {}
+
+    ~LinuxFile() override {
+        fclose(file);
+    }
+
+    size_t size() override {
+        long pos = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, pos, SEEK_SET);
+        return end;
+    }
+
+    size_t read(uint8_t *buff, size_t len) override {
+        return fread(buff, 1, len, file);
+    }
+
+    size_t write(const uint8_t *buff, size_t len) override {
+        size_t written = fwrite(buff, 1, len < *space ? len : *space, file);
+        *space -= written;
+        return written;
+    }
+
+private:
+    FILE *file;
+    size_t *space;
+};
+
+static LinuxDisplay display(LINUX_DISPLAY_WIDTH, LINUX_DISPLAY_HEIGHT);
+static LinuxStorage storage;
+/*
+ * Inflater on zlib (raw deflate, 32 KB window)
+ */
+class LinuxInflater : public HalInflater {
+public:
+    LinuxInflater();
+    ~LinuxInflater();
+
+    void reset() override;
+    HalInflateResults inflate(const uint8_t *in, size_t *len, HAL_inflate_cb_t out_cb, void *ctx) override;
+
+private:
+    z_stream zs;
+    bool done = false;
+    uint8_t out[4096];
+};
+
+static LinuxNvs nvs;
+static LinuxInflater inflater;
+
+
+LinuxDisplay::LinuxDisplay(int16_t w, int16_t h) : fb(new uint16_t[w * h]()), fb_width(w), fb_height(h) {
+}
+
+
+LinuxDisplay::~LinuxDisplay() {
+    delete[] fb;
+}
+
+
+int16_t LinuxDisplay::width() {
+    return fb_width;
+}
+
+
+int16_t LinuxDisplay::height() {
+    return fb_height;
+}
+
+
+/**
+ * Clip a rectangle to the screen
+ *
+ * @param x
+ * @param y
+ * @param w
+ * @param h
+ * @param dx    Columns cut on the left
+ * @param dy    Rows cut on the top
+ * @return false if nothing is left
+ */
+bool LinuxDisplay::clip(int32_t &x, int32_t &y, int32_t &w, int32_t &h, int32_t &dx, int32_t &dy) {
+    dx = x < 0 ? -x : 0;
+    dy = y < 0 ? -y : 0;
+    x += dx;
+    y += dy;
+    w -= dx;
+    h -= dy;
+    if (x + w > fb_width) {
+        w = fb_width - x;
+    }
+    if (y + h > fb_height) {
+        h = fb_height - y;
+    }
+    return w > 0 && h > 0;
+}
+
+
+void LinuxDisplay::fillScreen(uint16_t color) {
+    fillRect(0, 0, fb_width, fb_height, color);
+}
+
+
+void LinuxDisplay::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+    int32_t dx, dy;
+    calls++;
+    if (!clip(x, y, w, h, dx, dy)) {
+        return;
+    }
+    for (int32_t row = y; row < y + h; row++) {
+        for (int32_t col = x; col < x + w; col++) {
+            fb[row * fb_width + col] = color;
+        }
+    }
+    pixels += (uint64_t) w * h;
+}
+
+
+void LinuxDisplay::drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) {
+    int32_t w = textWidth(text, font);
+    int32_t h = fontHeight(font);
+
+    x -= (datum % 3) * w / 2;
+    y -= (datum / 3) * h / 2;
+    fillRect(x, y, w, h, color);
+}
+
+
+void LinuxDisplay::pushRect(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data) {
+    int32_t dx, dy, stride = w;
+    calls++;
+    if (!clip(x, y, w, h, dx, dy)) {
+        return;
+    }
+    for (int32_t row = 0; row < h; row++) {
+        memcpy(&fb[(y + row) * fb_width + x], &data[(row + dy) * stride + dx], w * sizeof(uint16_t));
+    }
+    pixels += (uint64_t) w * h;
+}
+
+
+void LinuxDisplay::readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data) {
+    int32_t dx, dy, stride = w;
+    if (!clip(x, y, w, h, dx, dy)) {
+        return;
+    }
+    for (int32_t row = 0; row < h; row++) {
+        memcpy(&data[(row + dy) * stride + dx], &fb[(y + row) * fb_width + x], w * sizeof(uint16_t));
+    }
+}
+
+
+// GLCD font (1) is 6x8, font 2 is about 8x16
+int16_t LinuxDisplay::textWidth(const char *text, uint8_t font) {
+    return strlen(text) * (font == 1 ? 6 : 8);
+}
+
+
+int16_t LinuxDisplay::fontHeight(uint8_t font) {
+    return font == 1 ? 8 : 16;
+}
+
+
+const uint16_t *LinuxDisplay::buffer() {
+    return fb;
+}
+
+
+/**
+ * Map a device path to the host directory
+ *
+ * @param path
+ * @param dest
+ * @param size
+ */
+void LinuxStorage::hostPath(const char *path, char *dest, size_t size) {
+    const char *root = getenv("M5SPOT_FS");
+    snprintf(dest, size, "%s%s", root ? root : "native_fs", path);
+}
+
+
+bool LinuxStorage::ready() {
+    const char *root = getenv("M5SPOT_FS");
+    ::mkdir(root ? root : "native_fs", 0755);
+    return true;
+}
+
+
+bool LinuxStorage::exists(const char *path) {
+    char host[256];
+    hostPath(path, host, sizeof(host));
+    return access(host, F_OK) == 0;
+}
+
+
+bool LinuxStorage::mkdir(const char *path) {
+    char host[256];
+    hostPath(path, host, sizeof(host));
+    return ::mkdir(host, 0755) == 0;
+}
+
+
+bool LinuxStorage::remove(const char *path) {
+    char host[256];
+    hostPath(path, host, sizeof(host));
+    return ::remove(host) == 0;
+}
+
+
+HalFile *LinuxStorage::open(const char *path, HalFileModes mode) {
+    char host[256];
+    hostPath(path, host, sizeof(host));
+    FILE *file = fopen(host, mode == hal_write ? "wb" : "rb");
+    return file ? new LinuxFile(file, &space) : nullptr;
+}
+
+
+/**
+ * Map a settings key to its file
+ *
+ * @param key
+ * @param dest
+ * @param size
+ */
+static void nvsPath(const char *key, char *dest, size_t size) {
+    const char *root = getenv("M5SPOT_FS");
+    snprintf(dest, size, "%s/%s.nvs", root ? root : "native_fs", key);
+}
+
+
+size_t LinuxNvs::read(const char *key, void *data, size_t size) {
+    char host[256];
+    nvsPath(key, host, sizeof(host));
+    FILE *file = fopen(host, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (len <= size && fread(data, 1, len, file) != len) {
+        len = 0;
+    }
+    fclose(file);
+    return len;
+}
+
+
+bool LinuxNvs::write(const char *key, const void *data, size_t size) {
+    char host[256], tmp[260];
+    storage.ready();
+    nvsPath(key, host, sizeof(host));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", host);
+
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(tmp, host) == 0;
+}
+
+
+LinuxInflater::LinuxInflater() {
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, -MAX_WBITS);
+}
+
+
+LinuxInflater::~LinuxInflater() {
+    inflateEnd(&zs);
+}
+
+
+void LinuxInflater::reset() {
+    inflateReset(&zs);
+    done = false;
+}
+
+
+HalInflateResults LinuxInflater::inflate(const uint8_t *in, size_t *len, HAL_inflate_cb_t out_cb, void *ctx) {
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = *len;
+
+    int ret = Z_OK;
+    while (!done && (zs.avail_in || ret == Z_OK)) {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = ::inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return hal_inflate_error;
+        }
+        if (zs.avail_out < sizeof(out)) {
+            out_cb((const char *) out, sizeof(out) - zs.avail_out, ctx);
+        } else if (ret == Z_BUF_ERROR || zs.avail_in == 0) {
+            break;
+        }
+        done = ret == Z_STREAM_END;
+    }
+
+    *len -= zs.avail_in;
+    return done ? hal_inflate_done : hal_inflate_more;
+}
+
+
+/**
+ * Get the display
+ *
+ * @return
+ */
+HalDisplay *halDisplay() {
+    return &display;
+}
+
+
+/**
+ * Create an off-screen canvas
+ *
+ * @param w
+ * @param h
+ * @return
+ */
+HalCanvas *halCreateCanvas(int16_t w, int16_t h) {
+    return new LinuxDisplay(w, h);
+}
+
+
+/**
+ * Get the display, with its framebuffer & counters
+ *
+ * @return
+ */
+LinuxDisplay *linuxDisplay() {
+    return &display;
+}
+
+
+/**
+ * Get the storage
+ *
+ * @return
+ */
+HalStorage *halStorage() {
+    return &storage;
+}
+
+
+/**
+ * Get the storage, with its free space
+ *
+ * @return
+ */
+LinuxStorage *linuxStorage() {
+    return &storage;
+}
+
+
+/**
+ * Get the settings store
+ *
+ * @return
+ */
+HalNvs *halNvs() {
+    return &nvs;
+}
+
+
+/**
+ * Get the inflater
+ *
+ * @return
+ */
+HalInflater *halInflater() {
+    return &inflater;
+}
+
+
+/**
+ * Get heap usage
+ *
+ * glibc does not tell the largest free block, the biggest free chunk
+ * is reported as the top chunk (keepcost), which is what big blocks
+ * come from.
+ *
+ * @param heap
+ */
+void halHeap(HAL_heap_t *heap) {
+    static uint32_t min_free = 0xFFFFFFFF;
+    struct mallinfo2 info = mallinfo2();
+
+    heap->free = info.fordblks;
+    heap->largest_free_block = info.keepcost;
+    if (heap->free < min_free) {
+        min_free = heap->free;
+    }
+    heap->min_free = min_free;
+}
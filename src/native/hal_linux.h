@@ -0,0 +1,76 @@
+#ifndef M5SPOT_NATIVE_HAL_LINUX_H
+#define M5SPOT_NATIVE_HAL_LINUX_H
+
+#include "../hal/hal.h"
+
+#define LINUX_DISPLAY_WIDTH 320
+#define LINUX_DISPLAY_HEIGHT 240
+
+/*
+ * Display drawing into an in-memory framebuffer, counting what is drawn
+ * (text is drawn as its bounding box, there are no fonts).
+ * Used for both the screen and off-screen canvases.
+ */
+class LinuxDisplay : public HalCanvas {
+public:
+    uint16_t *fb;
+    uint32_t calls = 0;
+    uint64_t pixels = 0;
+
+    LinuxDisplay(int16_t w, int16_t h);
+    ~LinuxDisplay() override;
+
+    int16_t width() override;
+    int16_t height() override;
+    void fillScreen(uint16_t color) override;
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) override;
+    void drawText(const char *text, int32_t x, int32_t y, uint8_t font, HalDatums datum, uint16_t color) override;
+    void pushRect(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *pixels) override;
+    void readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *pixels) override;
+    int16_t textWidth(const char *text, uint8_t font) override;
+    int16_t fontHeight(uint8_t font) override;
+    const uint16_t *buffer() override;
+
+private:
+    int16_t fb_width;
+    int16_t fb_height;
+
+    bool clip(int32_t &x, int32_t &y, int32_t &w, int32_t &h, int32_t &dx, int32_t &dy);
+};
+
+/*
+ * Storage in a host directory ($M5SPOT_FS, ./native_fs by default)
+ */
+class LinuxStorage : public HalStorage {
+public:
+    size_t space = SIZE_MAX;    // Bytes that can still be written, lower it for a full card
+
+    bool ready() override;
+    bool exists(const char *path) override;
+    bool mkdir(const char *path) override;
+    bool remove(const char *path) override;
+    HalFile *open(const char *path, HalFileModes mode) override;
+
+private:
+    void hostPath(const char *path, char *dest, size_t size);
+};
+
+/*
+ * Settings store, a file per key in the storage directory
+ * (written to a temporary file then renamed, like NVS never leaves half a blob)
+ */
+class LinuxNvs : public HalNvs {
+public:
+    size_t read(const char *key, void *data, size_t size) override;
+    bool write(const char *key, const void *data, size_t size) override;
+};
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+LinuxDisplay *linuxDisplay();
+LinuxStorage *linuxStorage();
+//@formatter:on
+
+#endif // M5SPOT_NATIVE_HAL_LINUX_H
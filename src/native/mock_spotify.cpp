@@ -0,0 +1,470 @@
+#include <Arduino.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <zlib.h>
+#include "mock_spotify.h"
+
+typedef struct {
+    const char *id;
+    const char *album_id;
+    const char *name;
+    const char *artists;    // JSON array content
+} MOCK_track_t;
+
+static const MOCK_track_t tracks[MOCK_TRACK_COUNT] = {
+        {"0DiWol3AO6WpXZgp0goxAV", "2noRn2Aes5aoNVsU6iWThc", "One More Time", "{\"name\":\"Daft Punk\"}"},
+        {"2VEZx7NWsZ1D0eJ4uv5Fym", "2noRn2Aes5aoNVsU6iWThc", "Aerodynamic", "{\"name\":\"Daft Punk\"}"},
+        {"5W3cjX2J3tjhG8zb6u0qHn", "4m2880jivSbbyEGAKfITCa", "Harder, Better, Faster, Stronger", "{\"name\":\"Daft Punk\"}"},
+        {"3n3Ppam7vgaVa1iaRUc9Lp", "6TJmQnO44YE5BtTxH8pop1", "Mr. Brightside", "{\"name\":\"The Killers\"}"},
+        {"7ouMYWpwJ422jRcDASZB7P", "0ETFjACtuP2ADo6LFhL6HN", "Knights of Cydonia", "{\"name\":\"Muse\"},{\"name\":\"Guest\"}"}
+};
+
+static MOCK_config_t config;
+static MOCK_stats_t stats;
+static std::mutex state_mutex;
+
+static char token[32] = "";
+static uint32_t token_millis = 0;
+static uint32_t token_counter = 0;
+
+typedef struct {
+    bool is_playing;
+    uint32_t base_pos_ms;     // Position in the rotation at base_millis
+    uint32_t base_millis;
+} MOCK_playback_t;
+
+static MOCK_playback_t playback = {true, 0, 0};
+static MOCK_playback_t shown = playback;    // Reported until lag_until (command_lag_ms)
+static uint32_t lag_until = 0;
+static int drop_next = 0;                       // Next request on a kept-alive connection
+
+
+/**
+ * Position in the track rotation
+ *
+ * @param p
+ * @return
+ */
+static uint32_t rotationPos(const MOCK_playback_t &p) {
+    return p.base_pos_ms + (p.is_playing ? millis() - p.base_millis : 0);
+}
+
+
+/**
+ * Gzip compress
+ *
+ * @param data
+ * @param len
+ * @return
+ */
+std::string mockGzip(const char *data, size_t len) {
+    z_stream zs = {};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+
+    std::string out(deflateBound(&zs, len) + 32, '\0');
+    zs.next_in = (Bytef *) data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *) &out[0];
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+
+/**
+ * Send a response
+ *
+ * @param fd
+ * @param code
+ * @param extra_headers
+ * @param body
+ * @param gzip          Content-Encoding: gzip, body (if any) compressed
+ */
+static void sendResponse(int fd, int code, const char *extra_headers, const char *body, bool gzip = false) {
+    const char *reason = code == 200 ? "OK" : code == 204 ? "No Content" : code == 401 ? "Unauthorized"
+                       : code == 404 ? "Not Found" : code == 429 ? "Too Many Requests" : "Service Unavailable";
+    std::string content = gzip && body[0] ? mockGzip(body, strlen(body)) : std::string(body);
+    char headers[320];
+    int len = snprintf(headers, sizeof(headers),
+                       "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: application/json; charset=utf-8\r\n"
+                       "Content-Length: %zu\r\n"
+                       "%s%s"
+                       "Connection: keep-alive\r\n\r\n",
+                       code, reason, content.size(), gzip ? "Content-Encoding: gzip\r\n" : "",
+                       extra_headers);
+    send(fd, headers, len, MSG_NOSIGNAL);
+    send(fd, content.data(), content.size(), MSG_NOSIGNAL);
+    __sync_fetch_and_add(&stats.body_bytes, content.size());
+}
+
+
+/**
+ * POST /api/token
+ *
+ * @param fd
+ * @param body
+ */
+static void handleToken(int fd, const char *body) {
+    char response[256];
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    snprintf(token, sizeof(token), "mock-access-%u", ++token_counter);
+    token_millis = millis();
+    stats.tokens++;
+
+    snprintf(response, sizeof(response),
+             "{\"access_token\":\"%s\",\"token_type\":\"Bearer\",\"expires_in\":%u%s,"
+             "\"scope\":\"user-read-private user-read-currently-playing\"}",
+             token, config.token_lifetime_s,
+             strstr(body, "grant_type=authorization_code") ? ",\"refresh_token\":\"mock-refresh\"" : "");
+    sendResponse(fd, 200, "", response);
+}
+
+
+/**
+ * Track object, as in currently-playing & queue responses
+ *
+ * Album & track come with their available_markets (~180 of them, like
+ * on Spotify), unless a market is given.
+ *
+ * @param track
+ * @param with_markets
+ * @return
+ */
+static std::string trackJson(const MOCK_track_t &track, bool with_markets) {
+    char markets[1024] = "";
+    if (with_markets) {
+        strcpy(markets, "\"available_markets\":[");
+        for (int i = 0; i < 180; i++) {
+            char market[8];
+            snprintf(market, sizeof(market), "%s\"%c%c\"", i ? "," : "", 'A' + i % 26, 'A' + i / 26);
+            strcat(markets, market);
+        }
+        strcat(markets, "],");
+    }
+
+    char json[3072];
+    snprintf(json, sizeof(json),
+             "{\"album\":{%s\"id\":\"%s\",\"images\":["
+             "{\"height\":640,\"url\":\"https://i.scdn.co/image/%s-640\",\"width\":640},"
+             "{\"height\":300,\"url\":\"https://i.scdn.co/image/%s-300\",\"width\":300},"
+             "{\"height\":64,\"url\":\"https://i.scdn.co/image/%s-64\",\"width\":64}],"
+             "\"name\":\"Album\"},\"artists\":[%s],%s\"duration_ms\":%u,\"id\":\"%s\",\"name\":\"%s\"}",
+             markets, track.album_id, track.album_id, track.album_id, track.album_id,
+             track.artists, markets, config.track_ms, track.id, track.name);
+    return json;
+}
+
+
+/**
+ * Playback state as reported, i.e. without the commands of the last command_lag_ms
+ *
+ * @return
+ */
+static const MOCK_playback_t &reportedPlayback() {
+    return (int32_t) (millis() - lag_until) < 0 ? shown : playback;
+}
+
+
+/**
+ * GET /v1/me/player/currently-playing
+ *
+ * @param fd
+ * @param query
+ * @param gzip
+ */
+static void handleCurrentlyPlaying(int fd, const char *query, bool gzip) {
+    char response[4096];
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    const MOCK_playback_t &p = reportedPlayback();
+    uint32_t pos = rotationPos(p);
+    const MOCK_track_t &track = tracks[(pos / config.track_ms) % MOCK_TRACK_COUNT];
+    stats.polls++;
+
+    snprintf(response, sizeof(response),
+             "{\"timestamp\":%u,\"progress_ms\":%u,\"is_playing\":%s,\"currently_playing_type\":\"track\","
+             "\"item\":%s}",
+             millis(), pos % config.track_ms, p.is_playing ? "true" : "false",
+             trackJson(track, !strstr(query, "market=")).c_str());
+    sendResponse(fd, 200, "", response, gzip);
+}
+
+
+/**
+ * GET /v1/me/player/queue: current track, then the next MOCK_QUEUE_SIZE
+ * ones of the rotation
+ *
+ * @param fd
+ * @param gzip
+ */
+static void handleQueue(int fd, bool gzip) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    uint32_t track_nr = rotationPos(reportedPlayback()) / config.track_ms;
+    stats.queues++;
+
+    std::string response = "{\"currently_playing\":" + trackJson(tracks[track_nr % MOCK_TRACK_COUNT], true);
+    response += ",\"queue\":[";
+    for (uint32_t i = 1; i <= MOCK_QUEUE_SIZE; i++) {
+        response += (i > 1 ? "," : "") + trackJson(tracks[(track_nr + i) % MOCK_TRACK_COUNT], true);
+    }
+    response += "]}";
+    sendResponse(fd, 200, "", response.c_str(), gzip);
+}
+
+
+/**
+ * POST /v1/me/player/next|previous, PUT /v1/me/player/play|pause
+ *
+ * @param fd
+ * @param endpoint
+ * @param gzip      Content-Encoding sent along with the empty body, as some servers do
+ */
+static void handleCommand(int fd, const char *endpoint, bool gzip) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    uint32_t pos = rotationPos(playback);
+    uint32_t track_nr = pos / config.track_ms;
+    MOCK_playback_t previous = playback;
+    stats.commands++;
+
+    if (strcmp(endpoint, "next") == 0) {
+        playback.base_pos_ms = (track_nr + 1) * config.track_ms;
+    } else if (strcmp(endpoint, "previous") == 0) {
+        playback.base_pos_ms = (track_nr ? track_nr - 1 : 0) * config.track_ms;
+    } else if (strcmp(endpoint, "pause") == 0) {
+        playback.base_pos_ms = pos;
+        playback.is_playing = false;
+    } else if (strcmp(endpoint, "play") == 0) {
+        playback.base_pos_ms = pos;
+        playback.is_playing = true;
+    } else {
+        stats.commands--;
+        sendResponse(fd, 404, "", "{\"error\":{\"status\":404,\"message\":\"Service not found\"}}");
+        return;
+    }
+    playback.base_millis = millis();
+
+    // Like Spotify, commands take a while to show in the playback state
+    if ((int32_t) (millis() - lag_until) >= 0) {
+        shown = previous;
+    }
+    lag_until = millis() + config.command_lag_ms;
+    sendResponse(fd, 204, "", "", gzip);
+}
+
+
+/**
+ * Route a request, after fault injection
+ *
+ * @param fd
+ * @param method
+ * @param path
+ * @param authorization
+ * @param body
+ * @param gzip          Accept-Encoding: gzip
+ */
+static void handleRequest(int fd, const char *method, char *path, const char *authorization, const char *body,
+                          bool gzip) {
+    char *query = strchr(path, '?');
+    if (query) {
+        *query++ = '\0';
+    }
+
+    uint32_t latency = config.latency_ms + (config.jitter_ms ? random(config.jitter_ms) : 0);
+    if (latency) {
+        delay(latency);
+    }
+
+    long dice = random(100);
+    if (dice < config.rate_limit_pct) {
+        __sync_fetch_and_add(&stats.rate_limited, 1);
+        char retry_after[32];
+        snprintf(retry_after, sizeof(retry_after), "Retry-After: %u\r\n", config.retry_after_s);
+        sendResponse(fd, 429, retry_after, "{\"error\":{\"status\":429,\"message\":\"API rate limit exceeded\"}}");
+        return;
+    }
+    if (dice < config.rate_limit_pct + config.error_pct) {
+        __sync_fetch_and_add(&stats.errors, 1);
+        sendResponse(fd, 503, "", "{\"error\":{\"status\":503,\"message\":\"Service unavailable\"}}");
+        return;
+    }
+
+    if (strcmp(method, "POST") == 0 && strcmp(path, "/api/token") == 0) {
+        handleToken(fd, body);
+        return;
+    }
+
+    if (strncmp(path, "/v1/me/player/", 14) != 0) {
+        sendResponse(fd, 404, "", "{\"error\":{\"status\":404,\"message\":\"Service not found\"}}");
+        return;
+    }
+
+    bool authorized;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        authorized = token[0] && strncmp(authorization, "Bearer ", 7) == 0 && strcmp(authorization + 7, token) == 0
+                     && millis() - token_millis < config.token_lifetime_s * 1000;
+    }
+    if (!authorized) {
+        __sync_fetch_and_add(&stats.unauthorized, 1);
+        sendResponse(fd, 401, "", "{\"error\":{\"status\":401,\"message\":\"The access token expired\"}}");
+        return;
+    }
+
+    if (strcmp(path + 14, "currently-playing") == 0) {
+        handleCurrentlyPlaying(fd, query ? query : "", gzip);
+    } else if (strcmp(path + 14, "queue") == 0) {
+        handleQueue(fd, gzip);
+    } else {
+        handleCommand(fd, path + 14, gzip);
+    }
+}
+
+
+/**
+ * Serve requests of a kept-alive connection until it is closed
+ *
+ * @param fd
+ */
+static void serveConnection(int fd) {
+    static const size_t buff_size = 4096;
+    char *buff = new char[buff_size + 1];
+    size_t len = 0;
+    uint32_t served = 0;
+
+    while (true) {
+        char *end = nullptr;
+        while (!(end = (char *) memmem(buff, len, "\r\n\r\n", 4))) {
+            ssize_t n = len < buff_size ? recv(fd, buff + len, buff_size - len, 0) : 0;
+            if (n <= 0) {
+                close(fd);
+                delete[] buff;
+                return;
+            }
+            len += n;
+        }
+        *end = '\0';
+
+        char method[8] = "", path[128] = "", authorization[128] = "";
+        size_t content_length = 0;
+        bool gzip = false;
+        sscanf(buff, "%7s %127s", method, path);
+        for (char *line = strstr(buff, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+                content_length = strtoul(line + 17, nullptr, 10);
+            } else if (strncasecmp(line + 2, "Authorization:", 14) == 0) {
+                sscanf(line + 16, " %127[^\r]", authorization);
+            } else if (strncasecmp(line + 2, "Accept-Encoding:", 16) == 0) {
+                char *eol = strstr(line + 2, "\r\n");
+                gzip = memmem(line + 2, eol ? eol - line - 2 : strlen(line + 2), "gzip", 4) != nullptr;
+            }
+        }
+
+        size_t header_len = end + 4 - buff;
+        while (len < header_len + content_length && len < buff_size) {
+            ssize_t n = recv(fd, buff + len, buff_size - len, 0);
+            if (n <= 0) {
+                close(fd);
+                delete[] buff;
+                return;
+            }
+            len += n;
+        }
+
+        char body[1024];
+        snprintf(body, sizeof(body), "%.*s", (int) content_length, buff + header_len);
+
+        if (served++ > 0 && __sync_bool_compare_and_swap(&drop_next, 1, 0)) {
+            __sync_fetch_and_add(&stats.dropped, 1);
+            close(fd);
+            delete[] buff;
+            return;
+        }
+
+        __sync_fetch_and_add(&stats.requests, 1);
+        handleRequest(fd, method, path, authorization, body, gzip);
+
+        size_t consumed = header_len + content_length < len ? header_len + content_length : len;
+        memmove(buff, buff + consumed, len - consumed);
+        len -= consumed;
+    }
+}
+
+
+/**
+ * Start the mock server (in background threads)
+ *
+ * @param cfg
+ * @return Listening port, 0 on failure
+ */
+uint16_t mockSpotifyStart(const MOCK_config_t &cfg) {
+    config = cfg;
+    memset(&stats, 0, sizeof(stats));
+    drop_next = 0;
+    playback.base_millis = millis();
+    shown = playback;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(cfg.port);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 8) != 0
+        || getsockname(fd, (sockaddr *) &addr, &addr_len) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    std::thread([fd]() {
+        while (true) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+            int one = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            __sync_fetch_and_add(&stats.connections, 1);
+            std::thread(serveConnection, client).detach();
+        }
+    }).detach();
+
+    return ntohs(addr.sin_port);
+}
+
+
+/**
+ * Get a copy of the counters
+ *
+ * @return
+ */
+MOCK_stats_t mockSpotifyStats() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return stats;
+}
+
+
+/**
+ * Drop the next request received on a kept-alive connection: the connection
+ * is closed without an answer and the request is not processed
+ */
+void mockSpotifyDropNext() {
+    __sync_lock_test_and_set(&drop_next, 1);
+}
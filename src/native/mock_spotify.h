@@ -0,0 +1,60 @@
+#ifndef M5SPOT_NATIVE_MOCK_SPOTIFY_H
+#define M5SPOT_NATIVE_MOCK_SPOTIFY_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * Local stand-in for accounts.spotify.com/api/token and
+ * api.spotify.com/v1/me/player/..., over plain HTTP/1.1 with keep-alive
+ *
+ * Plays a rotation of canned tracks in real time, and injects latency,
+ * rate limiting (429 + Retry-After), server errors (503), token expiry and
+ * the delay before commands show in the playback state. A kept-alive
+ * connection can also be dropped without an answer, as on a server idle
+ * timeout racing the next request.
+ * Currently-playing & queue responses are gzipped if accepted, command
+ * responses then have the Content-Encoding header with their empty body.
+ */
+
+#define MOCK_TRACK_COUNT 5
+#define MOCK_QUEUE_SIZE 10
+
+typedef struct {
+    uint16_t port;              // 0 for any free port
+    uint32_t latency_ms;        // Added before every response
+    uint32_t jitter_ms;         // Random extra latency, up to...
+    uint8_t rate_limit_pct;     // % of requests answered 429
+    uint32_t retry_after_s;
+    uint8_t error_pct;          // % of requests answered 503
+    uint32_t token_lifetime_s;  // expires_in, tokens are refused (401) afterwards
+    uint32_t track_ms;          // Duration of every track of the rotation
+    uint32_t command_lag_ms;    // Until player commands show in currently-playing
+} MOCK_config_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t connections;
+    uint32_t tokens;
+    uint32_t polls;
+    uint32_t queues;
+    uint32_t commands;
+    uint32_t rate_limited;
+    uint32_t errors;
+    uint32_t unauthorized;
+    uint32_t dropped;           // Connections closed on a request, without processing it
+    uint64_t body_bytes;        // Sent, compressed or not
+} MOCK_stats_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+uint16_t mockSpotifyStart(const MOCK_config_t &config);
+MOCK_stats_t mockSpotifyStats();
+void mockSpotifyDropNext();
+std::string mockGzip(const char *data, size_t len);
+//@formatter:on
+
+#endif // M5SPOT_NATIVE_MOCK_SPOTIFY_H
@@ -0,0 +1,218 @@
+#include <Arduino.h>
+#include "../sptf.h"
+#include "../art_cache.h"
+#include "../metrics.h"
+#include "../settings.h"
+#include "hal_linux.h"
+
+/*
+ * Platform hooks of the portable modules, for the native environment
+ * (main.cpp has the M5Stack ones)
+ */
+
+bool ota_in_progress = false;
+bool send_events = false;
+
+static HalCanvas *art_staging = nullptr;
+static char art_staged_key[96] = "";
+
+
+/**
+ * Placeholder album art color
+ *
+ * @param cache_key
+ * @return
+ */
+static uint16_t albumArtColor(const char *cache_key) {
+    uint16_t color = 0;
+    for (const char *c = cache_key; *c; c++) {
+        color = color * 31 + *c;
+    }
+    return color;
+}
+
+
+/**
+ * Send log to stdout (instead of the browser)
+ *
+ * @param logData
+ * @param type
+ */
+void eventsSendLog(const char *logData, EventsLogTypes type) {
+    if (!send_events) return;
+    printf(type == log_line ? "%s\n" : "%s", logData);
+}
+
+
+/**
+ * Send infos to stdout
+ *
+ * @param msg
+ * @param payload
+ */
+void eventsSendInfo(const char *msg, const char *payload) {
+    if (!send_events) return;
+    printf("[info] %s %s\n", msg, payload);
+}
+
+
+/**
+ * Send errors to stdout
+ *
+ * @param code
+ * @param msg
+ * @param payload
+ */
+void eventsSendError(int code, const char *msg, const char *payload) {
+    if (!send_events) return;
+    printf("[error] %d %s %s\n", code, msg, payload);
+}
+
+
+/**
+ * Clear the boot screen, once
+ */
+static void clearBootScreen() {
+    static bool cleared = false;
+    if (!cleared) {
+        halDisplay()->fillScreen(HAL_WHITE);
+        cleared = true;
+    }
+}
+
+
+/**
+ * Display album art
+ *
+ * There is no JPEG decoder off target: a flat placeholder, colored after
+ * the cache key, is drawn then cached like a decoded album art would be.
+ *
+ * @param url
+ * @param cache_key
+ */
+void sptfDisplayAlbumArt(const char *url, const char *cache_key) {
+    HalDisplay *lcd = halDisplay();
+    clearBootScreen();
+
+    if (artCacheDraw(cache_key, SPTF_ART_X, SPTF_ART_Y)) {
+        metricsCount(mc_album_art_cache_hits);
+        return;
+    }
+
+    if (art_staged_key[0] && strcmp(art_staged_key, cache_key) == 0) {
+        lcd->pushRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, art_staging->buffer());
+        metricsCount(mc_album_art_prefetch_hits);
+    } else {
+        metricsCount(mc_album_art_downloads);
+        lcd->fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, albumArtColor(cache_key));
+    }
+    artCacheStore(cache_key, SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H);
+}
+
+
+/**
+ * Clear album art, for tracks without any
+ */
+void sptfClearAlbumArt() {
+    clearBootScreen();
+    halDisplay()->fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, HAL_WHITE);
+}
+
+
+/**
+ * Prefetched album art is kept in the staging canvas, memory is no issue here
+ *
+ * @return
+ */
+bool sptfCanPrefetchAlbumArt() {
+    return true;
+}
+
+
+/**
+ * Prefetch album art into the staging canvas (placeholder, like above)
+ *
+ * @param url
+ * @param cache_key
+ * @return
+ */
+bool sptfPrefetchAlbumArt(const char *url, const char *cache_key) {
+    if (artCacheHas(cache_key) || strcmp(art_staged_key, cache_key) == 0) {
+        return true;
+    }
+    if (!art_staging && !(art_staging = halCreateCanvas(SPTF_ART_W, SPTF_ART_H))) {
+        return false;
+    }
+
+    metricsCount(mc_album_art_downloads);
+    art_staging->fillScreen(albumArtColor(cache_key));
+    strlcpy(art_staged_key, cache_key, sizeof(art_staged_key));
+    return true;
+}
+
+
+/**
+ * Write refresh token to settings
+ */
+void writeRefreshToken() {
+    settingsLock();
+    settingsSetString(settings.refresh_token, sizeof(settings.refresh_token), refresh_token.c_str());
+    settingsCommit();
+    settingsUnlock();
+}
+
+
+/**
+ * Write access token to settings, with its expiry
+ *
+ * @param expires_at
+ */
+void writeAccessToken(uint32_t expires_at) {
+    settingsLock();
+    if (!settingsSetString(settings.access_token, sizeof(settings.access_token), access_token.c_str())) {
+        settings.access_token[0] = '\0';
+    }
+    settings.access_token_expires_at = expires_at;
+    settings.token_refreshes++;
+    settingsCommit();
+    settingsUnlock();
+}
+
+
+/**
+ * Delete refresh & access tokens from settings
+ */
+void deleteRefreshToken() {
+    settingsLock();
+    settingsSetString(settings.refresh_token, sizeof(settings.refresh_token), "");
+    settingsSetString(settings.access_token, sizeof(settings.access_token), "");
+    settings.access_token_expires_at = 0;
+    settingsCommit();
+    settingsUnlock();
+}
+
+
+/**
+ * Base 64 encode
+ *
+ * @param str
+ * @return
+ */
+String b64Encode(String str) {
+    static const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t *in = (const uint8_t *) str.c_str();
+    size_t len = str.length();
+
+    String out;
+    out.reserve((len + 2) / 3 * 4);
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n = (uint32_t) in[i] << 16;
+        if (i + 1 < len) n |= (uint32_t) in[i + 1] << 8;
+        if (i + 2 < len) n |= in[i + 2];
+        out += chars[(n >> 18) & 0x3F];
+        out += chars[(n >> 12) & 0x3F];
+        out += i + 1 < len ? chars[(n >> 6) & 0x3F] : '=';
+        out += i + 2 < len ? chars[n & 0x3F] : '=';
+    }
+    return out;
+}
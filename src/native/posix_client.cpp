@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "posix_client.h"
+
+
+PosixClient::~PosixClient() {
+    stop();
+}
+
+
+/**
+ * Connect to host:port
+ *
+ * @param host
+ * @param port
+ * @return 1 if connected, 0 otherwise
+ */
+int PosixClient::connect(const char *host, uint16_t port) {
+    stop();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        return 0;
+    }
+
+    for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd >= 0 ? 1 : 0;
+}
+
+
+/**
+ * Send bytes
+ *
+ * @param buff
+ * @param size
+ * @return Number of bytes sent
+ */
+size_t PosixClient::write(const uint8_t *buff, size_t size) {
+    size_t done = 0;
+    while (fd >= 0 && done < size) {
+        ssize_t sent = send(fd, buff + done, size - done, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            stop();
+            break;
+        }
+        done += sent;
+    }
+    return done;
+}
+
+
+/**
+ * Number of bytes ready to be read without blocking
+ *
+ * @return
+ */
+int PosixClient::available() {
+    int count = 0;
+    if (fd < 0 || ioctl(fd, FIONREAD, &count) != 0) {
+        return 0;
+    }
+    return count;
+}
+
+
+/**
+ * Read available bytes
+ *
+ * @param buff
+ * @param size
+ * @return Number of bytes read, -1 if none
+ */
+int PosixClient::read(uint8_t *buff, size_t size) {
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = recv(fd, buff, size, MSG_DONTWAIT);
+    return len > 0 ? (int) len : -1;
+}
+
+
+/**
+ * Whether the socket is still open, or has unread data
+ *
+ * @return
+ */
+uint8_t PosixClient::connected() {
+    if (fd < 0) {
+        return 0;
+    }
+    char c;
+    ssize_t len = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Close the socket
+ */
+void PosixClient::stop() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef M5SPOT_NATIVE_POSIX_CLIENT_H
+#define M5SPOT_NATIVE_POSIX_CLIENT_H
+
+#include <Client.h>
+
+/*
+ * Plain TCP client over POSIX sockets
+ *
+ * Stands for WiFiClientSecure in the native environment: no TLS,
+ * requests are meant for a local (mock) server.
+ */
+class PosixClient : public Client {
+public:
+    ~PosixClient() override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(const uint8_t *buff, size_t size) override;
+    int available() override;
+    int read(uint8_t *buff, size_t size) override;
+    uint8_t connected() override;
+    void stop() override;
+
+private:
+    int fd = -1;
+};
+
+#endif // M5SPOT_NATIVE_POSIX_CLIENT_H
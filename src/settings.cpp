@@ -0,0 +1,132 @@
+#include <Arduino.h>
+#include "settings.h"
+#include "hal/hal.h"
+#include "metrics.h"
+
+#define SETTINGS_KEY "settings"
+#define SETTINGS_HEADER_SIZE offsetof(SETTINGS_t, refresh_token)
+
+SETTINGS_t settings;
+
+static uint32_t stored_crc = 0;
+static bool stored_current = false;     // NVS holds a valid record of this version
+static SemaphoreHandle_t mutex = nullptr;
+
+
+/**
+ * CRC-32 (IEEE 802.3) of the fields after the header
+ *
+ * @param s
+ * @param size
+ * @return
+ */
+static uint32_t settingsCrc(const SETTINGS_t *s, size_t size) {
+    const uint8_t *data = (const uint8_t *) s + SETTINGS_HEADER_SIZE;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = SETTINGS_HEADER_SIZE; i < size; i++) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+
+/**
+ * Load settings from NVS, in one read
+ *
+ * Defaults (all zeros) are used if there is no record, or if it is
+ * corrupted or from a newer firmware.
+ *
+ * @return false if defaults are used
+ */
+bool settingsBegin() {
+    if (!mutex) {
+        mutex = xSemaphoreCreateMutex();
+    }
+
+    SETTINGS_t loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    size_t len = halNvs()->read(SETTINGS_KEY, &loaded, sizeof(loaded));
+
+    bool valid = len >= SETTINGS_HEADER_SIZE && len <= sizeof(loaded) && loaded.size == len
+                 && loaded.version >= 1 && loaded.version <= SETTINGS_VERSION
+                 && loaded.crc == settingsCrc(&loaded, len);
+    if (!valid) {
+        memset(&loaded, 0, sizeof(loaded));
+    }
+
+    stored_current = valid && len == sizeof(loaded);
+    stored_crc = loaded.crc;
+
+    loaded.version = SETTINGS_VERSION;
+    loaded.size = sizeof(loaded);
+    memcpy(&settings, &loaded, sizeof(settings));   // Padding included, it is part of the CRC
+
+    return valid;
+}
+
+
+/**
+ * Set a string field, zero padded so no previous value is left behind
+ *
+ * @param field
+ * @param size
+ * @param value
+ * @return false if truncated
+ */
+bool settingsSetString(char *field, size_t size, const char *value) {
+    strncpy(field, value, size);
+    if (field[size - 1] != '\0') {
+        field[size - 1] = '\0';
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Save settings to NVS, unless nothing changed since last load or save
+ *
+ * The record is replaced as a whole: an interrupted write leaves the
+ * previous one. Called with the lock held, as the CRC covers all fields.
+ *
+ * @return false if unable to write
+ */
+bool settingsCommit() {
+    settings.version = SETTINGS_VERSION;
+    settings.size = sizeof(settings);
+    uint32_t crc = settingsCrc(&settings, sizeof(settings));
+
+    bool success = true;
+    if (stored_current && crc == stored_crc) {
+        metricsCount(mc_settings_writes_skipped);
+    } else {
+        settings.crc = crc;
+        success = halNvs()->write(SETTINGS_KEY, &settings, sizeof(settings));
+        if (success) {
+            stored_crc = crc;
+            stored_current = true;
+            metricsCount(mc_settings_writes);
+        }
+    }
+
+    return success;
+}
+
+
+/**
+ * Take the settings for changes, against other tasks
+ */
+void settingsLock() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+
+/**
+ * Give the settings back
+ */
+void settingsUnlock() {
+    xSemaphoreGive(mutex);
+}
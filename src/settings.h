@@ -0,0 +1,56 @@
+#ifndef M5SPOT_SETTINGS_H
+#define M5SPOT_SETTINGS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Settings kept across reboots: tokens, poll tuning, last WiFi access point
+ * and counters, stored as one CRC-checked record in NVS
+ *
+ * The record is loaded once at boot into `settings`, changed in place, then
+ * saved with settingsCommit(), which does not touch flash if nothing changed.
+ * Once other tasks run (network task, web server), fields are changed and
+ * committed between settingsLock() and settingsUnlock().
+ * Fields are only ever appended: a record of an older version is loaded as
+ * a prefix, the new fields keep their defaults.
+ */
+
+#define SETTINGS_VERSION 1
+#define SETTINGS_TOKEN_SIZE 512     // Spotify tokens are ~130 (refresh) & ~300 (access) chars
+
+typedef struct {
+    uint8_t ap;             // In AP_LIST
+    uint8_t channel;        // 0 if none
+    uint8_t bssid[6];
+} SETTINGS_wifi_t;
+
+typedef struct {
+    uint16_t version;
+    uint16_t size;                      // Of the record as stored, older versions are shorter
+    uint32_t crc;                       // CRC-32 of what follows
+    // Version 1
+    char refresh_token[SETTINGS_TOKEN_SIZE];
+    char access_token[SETTINGS_TOKEN_SIZE];
+    uint32_t access_token_expires_at;   // Wall clock time (s)
+    uint16_t polling_delay;             // Max delay between polls while playing (ms), 0 for SPTF_POLLING_DELAY
+    SETTINGS_wifi_t wifi;               // Last access point joined
+    uint32_t boot_count;
+    uint32_t token_refreshes;
+} SETTINGS_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+extern SETTINGS_t settings;
+
+bool settingsBegin();
+bool settingsSetString(char *field, size_t size, const char *value);
+bool settingsCommit();
+void settingsLock();
+void settingsUnlock();
+//@formatter:on
+
+#endif // M5SPOT_SETTINGS_H
@@ -0,0 +1,1375 @@
+#include <Arduino.h>
+#include "sptf.h"
+#include "conn_pool.h"
+#include "governor.h"
+#include "metrics.h"
+#include "heap_diag.h"
+#include "arena.h"
+#include "compositor.h"
+#include "boot_stats.h"
+#include "settings.h"
+#include "hal/hal.h"
+
+SPTF_config_t sptf_config = {"", "", 15000, "api.spotify.com", 443, "accounts.spotify.com", 443};
+
+String auth_code;
+String access_token;
+String refresh_token;
+
+uint32_t token_lifetime_ms = 0;
+uint32_t token_millis = 0;
+uint32_t next_curplay_millis = 0;
+uint32_t last_command_millis = 0;
+
+bool getting_token = false;
+bool sptf_is_playing = true;
+uint32_t sptf_follow_up_ms = SPTF_FOLLOW_UP_MS;
+uint32_t sptf_command_ms = SPTF_COMMAND_MS;
+
+uint16_t sptf_green = halColor565(30, 215, 96);
+
+// Only used by the network task
+SptfActions sptfAction = Iddle;
+ACTION_queue_t sptf_actions;
+static char playing_id[32] = "";        // Track of the last state handed over to the UI task
+static uint32_t track_end_millis = 0;   // Of playing_id, 0 if paused
+static SPTF_follow_up_t follow_up;
+static SPTF_prefetch_t prefetch;
+static uint32_t actions_hold_until = 0; // Commands wait for the governor (rest of a throttled skip)
+static uint32_t restored_expires_at = 0;    // Of a token restored before the wall clock was set, 0 once checked
+
+// UI task <-> network task
+CMD_queue_t ui_cmd_queue;
+CMD_queue_t web_cmd_queue;
+SPTF_state_buffer_t sptf_state;
+SemaphoreHandle_t lcd_mutex;   // LCD & SD share the same SPI bus
+
+
+/**
+ * Network task (core 0)
+ *
+ * @param param
+ */
+void sptfNetTask(void *param) {
+    while (true) {
+        if (!ota_in_progress) {
+            sptfNetLoop();
+        }
+        delay(10);
+    }
+}
+
+
+/**
+ * Network task loop: token refresh, commands and polling
+ */
+void sptfNetLoop() {
+
+    uint32_t cur_millis = millis();
+    arenaReset();
+    heapDiagLoop();
+
+    sptfTokenLoop(cur_millis);
+
+    // Commands from buttons/gestures and from web server, merged with
+    // those still pending (e.g. received while a request was running)
+    uint8_t cmd;
+    while (cmdQueuePop(&ui_cmd_queue, &cmd)) {
+        actionQueuePush(&sptf_actions, cmd);
+    }
+    while (cmdQueuePop(&web_cmd_queue, &cmd)) {
+        // Not held back by throttling, the device restarts right after
+        if (cmd == ResetToken) {
+            sptfResetToken();
+        } else {
+            actionQueuePush(&sptf_actions, cmd);
+        }
+    }
+
+    SPTF_action_t action;
+    if ((int32_t) (cur_millis - actions_hold_until) >= 0 && actionQueuePop(&sptf_actions, &action)) {
+        M5S_DBG("\n> [%d] Action %d (x%d), %d merged so far\n", micros(), action.action, action.count, sptf_actions.merged);
+        switch (action.action) {
+            case GetToken:
+                sptfGetToken(auth_code, gt_authorization_code);
+                break;
+            case Next:
+                sptfSkip(action.count);
+                break;
+            case Toggle:
+                sptfToggle();
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+
+    // Spotify polling handler, see sptfSchedulePoll()
+    if (sptfAction == CurrentlyPlaying && (int32_t) (cur_millis - next_curplay_millis) >= 0) {
+        sptfCurrentlyPlaying();
+        return;
+    }
+
+    sptfPrefetchLoop(cur_millis);
+}
+
+
+/**
+ * Prefetch the next track, so that it shows as soon as the current one ends
+ *
+ * The queue is read once per track, SPTF_PREFETCH_DELAY_MS after it started,
+ * between two polls and when the governor allows it right away; the album art
+ * of the next track is then downloaded and decoded off screen. At the end of
+ * the track, the poll reporting the next one draws it at once. Nothing is
+ * prefetched if album art could not be kept until then (no PSRAM nor SD card).
+ *
+ * @param cur_millis
+ */
+void sptfPrefetchLoop(uint32_t cur_millis) {
+    if (sptfAction != CurrentlyPlaying) {
+        return;
+    }
+
+    if (prefetch.due_millis && (int32_t) (cur_millis - prefetch.due_millis) >= 0
+        && (int32_t) (next_curplay_millis - cur_millis) >= SPTF_PREFETCH_POLL_SLACK_MS
+        && govWaitMs(gov_player_read) == 0 && sptfCanPrefetchAlbumArt()) {
+        sptfPrefetch();
+    }
+}
+
+
+/**
+ * Read the queue, and get the album art of the next track ready
+ */
+void sptfPrefetch() {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfPrefetch()\n", ts);
+
+    memset(&prefetch, 0, sizeof(prefetch));
+
+    JSON_stream_t js;
+    jsonStreamInit(&js, sptfParseQueue, &prefetch);
+
+    HTTP_response_t response = sptfApiRequest("GET", "/queue", "", [](const char *data, size_t len, void *ctx) {
+        jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+    }, &js);
+
+    if (response.httpCode != 200 || !jsonStreamDone(&js)) {
+        M5S_DBG("  [%d] Unable to get queue: %d\n", ts, response.httpCode);
+        if (track_end_millis && (int32_t) (track_end_millis - millis()) > SPTF_PREFETCH_RETRY_MS) {
+            prefetch.due_millis = millis() + SPTF_PREFETCH_RETRY_MS;
+        }
+        return;
+    }
+
+    // Queue moved on meanwhile, or repeating the track
+    if (strcmp(prefetch.after_id, playing_id) != 0 || !prefetch.next.id[0]
+        || strcmp(prefetch.next.id, playing_id) == 0) {
+        M5S_DBG("  [%d] Nothing to prefetch\n", ts);
+        return;
+    }
+
+    prefetch.art_ready = true;
+    if (prefetch.next.image_count) {
+        const SPTF_playing_t &next = prefetch.next;
+        const char *url = next.image_urls[sptfPickAlbumArt(&next, SPTF_ART_W, SPTF_ART_H)];
+        prefetch.art_ready = sptfPrefetchAlbumArt(url, next.album_id[0] ? next.album_id : url);
+        if (!prefetch.art_ready) {
+            M5S_DBG("  [%d] Album art not prefetched, downloaded on swap\n", ts);
+            metricsCount(mc_album_art_prefetch_failures);
+        }
+    }
+    prefetch.ready = true;
+    M5S_DBG("< [%d] Next: %s - %s\n", ts, prefetch.next.name, prefetch.next.artists);
+}
+
+
+/**
+ * Show the prefetched track, if it follows the one on screen
+ *
+ * Only once Spotify accepted a skip to it (204), while the playback state
+ * may still report the previous track. Album art is drawn at once if
+ * prefetched (art_ready), otherwise it is downloaded now, like for a track
+ * change reported by Spotify.
+ *
+ * @return false if there is none
+ */
+bool sptfPrefetchSwap() {
+    if (!prefetch.ready || strcmp(prefetch.after_id, playing_id) != 0) {
+        return false;
+    }
+    prefetch.ready = false;
+    metricsCount(mc_prefetch_swaps);
+
+    const SPTF_playing_t &next = prefetch.next;
+    M5S_DBG("\n> [%d] sptfPrefetchSwap(%s)\n", micros(), next.id);
+    strlcpy(playing_id, next.id, sizeof(playing_id));
+    track_end_millis = millis() + next.duration_ms;
+    prefetch.due_millis = millis() + min(SPTF_PREFETCH_DELAY_MS, next.duration_ms / 2);
+
+    xSemaphoreTake(lcd_mutex, portMAX_DELAY);
+    if (next.image_count) {
+        const char *url = next.image_urls[sptfPickAlbumArt(&next, SPTF_ART_W, SPTF_ART_H)];
+        M5S_DBG("  Album art %s\n", prefetch.art_ready ? "prefetched" : "not prefetched, downloading");
+        sptfDisplayAlbumArt(url, next.album_id[0] ? next.album_id : url);
+    } else {
+        sptfClearAlbumArt();
+    }
+    xSemaphoreGive(lcd_mutex);
+
+    SPTF_state_t state;
+    state.is_playing = true;
+    state.progress_ms = 0;
+    state.duration_ms = next.duration_ms;
+    state.progress_millis = millis();
+    strlcpy(state.id, next.id, sizeof(state.id));
+    strlcpy(state.name, next.name, sizeof(state.name));
+    strlcpy(state.artists, next.artists, sizeof(state.artists));
+    stateBufferWrite(&sptf_state, state);
+    return true;
+}
+
+
+/**
+ * Refresh Spotify access token when there is none, or shortly before expiry
+ *
+ * Within the last SPTF_TOKEN_REFRESH_MARGIN_S (or half of the lifetime), the
+ * refresh is done between two polls so that it does not delay any; only in
+ * the last SPTF_TOKEN_FORCE_MARGIN_S (or tenth of the lifetime) is it done
+ * regardless.
+ * Attempts are at least SPTF_TOKEN_RETRY_MS apart.
+ *
+ * @param cur_millis
+ */
+void sptfTokenLoop(uint32_t cur_millis) {
+    static uint32_t gettoken_millis = 0;
+
+    if (refresh_token == "" || (gettoken_millis && cur_millis - gettoken_millis < SPTF_TOKEN_RETRY_MS)) {
+        return;
+    }
+
+    // Expiry of a restored token is only known once SNTP has set the clock
+    if (restored_expires_at && token_millis) {
+        time_t now = time(nullptr);
+        if (now >= SPTF_MIN_EPOCH) {
+            token_lifetime_ms = restored_expires_at > now ? (restored_expires_at - now) * 1000 + (cur_millis - token_millis) : 0;
+            restored_expires_at = 0;
+            M5S_DBG("Restored access token valid for %u s\n", (token_lifetime_ms - (cur_millis - token_millis)) / 1000);
+        }
+    }
+
+    if (token_millis) {
+        // Margins are reduced for short lived tokens
+        uint32_t left_ms = token_lifetime_ms - min(cur_millis - token_millis, token_lifetime_ms);
+        if (left_ms > min(SPTF_TOKEN_REFRESH_MARGIN_S * 1000, token_lifetime_ms / 2)) {
+            return;
+        }
+        bool poll_soon = sptfAction == CurrentlyPlaying
+                         && (int32_t) (next_curplay_millis - cur_millis) < SPTF_TOKEN_POLL_SLACK_MS;
+        if (poll_soon && left_ms > min(SPTF_TOKEN_FORCE_MARGIN_S * 1000, token_lifetime_ms / 10)) {
+            return;
+        }
+    }
+
+    sptfGetToken(refresh_token);
+    gettoken_millis = millis();
+}
+
+
+/**
+ * Reuse an access token saved before a reboot, if still valid
+ *
+ * Startup does not wait for SNTP: if the wall clock is not set yet, the
+ * token is trusted until sptfTokenLoop() can check its expiry, and a 401
+ * on first use gets a new one anyway.
+ *
+ * @param token
+ * @param expires_at    Wall clock time (s)
+ * @return false if known to be expired
+ */
+bool sptfRestoreToken(const char *token, uint32_t expires_at) {
+    time_t now = time(nullptr);
+    bool clock_set = now >= SPTF_MIN_EPOCH;
+    if (!token[0] || !expires_at || (clock_set && expires_at <= now + SPTF_TOKEN_FORCE_MARGIN_S)) {
+        return false;
+    }
+
+    settingsLock();
+    access_token = token;
+    settingsUnlock();
+    token_millis = millis();
+    // Until checked, twice the refresh margin: no early refresh, a 401 still gets a new one
+    token_lifetime_ms = clock_set ? (expires_at - now) * 1000 : SPTF_TOKEN_REFRESH_MARGIN_S * 2000;
+    restored_expires_at = clock_set ? 0 : expires_at;
+    return true;
+}
+
+
+/**
+ * Forget tokens, until authorized again
+ */
+void sptfResetToken() {
+    M5S_DBG("\n> [%d] sptfResetToken()\n", micros());
+
+    settingsLock();
+    access_token = "";
+    refresh_token = "";
+    settingsUnlock();
+    token_millis = 0;
+    restored_expires_at = 0;
+    deleteRefreshToken();
+}
+
+
+/**
+ * Log a response header line, keep Retry-After & Content-Encoding
+ *
+ * @param header
+ * @param ctx
+ */
+void httpOnHeader(const HTTP_header_t &header, void *ctx) {
+    HTTP_request_ctx_t *req = (HTTP_request_ctx_t *) ctx;
+
+    if (header.name_len == 11 && strncasecmp(header.line, "Retry-After", 11) == 0) {
+        req->response->retry_after = strtoul(header.value, nullptr, 10);
+    } else if (header.name_len == 16 && strncasecmp(header.line, "Content-Encoding", 16) == 0) {
+        req->gzip = header.value_len == 4 && strncasecmp(header.value, "gzip", 4) == 0;
+        if (req->gzip) {
+            gzipStreamInit(&req->gz, httpOnBodyData, req);
+        }
+    }
+
+    M5S_DBG("%.*s\n", header.len, header.line);
+    if (send_events) {
+        char buff[256];
+        snprintf(buff, sizeof(buff), "%.*s", header.len, header.line);
+        eventsSendLog(buff);
+    }
+}
+
+
+/**
+ * Handle a response body span, as received
+ *
+ * @param data
+ * @param len
+ * @param ctx
+ */
+void httpOnBody(const char *data, size_t len, void *ctx) {
+    HTTP_request_ctx_t *req = (HTTP_request_ctx_t *) ctx;
+
+    if (req->gzip) {
+        uint32_t start = micros();
+        uint32_t body_cb_us = req->body_cb_us;
+        gzipStreamFeed(&req->gz, data, len);
+        // Inflating counts as parsing, like the body callback it calls
+        req->body_cb_us = body_cb_us + micros() - start;
+    } else {
+        httpOnBodyData(data, len, req);
+    }
+}
+
+
+/**
+ * Handle a response body span, decoded
+ *
+ * Successful responses go to the caller body callback when there is one,
+ * anything else is kept in the response payload, up to HTTP_PAYLOAD_MAX_SIZE
+ * and as far as the arena allows: a big error body must not leave the event
+ * messages that follow without room.
+ *
+ * @param data
+ * @param len
+ * @param ctx
+ */
+void httpOnBodyData(const char *data, size_t len, void *ctx) {
+    HTTP_request_ctx_t *req = (HTTP_request_ctx_t *) ctx;
+    int httpCode = req->reader->httpCode;
+
+    if (send_events) {
+        char buff[257];
+        for (size_t i = 0; i < len; i += sizeof(buff) - 1) {
+            snprintf(buff, sizeof(buff), "%.*s", (int) min(len - i, sizeof(buff) - 1), &data[i]);
+            eventsSendLog(buff, log_raw);
+        }
+    }
+
+    if (req->body_cb && httpCode >= 200 && httpCode < 300) {
+        uint32_t start = micros();
+        req->body_cb(data, len, req->body_ctx);
+        req->body_cb_us += micros() - start;
+        return;
+    }
+
+    if (!req->payload) {
+        size_t size = req->reader->content_length > 0 ? req->reader->content_length + 1 : len + 1;
+        size = min(min(size, (size_t) HTTP_PAYLOAD_MAX_SIZE), arenaAvailable());
+        req->payload = size ? (char *) arenaAlloc(size) : nullptr;
+        if (!req->payload) {
+            return;
+        }
+        req->payload_size = size;
+        req->payload_len = 0;
+    }
+
+    size_t needed = req->payload_len + len + 1;
+    if (needed > req->payload_size) {
+        size_t size = min(min(needed, (size_t) HTTP_PAYLOAD_MAX_SIZE), req->payload_size + arenaAvailable());
+        if (size > req->payload_size && arenaGrow(req->payload, size)) {
+            req->payload_size = size;
+        }
+    }
+
+    size_t copy = min(len, req->payload_size - req->payload_len - 1);
+    memcpy(&req->payload[req->payload_len], data, copy);
+    req->payload_len += copy;
+    req->payload[req->payload_len] = '\0';
+}
+
+
+/**
+ * HTTP requests, pipelined on one connection
+ *
+ * Sockets are taken from the keep-alive pool; a reused socket that turns out
+ * to be closed by the server before any response is dropped and GET requests
+ * are sent again once on a fresh connection. Commands are never sent twice
+ * here: they fail with 503 (closed) flagged as undelivered, for the caller to
+ * queue them again, or 504 (no response).
+ *
+ * All requests are sent in a row, then responses are read in the same order
+ * by the ring buffer reader (chunked or not), bytes of a response read along
+ * with the previous one are kept for it. When a body callback is given, a
+ * successful (2xx) response body is handed to it span by span instead of
+ * being stored in the response payload.
+ *
+ * @param host
+ * @param port
+ * @param requests
+ * @param responses
+ * @param count
+ */
+void httpRequests(const char *host, uint16_t port, const HTTP_request_t *requests, HTTP_response_t *responses,
+                  uint8_t count) {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] httpRequests(%s, %d, %d)\n", ts, host, port, count);
+
+    HTTP_conn_t *conn = nullptr;
+    MetricsEndpoints endpoint = metricsEndpoint(requests[0].headers);
+    uint32_t sent_us = 0;
+
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        uint32_t connect_us = micros();
+        conn = connPoolAcquire(host, port);
+        if (!conn) {
+            for (uint8_t i = 0; i < count; i++) {
+                responses[i] = {503, "Service unavailable (unable to connect)"};
+                metricsCountHttpCode(503);
+            }
+            return;
+        }
+        if (!conn->reused) {
+            metricsObserve(endpoint, mp_connect, micros() - connect_us);
+        }
+        M5S_DBG("  [%d] %s connection\n", ts, conn->reused ? "Reused" : "New");
+
+        /*
+         * Send HTTP requests
+         */
+
+        sent_us = micros();
+        bool sent = true;
+        for (uint8_t i = 0; sent && i < count; i++) {
+            if (attempt == 0) {
+                M5S_DBG("  [%d] Request:\n%s%s\n", ts, requests[i].headers, requests[i].content);
+                eventsSendLog(">>>> REQUEST");
+                eventsSendLog(requests[i].headers);
+                eventsSendLog(requests[i].content);
+            }
+
+            sent = conn->client.print(requests[i].headers) > 0;
+            if (sent && strlen(requests[i].content)) {
+                sent = conn->client.print(requests[i].content) > 0;
+            }
+        }
+
+        /*
+         * Wait for HTTP response
+         */
+
+        bool closed = !sent;
+        bool timed_out = false;
+        uint32_t timeout = millis();
+        while (!closed && !conn->client.available()) {
+            if (!conn->client.connected()) {
+                closed = true;
+            } else if (millis() - timeout > 5000) {
+                timed_out = true;
+                break;
+            }
+            vTaskDelay(1);
+        }
+
+        if (!closed && !timed_out) {
+            break;
+        }
+
+        // Server closed the kept-alive socket in the meantime: retry on a new one,
+        // unless a command could run twice (requests may have been processed)
+        if (closed && conn->reused && attempt == 0 && httpIdempotent(requests, count)) {
+            M5S_DBG("  [%d] Stale connection, reconnecting\n", ts);
+            connPoolMarkStale(conn);
+            continue;
+        }
+
+        // Closed before any response byte on a socket the server had already
+        // given up on: nothing was processed, the caller may send it again
+        bool undelivered = closed && conn->reused && attempt == 0;
+        if (undelivered) {
+            M5S_DBG("  [%d] Stale connection, command not delivered\n", ts);
+            connPoolMarkStale(conn);
+        } else {
+            connPoolRelease(conn, false);
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            responses[i] = timed_out ? HTTP_response_t {504, "Gateway timeout (no response)"}
+                                     : HTTP_response_t {503, "Service unavailable (connection closed)", 0,
+                                                        undelivered};
+            metricsCountHttpCode(responses[i].httpCode);
+        }
+        return;
+    }
+
+    metricsObserve(endpoint, mp_ttfb, micros() - sent_us);
+
+    static HTTP_reader_t reader;
+    bool keep_alive = true;
+
+    for (uint8_t i = 0; i < count; i++) {
+        HTTP_response_t &response = responses[i];
+        response = {0, ""};
+
+        if (!keep_alive) {
+            // The previous response could not be delimited, or closed the connection
+            response = {502, "Bad gateway (no response)"};
+            metricsCountHttpCode(response.httpCode);
+            continue;
+        }
+
+        M5S_DBG("  [%d] Response:\n", ts);
+        eventsSendLog("<<<< RESPONSE");
+
+        uint32_t body_us = micros();
+        endpoint = metricsEndpoint(requests[i].headers);
+        HTTP_request_ctx_t ctx = {&reader, &response, requests[i].body_cb, requests[i].body_ctx, 0, nullptr, 0, 0,
+                                  false};
+
+        if (i == 0) {
+            httpReaderInit(&reader, httpOnHeader, httpOnBody, &ctx);
+        } else {
+            httpReaderNext(&reader, &ctx);
+        }
+        HttpReaderResults result = httpReaderRun(&reader, conn->client, 5000);
+
+        metricsObserve(endpoint, mp_body, micros() - body_us - ctx.body_cb_us);
+        if (ctx.body_cb_us) {
+            metricsObserve(endpoint, mp_parse, ctx.body_cb_us);
+        }
+
+        metricsAdd(mc_http_body_bytes, reader.body_size);
+        metricsAdd(mc_http_body_decoded_bytes, ctx.gzip ? ctx.gz.out_size : reader.body_size);
+
+        // Content-Encoding may come with no body at all (204, errors)
+        if (result == hr_complete && ctx.gzip && reader.body_size && !gzipStreamDone(&ctx.gz)) {
+            response = {502, "Bad gateway (corrupted gzip body)"};
+        } else if (result == hr_complete) {
+            response.httpCode = reader.httpCode;
+            if (ctx.payload) {
+                response.payload = ctx.payload;
+            }
+        } else if (result == hr_timeout) {
+            response = {504, "Response timeout"};
+        } else {
+            response = {502, "Bad gateway (incomplete response)"};
+        }
+
+        keep_alive = reader.keep_alive && result == hr_complete;
+        if (response.httpCode < 200 || response.httpCode >= 300) {
+            metricsCountHttpCode(response.httpCode);
+        }
+    }
+
+    connPoolRelease(conn, keep_alive);
+
+    M5S_DBG("\n< [%d] HEAP: %d, CONN: %d/%d reused\n", ts, ESP.getFreeHeap(), connPoolStats().reused,
+            connPoolStats().acquired);
+}
+
+
+/**
+ * Check whether requests can safely be sent again (GET only)
+ *
+ * @param requests
+ * @param count
+ * @return
+ */
+bool httpIdempotent(const HTTP_request_t *requests, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (!startsWith(requests[i].headers, "GET ")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * HTTP request
+ *
+ * @see httpRequests()
+ *
+ * @param host
+ * @param port
+ * @param headers
+ * @param content
+ * @param body_cb
+ * @param body_ctx
+ * @return
+ */
+HTTP_response_t httpRequest(const char *host, uint16_t port, const char *headers, const char *content,
+                            HTTP_body_cb_t body_cb, void *body_ctx) {
+    HTTP_request_t request = {headers, content, body_cb, body_ctx};
+    HTTP_response_t response;
+    httpRequests(host, port, &request, &response, 1);
+    return response;
+}
+
+
+/**
+ * Call Spotify API
+ *
+ * Requests go through the governor: they are refused locally while Spotify
+ * asks to slow down (429, Retry-After) or fails (5xx), or if too many
+ * requests were sent recently.
+ *
+ * @param method
+ * @param endpoint
+ * @param content
+ * @param body_cb
+ * @param body_ctx
+ * @return
+ */
+HTTP_response_t sptfApiRequest(const char *method, const char *endpoint, const char *content,
+                               HTTP_body_cb_t body_cb, void *body_ctx) {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfApiRequest(%s, %s, %s)\n", ts, method, endpoint, content);
+
+    GovClasses cls = strcmp(method, "GET") == 0 ? gov_player_read : gov_player_write;
+    if (!govAcquire(cls)) {
+        M5S_DBG("  [%d] Throttled, retry in %d ms\n", ts, govWaitMs(cls));
+        return {429, "Too many requests (throttled by M5Spot)"};
+    }
+
+    char headers[512];
+    sptfApiHeaders(headers, sizeof(headers), method, endpoint, strlen(content));
+
+    HTTP_response_t response = httpRequest(sptf_config.api_host, sptf_config.api_port, headers, content,
+                                           body_cb, body_ctx);
+    // Lost on a stale socket: Spotify never saw it, no reason to back off
+    if (!response.undelivered) {
+        govReport(cls, response.httpCode, response.retry_after);
+    }
+
+    // Token revoked, or restored after a reboot but no longer valid
+    if (response.httpCode == 401) {
+        token_millis = 0;
+    }
+
+    return response;
+}
+
+
+/**
+ * Build Spotify API request headers
+ *
+ * @param headers
+ * @param size
+ * @param method
+ * @param endpoint
+ * @param content_length
+ */
+void sptfApiHeaders(char *headers, size_t size, const char *method, const char *endpoint, size_t content_length) {
+    // gzip only asked for if it can be inflated
+    snprintf(headers, size,
+             "%s /v1/me/player%s HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "Authorization: Bearer %s\r\n"
+             "Content-Length: %u\r\n"
+             "%s"
+             "Connection: keep-alive\r\n\r\n",
+             method, endpoint, sptf_config.api_host, access_token.c_str(), (unsigned) content_length,
+             halInflater() ? "Accept-Encoding: gzip\r\n" : ""
+    );
+}
+
+
+/**
+ * Send a player command, and fetch the playback state in the same round trip
+ *
+ * The currently-playing request is pipelined right behind the command, on the
+ * same connection, as long as Spotify is known to reflect commands within the
+ * time it takes to handle one (sptf_follow_up_ms <= sptf_command_ms);
+ * otherwise the state is polled sptf_follow_up_ms later.
+ *
+ * @param method
+ * @param endpoint
+ * @return Command response
+ */
+HTTP_response_t sptfApiCommand(const char *method, const char *endpoint) {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfApiCommand(%s, %s)\n", ts, method, endpoint);
+
+    if (!govAcquire(gov_player_write)) {
+        M5S_DBG("  [%d] Throttled, retry in %d ms\n", ts, govWaitMs(gov_player_write));
+        return {429, "Too many requests (throttled by M5Spot)"};
+    }
+    bool pipeline = sptf_follow_up_ms <= sptf_command_ms && govAcquire(gov_player_read);
+
+    char headers[2][512];
+    sptfApiHeaders(headers[0], sizeof(headers[0]), method, endpoint, 0);
+    sptfApiHeaders(headers[1], sizeof(headers[1]), "GET", SPTF_PLAYING_ENDPOINT, 0);
+
+    SPTF_playing_t playing;
+    memset(&playing, 0, sizeof(playing));
+
+    JSON_stream_t js;
+    jsonStreamInit(&js, sptfParsePlaying, &playing);
+
+    HTTP_request_t requests[2] = {
+            {headers[0], "", nullptr, nullptr},
+            {headers[1], "", [](const char *data, size_t len, void *ctx) {
+                jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+            }, &js}
+    };
+    HTTP_response_t responses[2];
+    uint32_t request_millis = millis();
+    httpRequests(sptf_config.api_host, sptf_config.api_port, requests, responses, pipeline ? 2 : 1);
+
+    if (!responses[0].undelivered) {
+        govReport(gov_player_write, responses[0].httpCode, responses[0].retry_after);
+    }
+    if (responses[0].httpCode == 401) {
+        token_millis = 0;
+    }
+    if (responses[0].httpCode == 204) {
+        sptfFollowUpStart(request_millis);
+        // Alone only, the state response would add to it
+        if (!pipeline) {
+            sptf_command_ms = (sptf_command_ms * 3 + millis() - request_millis) / 4;
+        }
+    }
+
+    if (pipeline && !responses[1].undelivered) {
+        govReport(gov_player_read, responses[1].httpCode, responses[1].retry_after);
+        if (responses[0].httpCode == 204) {
+            sptfHandlePlaying(responses[1], &playing, &js, request_millis);
+        }
+    }
+
+    return responses[0];
+}
+
+
+/**
+ * Keep the fields of interest of a token response
+ *
+ * @param js
+ * @param path
+ * @param value
+ * @param type
+ */
+void sptfParseToken(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type) {
+    SPTF_token_t *token = (SPTF_token_t *) js->ctx;
+
+    if (strcmp(path, "access_token") == 0) {
+        token->access_token = arenaStrdup(value);
+    } else if (strcmp(path, "refresh_token") == 0) {
+        token->refresh_token = arenaStrdup(value);
+    } else if (strcmp(path, "expires_in") == 0) {
+        token->expires_in = strtoul(value, nullptr, 10);
+    }
+}
+
+
+/**
+ * Get Spotify token
+ *
+ * @param code          Either an authorization code or a refresh token
+ * @param grant_type    [gt_authorization_code|gt_refresh_token]
+ */
+void sptfGetToken(const String &code, GrantTypes grant_type) {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfGetToken(%s, %s)\n", ts, code.c_str(), grant_type == gt_authorization_code ? "authorization" : "refresh");
+
+    bool success = false;
+
+    char requestContent[512];
+    if (grant_type == gt_authorization_code) {
+        snprintf(requestContent, sizeof(requestContent),
+                 "grant_type=authorization_code"
+                 "&redirect_uri=http%%3A%%2F%%2Fm5spot.local%%2Fcallback%%2F"
+                 "&code=%s",
+                 code.c_str()
+        );
+    } else {
+        snprintf(requestContent, sizeof(requestContent),
+                 "grant_type=refresh_token&refresh_token=%s",
+                 code.c_str()
+        );
+    }
+
+    size_t basicAuthSize = strlen(sptf_config.client_id) + strlen(sptf_config.client_secret) + 2;
+    char basicAuth[basicAuthSize];
+    snprintf(basicAuth, basicAuthSize, "%s:%s", sptf_config.client_id, sptf_config.client_secret);
+
+    char requestHeaders[768];
+    snprintf(requestHeaders, sizeof(requestHeaders),
+             "POST /api/token HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "Authorization: Basic %s\r\n"
+             "Content-Length: %u\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             sptf_config.accounts_host, b64Encode(basicAuth).c_str(), (unsigned) strlen(requestContent)
+    );
+
+    if (!govAcquire(gov_token)) {
+        M5S_DBG("  [%d] Throttled, retry in %d ms\n", ts, govWaitMs(gov_token));
+        getting_token = false;
+        return;
+    }
+
+    SPTF_token_t token = {nullptr, nullptr, 0};
+    JSON_stream_t js;
+    jsonStreamInit(&js, sptfParseToken, &token);
+
+    HTTP_response_t response = httpRequest(sptf_config.accounts_host, sptf_config.accounts_port, requestHeaders, requestContent,
+                                           [](const char *data, size_t len, void *ctx) {
+                                               jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+                                           }, &js);
+    govReport(gov_token, response.httpCode, response.retry_after);
+
+    if (response.httpCode == 200) {
+
+        if (jsonStreamDone(&js)) {
+            if (token.access_token && token.access_token[0]) {
+                settingsLock();
+                access_token = token.access_token;
+                settingsUnlock();
+                heapTrack(hs_token, access_token.length() + 1);
+                token_lifetime_ms = token.expires_in * 1000;
+                token_millis = millis();
+                restored_expires_at = 0;
+                success = true;
+                time_t now = time(nullptr);
+                if (now >= SPTF_MIN_EPOCH) {
+                    writeAccessToken(now + token.expires_in);
+                }
+                if (token.refresh_token && token.refresh_token[0]) {
+                    settingsLock();
+                    refresh_token = token.refresh_token;
+                    settingsUnlock();
+                    heapTrack(hs_token, refresh_token.length() + 1);
+                    writeRefreshToken();
+                }
+            }
+        } else {
+            M5S_DBG("  [%d] Unable to parse response payload (path: %s)\n", ts, js.path);
+            eventsSendError(500, "Unable to parse response payload", js.path);
+        }
+    } else {
+        M5S_DBG("  [%d] %d - %s\n", ts, response.httpCode, response.payload);
+        eventsSendError(response.httpCode, "Spotify error", response.payload);
+    }
+
+    metricsCount(success ? mc_token_refreshes : mc_token_failures);
+
+    if (success && sptfAction != CurrentlyPlaying) {
+        sptfAction = CurrentlyPlaying;
+        next_curplay_millis = millis();
+    }
+
+    getting_token = false;
+}
+
+
+/**
+ * Keep the fields of interest of a currently-playing object
+ *
+ * @param js
+ * @param path
+ * @param value
+ * @param type
+ */
+void sptfParsePlaying(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type) {
+    SPTF_playing_t *playing = (SPTF_playing_t *) js->ctx;
+
+    if (strcmp(path, "is_playing") == 0) {
+        playing->is_playing = strcmp(value, "true") == 0;
+    } else if (strcmp(path, "progress_ms") == 0) {
+        playing->progress_ms = strtoul(value, nullptr, 10);
+    } else if (startsWith(path, "item.")) {
+        sptfParseTrack(js, playing, path + 5, value, 0);
+    }
+}
+
+
+/**
+ * Parse a track object field
+ *
+ * @param js
+ * @param track
+ * @param field     Path from the track object, e.g. "album.id"
+ * @param value
+ * @param array_nr  Of the album images array, for jsonStreamIndex()
+ */
+void sptfParseTrack(JSON_stream_t *js, SPTF_playing_t *track, const char *field, const char *value, uint8_t array_nr) {
+    if (strcmp(field, "duration_ms") == 0) {
+        track->duration_ms = strtoul(value, nullptr, 10);
+    } else if (strcmp(field, "id") == 0) {
+        strlcpy(track->id, value, sizeof(track->id));
+    } else if (strcmp(field, "album.id") == 0) {
+        strlcpy(track->album_id, value, sizeof(track->album_id));
+    } else if (strcmp(field, "name") == 0) {
+        strlcpy(track->name, value, sizeof(track->name));
+    } else if (strcmp(field, "artists[].name") == 0) {
+        if (track->artists[0] != '\0') {
+            strlcat(track->artists, ", ", sizeof(track->artists));
+        }
+        strlcat(track->artists, value, sizeof(track->artists));
+    } else if (strcmp(field, "album.images[].url") == 0) {
+        uint16_t idx = jsonStreamIndex(js, array_nr);
+        if (idx < SPTF_MAX_IMAGES) {
+            strlcpy(track->image_urls[idx], value, sizeof(track->image_urls[idx]));
+            if (idx >= track->image_count) {
+                track->image_count = idx + 1;
+            }
+        }
+    } else if (strcmp(field, "album.images[].width") == 0) {
+        uint16_t idx = jsonStreamIndex(js, array_nr);
+        if (idx < SPTF_MAX_IMAGES) {
+            track->image_widths[idx] = strtoul(value, nullptr, 10);
+        }
+    } else if (strcmp(field, "album.images[].height") == 0) {
+        uint16_t idx = jsonStreamIndex(js, array_nr);
+        if (idx < SPTF_MAX_IMAGES) {
+            track->image_heights[idx] = strtoul(value, nullptr, 10);
+        }
+    }
+}
+
+
+/**
+ * Parse queue response: only the first track of the queue is kept
+ *
+ * @param js
+ * @param path
+ * @param value
+ * @param type
+ */
+void sptfParseQueue(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type) {
+    SPTF_prefetch_t *p = (SPTF_prefetch_t *) js->ctx;
+
+    if (strcmp(path, "currently_playing.id") == 0) {
+        strlcpy(p->after_id, value, sizeof(p->after_id));
+    } else if (startsWith(path, "queue[].") && jsonStreamIndex(js) == 0) {
+        sptfParseTrack(js, &p->next, path + 8, value, 1);
+    }
+}
+
+
+/**
+ * Pick the album art image to download: the smallest one covering the box,
+ * or the biggest one if none does (the decoder scales down by powers of 2,
+ * see jpgStreamDraw())
+ *
+ * @param playing
+ * @param width     Box size
+ * @param height
+ * @return Image index; the second image (usually 300x300) if sizes are unknown
+ */
+uint8_t sptfPickAlbumArt(const SPTF_playing_t *playing, uint16_t width, uint16_t height) {
+    int8_t covering = -1;
+    int8_t biggest = -1;
+
+    for (uint8_t i = 0; i < playing->image_count; i++) {
+        uint32_t area = (uint32_t) playing->image_widths[i] * playing->image_heights[i];
+        if (!area) {
+            return min(1, playing->image_count - 1);
+        }
+        if (playing->image_widths[i] >= width && playing->image_heights[i] >= height
+            && (covering < 0 || area < (uint32_t) playing->image_widths[covering] * playing->image_heights[covering])) {
+            covering = i;
+        }
+        if (biggest < 0 || area > (uint32_t) playing->image_widths[biggest] * playing->image_heights[biggest]) {
+            biggest = i;
+        }
+    }
+
+    return covering >= 0 ? covering : biggest;
+}
+
+
+/**
+ * Schedule next currently-playing poll
+ *
+ * - Right after a user command: after sptf_follow_up_ms until the change
+ *   shows, then fast polls
+ * - Playing (ads and items without an id too): at end of track, or after
+ *   sptf_config.polling_delay if sooner (the UI playback clock animates
+ *   progress in between)
+ * - Paused, or nothing playing: slow polls
+ * - Rate limited or failing: as told by the governor
+ *
+ * @param httpCode
+ * @param playing   nullptr if no valid payload
+ */
+void sptfSchedulePoll(int httpCode, const SPTF_playing_t *playing) {
+    uint32_t delay_ms = sptf_config.polling_delay;
+
+    if (httpCode == 204 || (playing && !playing->is_playing && playing->id[0] == '\0')) {
+        delay_ms = SPTF_POLL_IDLE_MS;
+    } else if (playing && !playing->is_playing) {
+        delay_ms = SPTF_POLL_PAUSED_MS;
+    } else if (playing && playing->duration_ms > playing->progress_ms) {
+        uint32_t remaining_ms = playing->duration_ms - playing->progress_ms;
+        if (remaining_ms + SPTF_POLL_TRACK_END_MS < delay_ms) {
+            delay_ms = remaining_ms + SPTF_POLL_TRACK_END_MS;
+        }
+    }
+
+    if (follow_up.pending) {
+        delay_ms = sptf_follow_up_ms > SPTF_FOLLOW_UP_MIN_MS ? sptf_follow_up_ms : SPTF_FOLLOW_UP_MIN_MS;
+    } else if (millis() - last_command_millis < SPTF_POLL_COMMAND_WINDOW_MS && delay_ms > SPTF_POLL_COMMAND_MS) {
+        delay_ms = SPTF_POLL_COMMAND_MS;
+    }
+
+    // Never earlier than the governor allows
+    uint32_t wait_ms = govWaitMs(gov_player_read);
+    if (wait_ms > delay_ms) {
+        delay_ms = wait_ms;
+    }
+
+    next_curplay_millis = millis() + delay_ms;
+    M5S_DBG("  Next poll in %d ms\n", delay_ms);
+}
+
+
+/**
+ * Get information about the Spotify user's current playback
+ *
+ * The response is parsed on the fly as it is read from the socket,
+ * only the fields listed in sptfParsePlaying() are kept.
+ */
+void sptfCurrentlyPlaying() {
+    uint32_t ts = micros();
+    M5S_DBG("\n> [%d] sptfCurrentlyPlaying()\n", ts);
+
+    SPTF_playing_t playing;
+    memset(&playing, 0, sizeof(playing));
+
+    JSON_stream_t js;
+    jsonStreamInit(&js, sptfParsePlaying, &playing);
+
+    uint32_t request_millis = millis();
+    HTTP_response_t response = sptfApiRequest("GET", SPTF_PLAYING_ENDPOINT, "", [](const char *data, size_t len, void *ctx) {
+        jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+    }, &js);
+
+    sptfHandlePlaying(response, &playing, &js, request_millis);
+
+    M5S_DBG("< [%d] HEAP: %d\n", ts, ESP.getFreeHeap());
+}
+
+
+/**
+ * Handle a currently-playing response: schedule next poll, hand the playback
+ * state over to the UI task (unless it does not show the last command yet)
+ *
+ * @param response
+ * @param playing   Parsed from the response
+ * @param js        Parser state
+ * @param request_millis
+ */
+void sptfHandlePlaying(const HTTP_response_t &response, SPTF_playing_t *playing, JSON_stream_t *js,
+                       uint32_t request_millis) {
+    // Reference point of the UI playback clock
+    uint32_t progress_millis = millis();
+    bool parsed = response.httpCode == 200 && jsonStreamDone(js);
+
+    bool current = sptfFollowUpCheck(parsed ? playing : nullptr, request_millis);
+    sptfSchedulePoll(response.httpCode, parsed ? playing : nullptr);
+
+    if (response.httpCode == 200) {
+
+        if (parsed && !current) {
+            M5S_DBG("  Last command not reflected yet, state ignored\n");
+        } else if (parsed) {
+            sptf_is_playing = playing->is_playing;
+            uint32_t remaining_ms = playing->duration_ms - min(playing->progress_ms, playing->duration_ms);
+            track_end_millis = playing->is_playing ? progress_millis + remaining_ms : 0;
+
+            // If song has changed, refresh album art
+            if (strcmp(playing->id, playing_id) != 0) {
+                strlcpy(playing_id, playing->id, sizeof(playing_id));
+                prefetch.ready = false;
+                prefetch.due_millis = millis() + min(SPTF_PREFETCH_DELAY_MS, remaining_ms / 2);
+
+                xSemaphoreTake(lcd_mutex, portMAX_DELAY);
+                if (playing->image_count) {
+                    const char *url = playing->image_urls[sptfPickAlbumArt(playing, SPTF_ART_W, SPTF_ART_H)];
+                    sptfDisplayAlbumArt(url, playing->album_id[0] ? playing->album_id : url);
+                } else {
+                    // Not to leave the previous one (or the boot screen) behind
+                    sptfClearAlbumArt();
+                }
+                xSemaphoreGive(lcd_mutex);
+            }
+
+            // Hand over to UI task
+            SPTF_state_t state;
+            state.is_playing = playing->is_playing;
+            state.progress_ms = playing->progress_ms;
+            state.duration_ms = playing->duration_ms;
+            state.progress_millis = progress_millis;
+            strlcpy(state.id, playing->id, sizeof(state.id));
+            strlcpy(state.name, playing->name, sizeof(state.name));
+            strlcpy(state.artists, playing->artists, sizeof(state.artists));
+            stateBufferWrite(&sptf_state, state);
+
+        } else {
+            M5S_DBG("  Unable to parse response payload (path: %s)\n", js->path);
+            eventsSendError(500, "Unable to parse response payload", js->path);
+        }
+    } else if (response.httpCode == 204) {
+        // No content
+    } else {
+        M5S_DBG("  %d - %s\n", response.httpCode, response.payload);
+        eventsSendError(response.httpCode, "Spotify error", response.payload);
+    }
+}
+
+
+/**
+ * Remember what the command just sent should change in the playback state
+ * (track for next/previous, is_playing for play/pause)
+ *
+ * @param command_millis    When the command was sent
+ */
+void sptfFollowUpStart(uint32_t command_millis) {
+    follow_up.pending = true;
+    follow_up.action = sptfAction;
+    follow_up.is_playing = !sptf_is_playing;
+    strlcpy(follow_up.id, playing_id, sizeof(follow_up.id));
+    follow_up.command_millis = command_millis;
+    follow_up.checks = 0;
+}
+
+
+/**
+ * Check whether the playback state shows the last command, and learn how long
+ * Spotify takes to reflect commands (sptf_follow_up_ms)
+ *
+ * @param playing           nullptr if no valid state
+ * @param request_millis    When the state was requested
+ * @return false if the state predates the last command
+ */
+bool sptfFollowUpCheck(const SPTF_playing_t *playing, uint32_t request_millis) {
+    if (!follow_up.pending) {
+        return true;
+    }
+
+    // Pipelined right behind the command: 0
+    uint32_t elapsed = request_millis - follow_up.command_millis;
+    bool reflected = playing && (follow_up.action == Toggle ? playing->is_playing == follow_up.is_playing
+                                                            : strcmp(playing->id, follow_up.id) != 0);
+    if (reflected) {
+        // Shown at first check: only known to take less than elapsed
+        uint32_t sample = follow_up.checks ? elapsed : elapsed / 2;
+        sptf_follow_up_ms = min((sptf_follow_up_ms * 3 + sample) / 4, (uint32_t) SPTF_FOLLOW_UP_MAX_MS);
+        follow_up.pending = false;
+        M5S_DBG("  Command reflected after %d ms, follow-up delay now %d ms\n", elapsed, sptf_follow_up_ms);
+        return true;
+    }
+
+    follow_up.checks++;
+    if (!playing || elapsed > SPTF_POLL_COMMAND_WINDOW_MS) {
+        // Not going to show (e.g. skipped past the end of the queue, or changed from elsewhere)
+        follow_up.pending = false;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Display song name, artists & progress from the latest playback state (UI task)
+ *
+ * The LCD is left alone while the network task is drawing album art.
+ */
+void sptfDisplayPlaying() {
+    static SPTF_state_t state;
+    static bool has_state = false;
+    static uint32_t displayed_version = 0;
+    static uint16_t displayed_width = 0;
+    static char displayed_id[32] = {0};
+
+    has_state = stateBufferRead(&sptf_state, &state) || has_state;
+    if (!has_state) {
+        return;
+    }
+
+    // Playback clock: extrapolate progress since last poll
+    uint32_t progress_ms = state.progress_ms;
+    if (state.is_playing) {
+        progress_ms += millis() - state.progress_millis;
+    }
+    if (progress_ms > state.duration_ms) {
+        progress_ms = state.duration_ms;
+    }
+    uint16_t width = state.duration_ms ? ceil((float) 320 * ((float) progress_ms / state.duration_ms)) : 0;
+
+    static COMP_layer_t title_layer, progress_layer;
+    static COMP_marquee_t name_marquee, artists_marquee;
+    uint32_t cur_millis = millis();
+    bool scrolled = compMarqueeMoved(&name_marquee, cur_millis) || compMarqueeMoved(&artists_marquee, cur_millis);
+
+    if (state.version == displayed_version && width == displayed_width && !scrolled) {
+        return;
+    }
+
+    if (xSemaphoreTake(lcd_mutex, 0) != pdTRUE) {
+        return;
+    }
+
+    if (!title_layer.area.w) {
+        compLayerBegin(&title_layer, 0, 0, 320, 30, HAL_WHITE);
+        compLayerBegin(&progress_layer, 0, 235, 320, 5, HAL_WHITE);
+    }
+
+    uint32_t render_us = micros();
+
+    if (strcmp(state.id, displayed_id) != 0) {
+        strlcpy(displayed_id, state.id, sizeof(displayed_id));
+
+        // Display song & artists names, scrolling if too long
+        compMarqueeText(&title_layer, &name_marquee, state.name, 160, 2, 2, hal_datum_tc, HAL_BLACK);
+        compMarqueeText(&title_layer, &artists_marquee, state.artists, 160, 28, 1, hal_datum_bc, HAL_BLACK);
+
+        // Album art may have cleared the screen
+        compLayerInvalidate(&progress_layer);
+    } else {
+        compMarqueeStep(&title_layer, &name_marquee, cur_millis);
+        compMarqueeStep(&title_layer, &artists_marquee, cur_millis);
+    }
+
+    // Update progress bar, only the part that changed
+    if (width < displayed_width) {
+        compFillRect(&progress_layer, width, 0, displayed_width - width, 5, HAL_WHITE);
+    } else if (width > displayed_width) {
+        compFillRect(&progress_layer, displayed_width, 0, width - displayed_width, 5, sptf_green);
+    }
+
+    compFlush(&title_layer);
+    compFlush(&progress_layer);
+    bool first_track = bootPhaseEnd(bp_first_track);
+
+    xSemaphoreGive(lcd_mutex);
+    metricsObserve(me_ui, mp_render, micros() - render_us);
+
+    // Boot is over
+    if (first_track) {
+        M5S_DBG("\nBoot timing:\n");
+        bootStatsWrite([](const char *line, void *ctx) {
+            M5S_DBG("%s", line);
+        }, nullptr);
+    }
+    displayed_version = state.version;
+    displayed_width = width;
+}
+
+
+/**
+ * Spotify next/previous track(s)
+ *
+ * @param count     Number of tracks to skip, negative to go backwards
+ */
+void sptfSkip(int8_t count) {
+    const char *endpoint = count > 0 ? "/next" : "/previous";
+    bool skipped = false;
+    sptfAction = Next;
+
+    // State is fetched along with the last one
+    uint32_t arena_mark = arenaMark();
+    for (uint8_t i = abs(count); i > 0; i--) {
+        arenaRewind(arena_mark);
+        HTTP_response_t response = i > 1 ? sptfApiRequest("POST", endpoint) : sptfApiCommand("POST", endpoint);
+        if (response.httpCode == 429) {
+            // Rate limited (by Spotify or locally): the remaining skips are sent later
+            SPTF_action_t rest = {Next, (int8_t) (count > 0 ? i : -i)};
+            actionQueueRequeue(&sptf_actions, rest);
+            actions_hold_until = millis() + govWaitMs(gov_player_write);
+            M5S_DBG("  Skip throttled, %d left for later\n", rest.count);
+            break;
+        }
+        if (response.undelivered) {
+            // Lost on a stale socket, sent again on a fresh one next loop
+            SPTF_action_t rest = {Next, (int8_t) (count > 0 ? i : -i)};
+            actionQueueRequeue(&sptf_actions, rest);
+            M5S_DBG("  Skip not delivered, %d left for later\n", rest.count);
+            break;
+        }
+        if (response.httpCode != 204) {
+            eventsSendError(response.httpCode, "Spotify error", response.payload);
+            break;
+        }
+        skipped = true;
+    }
+
+    if (skipped) {
+        last_command_millis = millis();
+        if (!follow_up.pending || follow_up.checks == 0) {
+            next_curplay_millis = millis() + sptf_follow_up_ms;
+        }
+        // Spotify does not show it yet, the prefetched track can
+        if (count == 1 && follow_up.pending) {
+            sptfPrefetchSwap();
+        }
+    }
+    sptfAction = CurrentlyPlaying;
+}
+
+
+/**
+ * Spotify toggle pause/play
+ */
+void sptfToggle() {
+    sptfAction = Toggle;
+    HTTP_response_t response = sptfApiCommand("PUT", sptf_is_playing ? "/pause" : "/play");
+    if (response.httpCode == 204) {
+        sptf_is_playing = follow_up.is_playing;
+        last_command_millis = millis();
+        if (!follow_up.pending || follow_up.checks == 0) {
+            next_curplay_millis = millis() + sptf_follow_up_ms;
+        }
+    } else if (response.httpCode == 429) {
+        SPTF_action_t toggle = {Toggle, 0};
+        actionQueueRequeue(&sptf_actions, toggle);
+        actions_hold_until = millis() + govWaitMs(gov_player_write);
+    } else if (response.undelivered) {
+        SPTF_action_t toggle = {Toggle, 0};
+        actionQueueRequeue(&sptf_actions, toggle);
+    } else {
+        eventsSendError(response.httpCode, "Spotify error", response.payload);
+    }
+    sptfAction = CurrentlyPlaying;
+}
@@ -0,0 +1,259 @@
+#ifndef M5SPOT_SPTF_H
+#define M5SPOT_SPTF_H
+
+#include <Arduino.h>
+#include "json_stream.h"
+#include "http_reader.h"
+#include "gzip_stream.h"
+#include "sptf_channel.h"
+#include "action_queue.h"
+
+/*
+ * Spotify client logic (HTTP, token handling, polling, rendering)
+ *
+ * Only relies on the Arduino core API and on the hardware abstraction layer
+ * (hal/hal.h), so it builds both for the M5Stack and for the native
+ * environment (see src/native/).
+ */
+
+#define min(X, Y) (((X)<(Y))?(X):(Y))
+#define startsWith(STR, SEARCH) (strncmp(STR, SEARCH, strlen(SEARCH)) == 0)
+#define startsWithIC(STR, SEARCH) (strncasecmp(STR, SEARCH, strlen(SEARCH)) == 0)
+
+/*
+ * Currently-playing polling delays, see sptfSchedulePoll()
+ * (sptf_config.polling_delay is the maximum delay while playing)
+ */
+#define SPTF_POLL_PAUSED_MS 30000
+#define SPTF_POLL_IDLE_MS 60000
+#define SPTF_POLL_COMMAND_MS 1000
+#define SPTF_POLL_COMMAND_WINDOW_MS 5000
+#define SPTF_POLL_TRACK_END_MS 300
+#define SPTF_PLAYING_ENDPOINT "/currently-playing?market=from_token"
+
+/*
+ * Delay before player commands show in the playback state: learned, see
+ * sptfFollowUpCheck(). The state is fetched in the same round trip as the
+ * command (pipelined) while this delay is within the command round trip,
+ * also learned: Spotify handles the pipelined request once done with the
+ * command, which takes most of that round trip.
+ */
+#define SPTF_FOLLOW_UP_MS 200
+#define SPTF_FOLLOW_UP_MIN_MS 50
+#define SPTF_FOLLOW_UP_MAX_MS 2000
+#define SPTF_COMMAND_MS 300                 // Initial round trip, commands are relayed to the device
+
+/*
+ * Next track prefetch, see sptfPrefetchLoop()
+ */
+#define SPTF_PREFETCH_DELAY_MS 3000         // After a track starts (or half of it, if shorter)...
+#define SPTF_PREFETCH_POLL_SLACK_MS 1000    // ...unless a poll is due sooner
+#define SPTF_PREFETCH_RETRY_MS 10000
+
+/*
+ * Access token refresh, see sptfTokenLoop()
+ */
+#define SPTF_TOKEN_REFRESH_MARGIN_S 300     // Refresh window opens before expiry...
+#define SPTF_TOKEN_FORCE_MARGIN_S 60        // ...refresh can't wait for polls to be done anymore
+#define SPTF_TOKEN_POLL_SLACK_MS 2000       // Refresh is not started if a poll is due sooner
+#define SPTF_TOKEN_RETRY_MS 5000
+#define SPTF_MIN_EPOCH 1577836800           // Wall clock (SNTP) is set if past 2020-01-01
+
+//@formatter:off
+#ifdef DEBUG_M5SPOT
+#define M5S_DBG(...) Serial.printf( __VA_ARGS__ )
+#else
+// Not compiled in, but arguments still count as used (and formats are checked)
+#define M5S_DBG(...) do { if (false) Serial.printf( __VA_ARGS__ ); } while (false)
+#endif
+//@formatter:on
+
+#define HTTP_PAYLOAD_MAX_SIZE 1024          // Not streamed bodies (errors) are truncated to it
+
+typedef struct {
+    int httpCode;
+    const char *payload;    // Not streamed body, in arena (truncated if too big), or static message
+    uint32_t retry_after;   // Retry-After header (s), 0 if none
+    bool undelivered;       // Kept-alive socket closed before any response: request never reached the server
+} HTTP_response_t;
+
+typedef struct {
+    HTTP_reader_t *reader;
+    HTTP_response_t *response;
+    HTTP_body_cb_t body_cb;
+    void *body_ctx;
+    uint32_t body_cb_us;    // Time spent in body_cb (parsing)
+    char *payload;
+    size_t payload_len;
+    size_t payload_size;
+    bool gzip;              // Content-Encoding: gzip, body goes through gz
+    GZIP_stream_t gz;
+} HTTP_request_ctx_t;
+
+typedef struct {
+    const char *headers;
+    const char *content;
+    HTTP_body_cb_t body_cb;
+    void *body_ctx;
+} HTTP_request_t;
+
+#define SPTF_MAX_IMAGES 3
+
+// Album art box, between title and progress bars
+#define SPTF_ART_X 10
+#define SPTF_ART_Y 30
+#define SPTF_ART_W 300
+#define SPTF_ART_H 205
+
+typedef struct {
+    bool is_playing;
+    uint32_t progress_ms;
+    uint32_t duration_ms;
+    char id[32];
+    char album_id[32];
+    char name[128];
+    char artists[160];
+    uint8_t image_count;
+    char image_urls[SPTF_MAX_IMAGES][80];
+    uint16_t image_widths[SPTF_MAX_IMAGES];     // 0 if unknown
+    uint16_t image_heights[SPTF_MAX_IMAGES];
+} SPTF_playing_t;
+
+typedef struct {
+    uint32_t due_millis;    // 0 if done, or nothing to prefetch
+    bool ready;
+    bool art_ready;         // Album art staged or cached, else downloaded on swap
+    char after_id[32];      // Track the queue was read behind
+    SPTF_playing_t next;    // progress_ms & is_playing unused
+} SPTF_prefetch_t;
+
+typedef struct {
+    const char *access_token;   // In arena
+    const char *refresh_token;  // In arena, nullptr if none
+    uint32_t expires_in;
+} SPTF_token_t;
+
+/*
+ * Set by the platform at startup (from config.h on the M5Stack).
+ * Hosts & ports can point to a local mock server (see native/mock_spotify.h).
+ */
+typedef struct {
+    const char *client_id;
+    const char *client_secret;
+    uint16_t polling_delay;
+    const char *api_host;
+    uint16_t api_port;
+    const char *accounts_host;
+    uint16_t accounts_port;
+} SPTF_config_t;
+
+enum SptfActions {
+    Iddle, GetToken, CurrentlyPlaying, Next, Previous, Toggle, ResetToken
+};
+
+// Last player command, until the playback state shows it
+typedef struct {
+    bool pending;
+    SptfActions action;
+    char id[32];            // Track before next/previous
+    bool is_playing;        // Expected after play/pause
+    uint32_t command_millis;
+    uint8_t checks;         // States fetched that did not show it yet
+} SPTF_follow_up_t;
+
+enum GrantTypes {
+    gt_authorization_code, gt_refresh_token
+};
+
+enum EventsLogTypes {
+    log_line, log_raw, log_info, log_error
+};
+
+
+/*
+ * Globals
+ */
+//@formatter:off
+extern SPTF_config_t sptf_config;
+
+extern String auth_code;
+extern String access_token;         // Set by the network task, under settingsLock() for the web server
+extern String refresh_token;
+
+extern uint32_t token_lifetime_ms;   // From token_millis to expiry
+extern uint32_t token_millis;
+extern uint32_t next_curplay_millis;
+extern uint32_t last_command_millis;
+
+extern bool getting_token;
+extern bool sptf_is_playing;
+extern uint32_t sptf_follow_up_ms;
+extern uint32_t sptf_command_ms;
+extern uint16_t sptf_green;
+
+extern SptfActions sptfAction;
+extern ACTION_queue_t sptf_actions;
+
+extern CMD_queue_t ui_cmd_queue;
+extern CMD_queue_t web_cmd_queue;
+extern SPTF_state_buffer_t sptf_state;
+extern SemaphoreHandle_t lcd_mutex;
+
+// Owned by the platform
+extern bool ota_in_progress;
+extern bool send_events;
+//@formatter:on
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+void sptfNetTask(void *param);
+void sptfNetLoop();
+
+void httpOnHeader(const HTTP_header_t &header, void *ctx);
+void httpOnBody(const char *data, size_t len, void *ctx);
+void httpOnBodyData(const char *data, size_t len, void *ctx);
+HTTP_response_t httpRequest(const char *host, uint16_t port, const char *headers, const char *content = "", HTTP_body_cb_t body_cb = nullptr, void *body_ctx = nullptr);
+void httpRequests(const char *host, uint16_t port, const HTTP_request_t *requests, HTTP_response_t *responses, uint8_t count);
+bool httpIdempotent(const HTTP_request_t *requests, uint8_t count);
+HTTP_response_t sptfApiRequest(const char *method, const char *endpoint, const char *content = "", HTTP_body_cb_t body_cb = nullptr, void *body_ctx = nullptr);
+void sptfApiHeaders(char *headers, size_t size, const char *method, const char *endpoint, size_t content_length);
+HTTP_response_t sptfApiCommand(const char *method, const char *endpoint);
+void sptfParseToken(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type);
+void sptfGetToken(const String &code, GrantTypes grant_type = gt_refresh_token);
+void sptfTokenLoop(uint32_t cur_millis);
+bool sptfRestoreToken(const char *token, uint32_t expires_at);
+void sptfResetToken();
+void sptfSchedulePoll(int httpCode, const SPTF_playing_t *playing);
+void sptfCurrentlyPlaying();
+void sptfHandlePlaying(const HTTP_response_t &response, SPTF_playing_t *playing, JSON_stream_t *js, uint32_t request_millis);
+void sptfFollowUpStart(uint32_t command_millis);
+bool sptfFollowUpCheck(const SPTF_playing_t *playing, uint32_t request_millis);
+void sptfParsePlaying(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type);
+void sptfParseTrack(JSON_stream_t *js, SPTF_playing_t *track, const char *field, const char *value, uint8_t array_nr);
+void sptfParseQueue(JSON_stream_t *js, const char *path, const char *value, JsonStreamTypes type);
+void sptfPrefetchLoop(uint32_t cur_millis);
+void sptfPrefetch();
+bool sptfPrefetchSwap();
+uint8_t sptfPickAlbumArt(const SPTF_playing_t *playing, uint16_t width, uint16_t height);
+void sptfSkip(int8_t count);
+void sptfToggle();
+void sptfDisplayPlaying();
+
+// Implemented by the platform (main.cpp, or native/platform_linux.cpp)
+void eventsSendLog(const char *logData, EventsLogTypes type = log_line);
+void eventsSendInfo(const char *msg, const char* payload = "");
+void eventsSendError(int code, const char *msg, const char *payload = "");
+void sptfDisplayAlbumArt(const char *url, const char *cache_key);
+void sptfClearAlbumArt();
+bool sptfCanPrefetchAlbumArt();
+bool sptfPrefetchAlbumArt(const char *url, const char *cache_key);
+void writeRefreshToken();
+void writeAccessToken(uint32_t expires_at);
+void deleteRefreshToken();
+String b64Encode(String str);
+//@formatter:on
+
+#endif // M5SPOT_SPTF_H
@@ -0,0 +1,84 @@
+#include "sptf_channel.h"
+
+#define CMD_MASK (CMD_QUEUE_SIZE - 1)
+
+
+/**
+ * Push a command (producer side)
+ *
+ * @param q
+ * @param cmd
+ * @return false if queue is full
+ */
+bool cmdQueuePush(CMD_queue_t *q, uint8_t cmd) {
+    uint32_t tail = q->tail.load(std::memory_order_relaxed);
+    if (tail - q->head.load(std::memory_order_acquire) >= CMD_QUEUE_SIZE) {
+        return false;
+    }
+    q->buff[tail & CMD_MASK] = cmd;
+    q->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+
+/**
+ * Pop a command (consumer side)
+ *
+ * @param q
+ * @param cmd
+ * @return false if queue is empty
+ */
+bool cmdQueuePop(CMD_queue_t *q, uint8_t *cmd) {
+    uint32_t head = q->head.load(std::memory_order_relaxed);
+    if (head == q->tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *cmd = q->buff[head & CMD_MASK];
+    q->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+
+/**
+ * Publish a new playback state (writer side)
+ *
+ * @param sb
+ * @param state     Its version field is set by the buffer
+ */
+void stateBufferWrite(SPTF_state_buffer_t *sb, const SPTF_state_t &state) {
+    uint8_t back = 1 - sb->front.load(std::memory_order_relaxed);
+
+    sb->seq[back].fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_release);
+    sb->slots[back] = state;
+    sb->slots[back].version = ++sb->version;
+    sb->seq[back].fetch_add(1, std::memory_order_release);
+
+    sb->front.store(back, std::memory_order_release);
+}
+
+
+/**
+ * Get a copy of the latest playback state (reader side)
+ *
+ * @param sb
+ * @param state
+ * @return false if nothing has been published yet
+ */
+bool stateBufferRead(SPTF_state_buffer_t *sb, SPTF_state_t *state) {
+    while (true) {
+        uint8_t front = sb->front.load(std::memory_order_acquire);
+        uint32_t seq = sb->seq[front].load(std::memory_order_acquire);
+        if (seq == 0) {
+            return false;
+        }
+        if (seq & 1) {
+            continue;
+        }
+        *state = sb->slots[front];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sb->seq[front].load(std::memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+}
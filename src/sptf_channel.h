@@ -0,0 +1,55 @@
+#ifndef M5SPOT_SPTF_CHANNEL_H
+#define M5SPOT_SPTF_CHANNEL_H
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+ * Lock-free channels between the UI task (core 1) and the network task (core 0)
+ *
+ * - Commands go through single-producer/single-consumer rings, one per
+ *   producing task (Arduino loop, AsyncWebServer callbacks).
+ * - Playback state comes back through a double buffered snapshot: the network
+ *   task writes the back slot then swaps, the UI copies the front slot and
+ *   retries if it was overwritten in the meantime.
+ */
+
+#define CMD_QUEUE_SIZE 16   // Must be a power of 2
+
+typedef struct {
+    uint8_t buff[CMD_QUEUE_SIZE];
+    std::atomic<uint32_t> head;     // Next slot to read, owned by consumer
+    std::atomic<uint32_t> tail;     // Next slot to write, owned by producer
+} CMD_queue_t;
+
+typedef struct {
+    uint32_t version;
+    bool is_playing;
+    uint32_t progress_ms;
+    uint32_t duration_ms;
+    uint32_t progress_millis;   // millis() when progress_ms was read
+    char id[32];
+    char name[128];
+    char artists[160];
+} SPTF_state_t;
+
+typedef struct {
+    SPTF_state_t slots[2];
+    std::atomic<uint32_t> seq[2];   // Odd while slot is being written
+    std::atomic<uint8_t> front;
+    uint32_t version;
+} SPTF_state_buffer_t;
+
+
+/*
+ * Function declarations
+ */
+//@formatter:off
+bool cmdQueuePush(CMD_queue_t *q, uint8_t cmd);
+bool cmdQueuePop(CMD_queue_t *q, uint8_t *cmd);
+
+void stateBufferWrite(SPTF_state_buffer_t *sb, const SPTF_state_t &state);
+bool stateBufferRead(SPTF_state_buffer_t *sb, SPTF_state_t *state);
+//@formatter:on
+
+#endif // M5SPOT_SPTF_CHANNEL_H
@@ -0,0 +1,974 @@
+#include <string>
+#include <unity.h>
+#include <Arduino.h>
+#include "sptf.h"
+#include "action_queue.h"
+#include "arena.h"
+#include "event_log.h"
+#include "art_cache.h"
+#include "settings.h"
+#include "governor.h"
+#include "hal/hal.h"
+#include "fixtures.h"
+#include "hal_linux.h"
+#include "mock_spotify.h"
+
+/*
+ * Unit tests of the portable modules, against canned Spotify responses
+ * Run: pio test -e native
+ */
+
+static ReplayClient client;
+static HTTP_reader_t reader;
+
+
+void setUp() {
+}
+
+
+void tearDown() {
+}
+
+
+/*
+ * HTTP reader
+ */
+
+/**
+ * Body collected by the reader
+ */
+static void appendBody(const char *data, size_t len, void *ctx) {
+    ((std::string *) ctx)->append(data, len);
+}
+
+
+/**
+ * Read a whole response, in reads of at most segment bytes
+ *
+ * @param response
+ * @param segment
+ * @param body
+ * @return
+ */
+static HttpReaderResults readResponse(const std::string &response, size_t segment, std::string *body) {
+    httpReaderInit(&reader, nullptr, appendBody, body);
+    client.segment = segment;
+    client.rewind(response.data(), response.size());
+    return httpReaderRun(&reader, client, 1000);
+}
+
+
+/**
+ * JSON body of the fixture response
+ *
+ * @return
+ */
+static std::string playingBody() {
+    std::string response = fixturePlayingResponse(false);
+    return response.substr(response.find("\r\n\r\n") + 4);
+}
+
+
+static void test_http_reader_content_length() {
+    std::string body;
+    TEST_ASSERT_EQUAL(hr_complete, readResponse(fixturePlayingResponse(false), 1460, &body));
+    TEST_ASSERT_EQUAL(200, reader.httpCode);
+    TEST_ASSERT_TRUE(reader.keep_alive);
+    TEST_ASSERT_FALSE(reader.chunked);
+    TEST_ASSERT_EQUAL(playingBody().size(), reader.body_size);
+    TEST_ASSERT_TRUE(body == playingBody());
+}
+
+
+static void test_http_reader_chunked() {
+    std::string body;
+    TEST_ASSERT_EQUAL(hr_complete, readResponse(fixturePlayingResponse(true), 1460, &body));
+    TEST_ASSERT_EQUAL(200, reader.httpCode);
+    TEST_ASSERT_TRUE(reader.chunked);
+    TEST_ASSERT_EQUAL(playingBody().size(), body.size());
+    TEST_ASSERT_TRUE(body == playingBody());
+}
+
+
+static void test_http_reader_segmented() {
+    const size_t segments[] = {1, 3, 7, 536};
+    for (size_t segment : segments) {
+        for (int chunked = 0; chunked < 2; chunked++) {
+            std::string body;
+            TEST_ASSERT_EQUAL(hr_complete, readResponse(fixturePlayingResponse(chunked), segment, &body));
+            TEST_ASSERT_TRUE(body == playingBody());
+        }
+    }
+}
+
+
+static void test_http_reader_pipelined() {
+    std::string first = fixturePlayingResponse(false);
+    std::string second = "HTTP/1.1 204 No Content\r\nConnection: keep-alive\r\n\r\n";
+    std::string responses = first + second;
+    std::string body;
+
+    TEST_ASSERT_EQUAL(hr_complete, readResponse(responses, 1460, &body));
+    TEST_ASSERT_EQUAL(200, reader.httpCode);
+    TEST_ASSERT_TRUE(body == playingBody());
+
+    // Second response may already be (partly) buffered
+    body.clear();
+    httpReaderNext(&reader, &body);
+    TEST_ASSERT_EQUAL(hr_complete, httpReaderRun(&reader, client, 1000));
+    TEST_ASSERT_EQUAL(204, reader.httpCode);
+    TEST_ASSERT_EQUAL(0, body.size());
+}
+
+
+static void test_http_reader_truncated() {
+    std::string response = fixturePlayingResponse(false);
+    response.resize(response.size() - 10);
+    std::string body;
+    TEST_ASSERT_NOT_EQUAL(hr_complete, readResponse(response, 1460, &body));
+}
+
+
+static void test_http_error_payload() {
+    std::string body(3000, 'E');
+    std::string response = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 3000\r\n\r\n" + body;
+
+    // Truncated, the arena is left to event messages
+    arenaReset();
+    uint32_t mark = arenaMark();
+    HTTP_response_t result = {0, ""};
+    HTTP_request_ctx_t ctx = {&reader, &result, nullptr, nullptr, 0, nullptr, 0, 0, false};
+    httpReaderInit(&reader, httpOnHeader, httpOnBody, &ctx);
+    client.segment = 700;
+    client.rewind(response.data(), response.size());
+    TEST_ASSERT_EQUAL(hr_complete, httpReaderRun(&reader, client, 1000));
+    TEST_ASSERT_EQUAL(HTTP_PAYLOAD_MAX_SIZE - 1, ctx.payload_len);
+    TEST_ASSERT_TRUE(arenaAvailable() >= ARENA_SIZE - HTTP_PAYLOAD_MAX_SIZE);
+
+    arenaRewind(mark);
+    TEST_ASSERT_EQUAL(ARENA_SIZE, arenaAvailable());
+}
+
+
+/*
+ * JSON stream
+ */
+
+/**
+ * Read & parse the fixture currently-playing response
+ *
+ * @param response
+ * @param segment
+ * @param gzip
+ * @param playing
+ */
+static void readPlaying(const std::string &response, size_t segment, bool gzip, SPTF_playing_t *playing) {
+    JSON_stream_t js;
+    GZIP_stream_t gz;
+
+    memset(playing, 0, sizeof(*playing));
+    jsonStreamInit(&js, sptfParsePlaying, playing);
+    HTTP_body_cb_t json_cb = [](const char *data, size_t len, void *ctx) {
+        jsonStreamFeed((JSON_stream_t *) ctx, data, len);
+    };
+    if (gzip) {
+        gzipStreamInit(&gz, json_cb, &js);
+        httpReaderInit(&reader, nullptr, [](const char *data, size_t len, void *ctx) {
+            gzipStreamFeed((GZIP_stream_t *) ctx, data, len);
+        }, &gz);
+    } else {
+        httpReaderInit(&reader, nullptr, json_cb, &js);
+    }
+    client.segment = segment;
+    client.rewind(response.data(), response.size());
+
+    TEST_ASSERT_EQUAL(hr_complete, httpReaderRun(&reader, client, 1000));
+    TEST_ASSERT_TRUE(!gzip || gzipStreamDone(&gz));
+    TEST_ASSERT_TRUE(jsonStreamDone(&js));
+}
+
+
+/**
+ * Check the fields of the fixture track
+ *
+ * @param playing
+ */
+static void assertPlaying(const SPTF_playing_t &playing) {
+    TEST_ASSERT_EQUAL_STRING(FIXTURE_TRACK_ID, playing.id);
+    TEST_ASSERT_EQUAL_STRING("2noRn2Aes5aoNVsU6iWThc", playing.album_id);
+    TEST_ASSERT_EQUAL_STRING("One More Time", playing.name);
+    TEST_ASSERT_EQUAL_STRING("Daft Punk, Romanthony", playing.artists);
+    TEST_ASSERT_TRUE(playing.is_playing);
+    TEST_ASSERT_EQUAL_UINT32(42000, playing.progress_ms);
+    TEST_ASSERT_EQUAL_UINT32(320357, playing.duration_ms);
+    TEST_ASSERT_EQUAL_UINT8(3, playing.image_count);
+    TEST_ASSERT_EQUAL_STRING("https://i.scdn.co/image/ab67616d0000b2730300", playing.image_urls[1]);
+    TEST_ASSERT_EQUAL_UINT16(300, playing.image_widths[1]);
+    TEST_ASSERT_EQUAL(1, sptfPickAlbumArt(&playing, SPTF_ART_W, SPTF_ART_H));
+}
+
+
+static void test_json_stream_playing() {
+    SPTF_playing_t playing;
+    readPlaying(fixturePlayingResponse(false), 1460, false, &playing);
+    assertPlaying(playing);
+    readPlaying(fixturePlayingResponse(true), 1460, false, &playing);
+    assertPlaying(playing);
+    readPlaying(fixturePlayingResponse(true), 1, false, &playing);
+    assertPlaying(playing);
+}
+
+
+static void test_json_stream_playing_gzip() {
+    SPTF_playing_t playing;
+    readPlaying(fixturePlayingResponse(true, true), 1460, true, &playing);
+    assertPlaying(playing);
+    readPlaying(fixturePlayingResponse(false, true), 5, true, &playing);
+    assertPlaying(playing);
+}
+
+
+static void test_json_stream_token() {
+    std::string json = fixtureTokenJson();
+    SPTF_token_t token;
+    JSON_stream_t js;
+
+    // Fed whole, then byte by byte (values split across reads)
+    for (size_t step : {json.size(), (size_t) 1}) {
+        arenaReset();
+        token = {nullptr, nullptr, 0};
+        jsonStreamInit(&js, sptfParseToken, &token);
+        for (size_t i = 0; i < json.size(); i += step) {
+            jsonStreamFeed(&js, json.data() + i, min(step, json.size() - i));
+        }
+        TEST_ASSERT_TRUE(jsonStreamDone(&js));
+        TEST_ASSERT_EQUAL_UINT32(3600, token.expires_in);
+        TEST_ASSERT_NOT_NULL(token.access_token);
+        TEST_ASSERT_EQUAL(FIXTURE_ACCESS_TOKEN_LEN, strlen(token.access_token));
+        TEST_ASSERT_EQUAL_STRING(std::string(FIXTURE_ACCESS_TOKEN_LEN, 'A').c_str(), token.access_token);
+        TEST_ASSERT_NOT_NULL(token.refresh_token);
+        TEST_ASSERT_EQUAL(131, strlen(token.refresh_token));
+    }
+}
+
+
+static void test_json_stream_queue() {
+    std::string json = "{\"currently_playing\":{\"id\":\"current\",\"name\":\"Current\"},\"queue\":["
+                       "{\"album\":{\"id\":\"album1\",\"images\":[{\"height\":640,\"url\":\"https://i/640\",\"width\":640},"
+                       "{\"height\":300,\"url\":\"https://i/300\",\"width\":300}]},"
+                       "\"artists\":[{\"name\":\"A\"},{\"name\":\"B\"}],\"duration_ms\":1000,\"id\":\"next1\",\"name\":\"Next 1\"},"
+                       "{\"album\":{\"id\":\"album2\"},\"artists\":[{\"name\":\"C\"}],\"id\":\"next2\",\"name\":\"Next 2\"}]}";
+    SPTF_prefetch_t prefetch;
+    JSON_stream_t js;
+
+    memset(&prefetch, 0, sizeof(prefetch));
+    jsonStreamInit(&js, sptfParseQueue, &prefetch);
+    jsonStreamFeed(&js, json.data(), json.size());
+    TEST_ASSERT_TRUE(jsonStreamDone(&js));
+    TEST_ASSERT_EQUAL_STRING("current", prefetch.after_id);
+    TEST_ASSERT_EQUAL_STRING("next1", prefetch.next.id);
+    TEST_ASSERT_EQUAL_STRING("album1", prefetch.next.album_id);
+    TEST_ASSERT_EQUAL_STRING("Next 1", prefetch.next.name);
+    TEST_ASSERT_EQUAL_STRING("A, B", prefetch.next.artists);
+    TEST_ASSERT_EQUAL_UINT32(1000, prefetch.next.duration_ms);
+    TEST_ASSERT_EQUAL_UINT8(2, prefetch.next.image_count);
+    TEST_ASSERT_EQUAL_STRING("https://i/300", prefetch.next.image_urls[1]);
+}
+
+
+/*
+ * Tokens
+ */
+
+static void test_token_restore() {
+    time_t now = time(nullptr);
+
+    TEST_ASSERT_FALSE(sptfRestoreToken("", now + 3600));
+    TEST_ASSERT_FALSE(sptfRestoreToken("saved", 0));
+    TEST_ASSERT_FALSE(sptfRestoreToken("saved", now + SPTF_TOKEN_FORCE_MARGIN_S / 2));
+
+    TEST_ASSERT_TRUE(sptfRestoreToken("saved", now + 3600));
+    TEST_ASSERT_EQUAL_STRING("saved", access_token.c_str());
+    TEST_ASSERT_UINT32_WITHIN(1000, 3600 * 1000, token_lifetime_ms);
+}
+
+
+static void test_token_reset() {
+    refresh_token = "saved-refresh";
+    writeRefreshToken();
+    TEST_ASSERT_TRUE(sptfRestoreToken("saved", time(nullptr) + 3600));
+
+    // From the web server
+    cmdQueuePush(&web_cmd_queue, ResetToken);
+    sptfNetLoop();
+    TEST_ASSERT_EQUAL_STRING("", access_token.c_str());
+    TEST_ASSERT_EQUAL_STRING("", refresh_token.c_str());
+    TEST_ASSERT_TRUE(settingsBegin());
+    TEST_ASSERT_EQUAL_STRING("", settings.refresh_token);
+    TEST_ASSERT_EQUAL_STRING("", settings.access_token);
+}
+
+
+/*
+ * Polling
+ */
+
+static void assertNextPoll(int httpCode, const SPTF_playing_t *playing, uint32_t delay_ms) {
+    sptfSchedulePoll(httpCode, playing);
+    TEST_ASSERT_UINT32_WITHIN(5, delay_ms, next_curplay_millis - millis());
+}
+
+
+static void test_schedule_poll() {
+    sptf_config.polling_delay = 10000;
+    last_command_millis = millis() - SPTF_POLL_COMMAND_WINDOW_MS;
+    SPTF_playing_t playing;
+    memset(&playing, 0, sizeof(playing));
+
+    assertNextPoll(204, nullptr, SPTF_POLL_IDLE_MS);
+    assertNextPoll(200, &playing, SPTF_POLL_IDLE_MS);
+
+    // Ads, episodes or local files: no id, still playing
+    playing.is_playing = true;
+    assertNextPoll(200, &playing, 10000);
+
+    strlcpy(playing.id, FIXTURE_TRACK_ID, sizeof(playing.id));
+    playing.duration_ms = 200000;
+    playing.progress_ms = 198000;
+    assertNextPoll(200, &playing, 2000 + SPTF_POLL_TRACK_END_MS);
+
+    playing.is_playing = false;
+    assertNextPoll(200, &playing, SPTF_POLL_PAUSED_MS);
+}
+
+
+static void test_follow_up_learning() {
+    SPTF_playing_t playing;
+    memset(&playing, 0, sizeof(playing));
+    sptfAction = Toggle;
+    sptf_is_playing = true;
+    sptf_follow_up_ms = 200;
+
+    // Pause shown at the second check, 600 ms after the command
+    sptfFollowUpStart(1000);
+    playing.is_playing = true;
+    TEST_ASSERT_FALSE(sptfFollowUpCheck(&playing, 1200));
+    playing.is_playing = false;
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 1600));
+    TEST_ASSERT_EQUAL_UINT32((200 * 3 + 600) / 4, sptf_follow_up_ms);
+
+    // Shown at the first check, 400 ms after: only known to take less, counted as half
+    sptfFollowUpStart(2000);
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 2400));
+    TEST_ASSERT_EQUAL_UINT32((300 * 3 + 200) / 4, sptf_follow_up_ms);
+
+    // Pipelined, right behind the command
+    sptfFollowUpStart(3000);
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 3000));
+    TEST_ASSERT_EQUAL_UINT32(275 * 3 / 4, sptf_follow_up_ms);
+
+    // Capped
+    sptf_follow_up_ms = SPTF_FOLLOW_UP_MAX_MS;
+    sptfFollowUpStart(4000);
+    playing.is_playing = true;
+    TEST_ASSERT_FALSE(sptfFollowUpCheck(&playing, 4100));
+    playing.is_playing = false;
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 4000 + SPTF_POLL_COMMAND_WINDOW_MS));
+    TEST_ASSERT_EQUAL_UINT32(SPTF_FOLLOW_UP_MAX_MS, sptf_follow_up_ms);
+
+    // Never shown (changed from elsewhere): given up after the command window, nothing learned
+    sptf_follow_up_ms = 200;
+    sptfFollowUpStart(10000);
+    playing.is_playing = true;
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 10000 + SPTF_POLL_COMMAND_WINDOW_MS + 1));
+    TEST_ASSERT_EQUAL_UINT32(200, sptf_follow_up_ms);
+    TEST_ASSERT_TRUE(sptfFollowUpCheck(&playing, 20000));
+
+    sptf_follow_up_ms = SPTF_FOLLOW_UP_MS;
+    sptfAction = CurrentlyPlaying;
+}
+
+
+/*
+ * Action queue
+ */
+
+static void test_action_queue_coalesce_skips() {
+    ACTION_queue_t q = {};
+    SPTF_action_t action;
+
+    TEST_ASSERT_TRUE(actionQueuePush(&q, Next));
+    TEST_ASSERT_TRUE(actionQueuePush(&q, Next));
+    TEST_ASSERT_TRUE(actionQueuePush(&q, Next));
+    TEST_ASSERT_TRUE(actionQueuePush(&q, Previous));
+    TEST_ASSERT_EQUAL_UINT8(1, q.len);
+    TEST_ASSERT_EQUAL_UINT32(3, q.merged);
+
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(Next, action.action);
+    TEST_ASSERT_EQUAL_INT8(2, action.count);
+    TEST_ASSERT_FALSE(actionQueuePop(&q, &action));
+
+    // Opposite skips cancel out, Previous alone is a negative skip
+    actionQueuePush(&q, Next);
+    actionQueuePush(&q, Previous);
+    TEST_ASSERT_EQUAL_UINT8(0, q.len);
+    actionQueuePush(&q, Previous);
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(Next, action.action);
+    TEST_ASSERT_EQUAL_INT8(-1, action.count);
+}
+
+
+static void test_action_queue_coalesce_others() {
+    ACTION_queue_t q = {};
+    SPTF_action_t action;
+
+    // Burst of the benchmark: Next, Next, Previous, Toggle, Toggle, Next, GetToken, GetToken
+    const uint8_t burst[] = {Next, Next, Previous, Toggle, Toggle, Next, GetToken, GetToken};
+    for (uint8_t a : burst) {
+        TEST_ASSERT_TRUE(actionQueuePush(&q, a));
+    }
+    TEST_ASSERT_EQUAL_UINT8(2, q.len);
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(Next, action.action);
+    TEST_ASSERT_EQUAL_INT8(2, action.count);
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(GetToken, action.action);
+
+    // Different kinds keep their order, GetToken is only queued once
+    actionQueuePush(&q, GetToken);
+    actionQueuePush(&q, Toggle);
+    actionQueuePush(&q, Next);
+    actionQueuePush(&q, GetToken);
+    TEST_ASSERT_EQUAL_UINT8(3, q.len);
+    const uint8_t order[] = {GetToken, Toggle, Next};
+    for (uint8_t a : order) {
+        TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+        TEST_ASSERT_EQUAL_UINT8(a, action.action);
+    }
+}
+
+
+static void test_action_queue_full() {
+    ACTION_queue_t q = {};
+
+    for (uint8_t i = 0; i < ACTION_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(actionQueuePush(&q, i % 2 ? Toggle : Next));
+    }
+    TEST_ASSERT_FALSE(actionQueuePush(&q, GetToken));
+    TEST_ASSERT_EQUAL_UINT32(1, q.dropped);
+
+    // Still merged with the tail when full
+    TEST_ASSERT_TRUE(actionQueuePush(&q, Toggle));
+    TEST_ASSERT_EQUAL_UINT8(ACTION_QUEUE_SIZE - 1, q.len);
+}
+
+
+static void test_action_queue_requeue() {
+    ACTION_queue_t q = {};
+    SPTF_action_t action;
+
+    // Throttled skip goes back in front, merged with skips queued meanwhile
+    actionQueuePush(&q, Next);
+    actionQueuePush(&q, Toggle);
+    TEST_ASSERT_TRUE(actionQueueRequeue(&q, {Next, 2}));
+    TEST_ASSERT_EQUAL_UINT8(2, q.len);
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(Next, action.action);
+    TEST_ASSERT_EQUAL_INT8(3, action.count);
+
+    // Throttled toggle cancels out with a toggle queued meanwhile
+    TEST_ASSERT_TRUE(actionQueueRequeue(&q, {Toggle, 0}));
+    TEST_ASSERT_EQUAL_UINT8(0, q.len);
+
+    TEST_ASSERT_TRUE(actionQueueRequeue(&q, {Toggle, 0}));
+    TEST_ASSERT_TRUE(actionQueuePop(&q, &action));
+    TEST_ASSERT_EQUAL_UINT8(Toggle, action.action);
+}
+
+
+/*
+ * Governor
+ */
+
+/**
+ * Wait until requests of this class are allowed again
+ */
+static void waitGovernor(GovClasses cls) {
+    while (govWaitMs(cls)) {
+        delay(10);
+    }
+}
+
+
+static void test_governor_retry_after() {
+    const GOV_class_t &stats = govStats(gov_player_read);
+    govReport(gov_player_read, 200, 0);
+    uint32_t rate_limited = stats.rate_limited;
+    uint32_t throttled = stats.throttled;
+
+    // Retry-After, plus up to one second of jitter
+    govReport(gov_player_read, 429, 1);
+    TEST_ASSERT_EQUAL_UINT32(rate_limited + 1, stats.rate_limited);
+    TEST_ASSERT_UINT32_WITHIN(510, 1500, govWaitMs(gov_player_read));
+    TEST_ASSERT_FALSE(govAcquire(gov_player_read));
+    TEST_ASSERT_EQUAL_UINT32(throttled + 1, stats.throttled);
+    TEST_ASSERT_EQUAL_UINT32(0, govWaitMs(gov_player_write));
+
+    waitGovernor(gov_player_read);
+    TEST_ASSERT_TRUE(govAcquire(gov_player_read));
+    govReport(gov_player_read, 200, 0);
+}
+
+
+static void test_governor_backoff() {
+    const GOV_class_t &stats = govStats(gov_player_write);
+    govReport(gov_player_write, 200, 0);
+
+    // Doubled on each failure, "equal jitter": between half and all of it
+    govReport(gov_player_write, 503, 0);
+    TEST_ASSERT_EQUAL_UINT8(1, stats.failures);
+    TEST_ASSERT_UINT32_WITHIN(stats.base_ms / 4 + 10, stats.base_ms * 3 / 4, govWaitMs(gov_player_write));
+    govReport(gov_player_write, 503, 0);
+    TEST_ASSERT_UINT32_WITHIN(stats.base_ms / 2 + 10, stats.base_ms * 3 / 2, govWaitMs(gov_player_write));
+
+    // 429 without Retry-After too
+    govReport(gov_player_write, 429, 0);
+    TEST_ASSERT_EQUAL_UINT8(3, stats.failures);
+    TEST_ASSERT_UINT32_WITHIN(stats.base_ms + 10, stats.base_ms * 3, govWaitMs(gov_player_write));
+
+    // A success resets the backoff, the class stays blocked meanwhile
+    govReport(gov_player_write, 204, 0);
+    TEST_ASSERT_EQUAL_UINT8(0, stats.failures);
+    TEST_ASSERT_TRUE(govWaitMs(gov_player_write) > 0);
+    govReport(gov_player_write, 503, 0);
+    TEST_ASSERT_UINT32_WITHIN(stats.base_ms / 4 + 10, stats.base_ms * 3 / 4, govWaitMs(gov_player_write));
+
+    waitGovernor(gov_player_write);
+    govReport(gov_player_write, 204, 0);
+}
+
+
+/*
+ * Settings
+ */
+
+static void test_settings_commit_reload() {
+    settingsBegin();
+    settingsSetString(settings.access_token, sizeof(settings.access_token), "token-test");
+    settings.polling_delay = 12345;
+    TEST_ASSERT_TRUE(settingsCommit());
+
+    memset(&settings, 0, sizeof(settings));
+    TEST_ASSERT_TRUE(settingsBegin());
+    TEST_ASSERT_EQUAL_STRING("token-test", settings.access_token);
+    TEST_ASSERT_EQUAL_UINT32(12345, settings.polling_delay);
+}
+
+
+static void test_settings_corrupted() {
+    TEST_ASSERT_TRUE(settingsBegin());
+
+    // A flipped bit must be caught by the CRC
+    settings.access_token[0] ^= 1;
+    TEST_ASSERT_TRUE(halNvs()->write("settings", &settings, sizeof(settings)));
+    TEST_ASSERT_FALSE(settingsBegin());
+    TEST_ASSERT_EQUAL_STRING("", settings.access_token);
+}
+
+
+/*
+ * Event log
+ */
+
+/**
+ * Batches sent, one per line
+ */
+static void appendBatch(const char *data, EventsLogTypes type, void *ctx) {
+    ((std::string *) ctx)->append(std::to_string(type) + ":" + data + "|");
+}
+
+
+static void test_event_log_empty_lines() {
+    eventLogBegin();
+    std::string sent;
+
+    eventLogPush("", log_line);
+    TEST_ASSERT_EQUAL(1, eventLogDrain(appendBatch, &sent, 4));
+    TEST_ASSERT_EQUAL_STRING("0:|", sent.c_str());
+
+    sent.clear();
+    eventLogPush("", log_line);
+    eventLogPush("request", log_line);
+    eventLogPush("", log_line);
+    TEST_ASSERT_EQUAL(1, eventLogDrain(appendBatch, &sent, 4));
+    TEST_ASSERT_EQUAL_STRING("0:\nrequest\n|", sent.c_str());
+    TEST_ASSERT_EQUAL(0, eventLogDrain(appendBatch, &sent, 4));
+}
+
+
+static void test_event_log_ring() {
+    eventLogBegin();
+    eventLogClear();
+    uint32_t dropped = eventLogDropped();
+    std::string sent;
+
+    // 4 lines of 1000 bytes fit, the oldest is dropped for a 5th one
+    std::string lines[5];
+    for (uint8_t i = 0; i < 5; i++) {
+        lines[i] = std::string(1000, (char) ('a' + i));
+        eventLogPush(lines[i].c_str(), log_line);
+    }
+    TEST_ASSERT_EQUAL_UINT32(dropped + 1, eventLogDropped());
+
+    // One per batch (too long to be joined), oldest first, max_batches at a time
+    TEST_ASSERT_EQUAL(2, eventLogDrain(appendBatch, &sent, 2));
+    TEST_ASSERT_EQUAL_STRING(("0:" + lines[1] + "|0:" + lines[2] + "|").c_str(), sent.c_str());
+    sent.clear();
+    TEST_ASSERT_EQUAL(2, eventLogDrain(appendBatch, &sent, 4));
+    TEST_ASSERT_EQUAL_STRING(("0:" + lines[3] + "|0:" + lines[4] + "|").c_str(), sent.c_str());
+
+    // Lines joined, raw spans concatenated, infos one by one, in order
+    sent.clear();
+    eventLogPush("first", log_line);
+    eventLogPush("second", log_line);
+    eventLogPush("{\"info\":1}", log_info);
+    eventLogPush("{\"info\":2}", log_info);
+    eventLogPush("raw", log_raw);
+    eventLogPush(" span", log_raw);
+    eventLogPush("last", log_line);
+    TEST_ASSERT_EQUAL(5, eventLogDrain(appendBatch, &sent, 8));
+    TEST_ASSERT_EQUAL_STRING("0:first\nsecond|2:{\"info\":1}|2:{\"info\":2}|1:raw span|0:last|", sent.c_str());
+    TEST_ASSERT_EQUAL_UINT32(dropped + 1, eventLogDropped());
+}
+
+
+/*
+ * Album art cache
+ */
+
+/**
+ * Draw an image the way the JPEG decoder does: blocks in raster order, centered
+ * in the SPTF_ART_W x SPTF_ART_H box, cropped to it (row by row if not whole)
+ */
+static void drawBlocks(HalDisplay *display, int16_t img_w, int16_t img_h, uint8_t block) {
+    int16_t off_x = (SPTF_ART_W - img_w) / 2;
+    int16_t off_y = (SPTF_ART_H - img_h) / 2;
+    if (img_w < SPTF_ART_W || img_h < SPTF_ART_H) {
+        display->fillRect(0, 0, SPTF_ART_W, SPTF_ART_H, HAL_WHITE);
+    }
+
+    uint16_t pixels[16 * 16];
+    for (int16_t top = off_y; top < off_y + img_h && top < SPTF_ART_H; top += block) {
+        for (int16_t left = off_x; left < off_x + img_w; left += block) {
+            for (uint16_t i = 0; i < block * block; i++) {
+                pixels[i] = (uint16_t) ((top + i / block) * 31 + (left + i % block) * 7);
+            }
+            int16_t x0 = left > 0 ? left : 0;
+            int16_t y0 = top > 0 ? top : 0;
+            int16_t x1 = min(left + block, SPTF_ART_W);
+            int16_t y1 = min(top + block, SPTF_ART_H);
+            if (x0 >= x1 || y0 >= y1) {
+                continue;
+            }
+            const uint16_t *start = &pixels[(y0 - top) * block + (x0 - left)];
+            if (x1 - x0 == block) {
+                display->pushRect(x0, y0, block, y1 - y0, start);
+            } else {
+                for (int16_t row = 0; row < y1 - y0; row++) {
+                    display->pushRect(x0, y0 + row, x1 - x0, 1, &start[row * block]);
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * Decode into the cache, then check what is drawn from it against a canvas
+ */
+static void assertWriter(int16_t img_w, int16_t img_h, uint8_t block) {
+    HalCanvas *expected = halCreateCanvas(SPTF_ART_W, SPTF_ART_H);
+    drawBlocks(expected, img_w, img_h, block);
+
+    char key[32];
+    snprintf(key, sizeof(key), "writer-%dx%d-%d", img_w, img_h, block);
+    HalDisplay *writer = artCacheWriterOpen(key, SPTF_ART_W, SPTF_ART_H);
+    TEST_ASSERT_NOT_NULL(writer);
+    drawBlocks(writer, img_w, img_h, block);
+    TEST_ASSERT_TRUE(artCacheWriterClose(writer, true));
+
+    TEST_ASSERT_TRUE(artCacheDraw(key, SPTF_ART_X, SPTF_ART_Y));
+    static uint16_t drawn[SPTF_ART_W * SPTF_ART_H];
+    halDisplay()->readRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, drawn);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(expected->buffer(), drawn, SPTF_ART_W * SPTF_ART_H);
+    delete expected;
+}
+
+
+static void test_art_cache_writer() {
+    TEST_ASSERT_TRUE(artCacheBegin());
+    assertWriter(SPTF_ART_W, SPTF_ART_H, 16);
+    assertWriter(320, 320, 16);     // Cropped, by rows
+    assertWriter(150, 150, 8);      // Smaller, on white
+    assertWriter(300, 200, 2);
+
+    // Dropped, e.g. decoding failed
+    HalDisplay *writer = artCacheWriterOpen("writer-dropped", SPTF_ART_W, SPTF_ART_H);
+    TEST_ASSERT_NOT_NULL(writer);
+    drawBlocks(writer, SPTF_ART_W, SPTF_ART_H, 16);
+    TEST_ASSERT_FALSE(artCacheWriterClose(writer, false));
+    TEST_ASSERT_FALSE(artCacheHas("writer-dropped"));
+}
+
+
+static void test_art_cache_short_write() {
+    TEST_ASSERT_TRUE(artCacheBegin());
+    halDisplay()->fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, 0x1234);
+    TEST_ASSERT_TRUE(artCacheStore("kept", SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H));
+
+    // Card full halfway through
+    linuxStorage()->space = SPTF_ART_W * SPTF_ART_H;
+    TEST_ASSERT_FALSE(artCacheStore("short", SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H));
+    linuxStorage()->space = SPTF_ART_W * SPTF_ART_H;
+    HalDisplay *writer = artCacheWriterOpen("short", SPTF_ART_W, SPTF_ART_H);
+    drawBlocks(writer, SPTF_ART_W, SPTF_ART_H, 16);
+    TEST_ASSERT_FALSE(artCacheWriterClose(writer, true));
+    linuxStorage()->space = SIZE_MAX;
+
+    TEST_ASSERT_FALSE(artCacheHas("short"));
+    TEST_ASSERT_FALSE(artCacheDraw("short", SPTF_ART_X, SPTF_ART_Y));
+    TEST_ASSERT_TRUE(artCacheBegin());
+    TEST_ASSERT_FALSE(artCacheHas("short"));
+    TEST_ASSERT_TRUE(artCacheHas("kept"));
+}
+
+
+static void test_art_cache_lru() {
+    TEST_ASSERT_TRUE(artCacheBegin());
+    halDisplay()->fillRect(SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H, 0x5678);
+    char key[16];
+    for (uint8_t i = 0; i < ART_CACHE_MAX_ENTRIES; i++) {
+        snprintf(key, sizeof(key), "lru-%d", i);
+        TEST_ASSERT_TRUE(artCacheStore(key, SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H));
+    }
+    TEST_ASSERT_FALSE(artCacheHas("kept"));
+
+    // Drawn from cache: no longer the least recently used
+    TEST_ASSERT_TRUE(artCacheDraw("lru-0", SPTF_ART_X, SPTF_ART_Y));
+    TEST_ASSERT_TRUE(artCacheStore("lru-new", SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H));
+    TEST_ASSERT_TRUE(artCacheHas("lru-0"));
+    TEST_ASSERT_FALSE(artCacheHas("lru-1"));
+    TEST_ASSERT_TRUE(artCacheHas("lru-2"));
+    TEST_ASSERT_TRUE(artCacheHas("lru-new"));
+    TEST_ASSERT_FALSE(artCacheDraw("lru-1", SPTF_ART_X, SPTF_ART_Y));
+
+    // Use order kept across restarts
+    TEST_ASSERT_TRUE(artCacheBegin());
+    TEST_ASSERT_TRUE(artCacheStore("lru-restart", SPTF_ART_X, SPTF_ART_Y, SPTF_ART_W, SPTF_ART_H));
+    TEST_ASSERT_FALSE(artCacheHas("lru-2"));
+    TEST_ASSERT_TRUE(artCacheHas("lru-0"));
+    TEST_ASSERT_TRUE(artCacheHas("lru-3"));
+}
+
+
+/*
+ * Against the mock server
+ */
+
+/**
+ * Wait until the governor allows that many requests in a row, all classes
+ * together (spent by previous tests)
+ */
+static void waitBucket(uint32_t tokens) {
+    while (govBucketTokens() < tokens) {
+        delay(10);
+    }
+}
+
+
+/**
+ * Start a mock server and point the Spotify client to it
+ */
+static void startMock(const MOCK_config_t &mock) {
+    waitBucket(GOV_BUCKET_SIZE / 2);
+    uint16_t port = mockSpotifyStart(mock);
+    TEST_ASSERT_NOT_EQUAL(0, port);
+
+    sptf_config.client_id = "mock-client";
+    sptf_config.client_secret = "mock-secret";
+    sptf_config.api_host = "127.0.0.1";
+    sptf_config.api_port = port;
+    sptf_config.accounts_host = "127.0.0.1";
+    sptf_config.accounts_port = port;
+    refresh_token = "mock-refresh";
+    token_millis = 0;
+    next_curplay_millis = millis();
+    sptf_follow_up_ms = SPTF_FOLLOW_UP_MS;
+    sptf_command_ms = SPTF_COMMAND_MS;
+    sptfAction = CurrentlyPlaying;
+    settingsBegin();
+}
+
+
+/**
+ * Run the network loop for a while
+ */
+static void netLoopFor(uint32_t ms) {
+    uint32_t start = millis();
+    while (millis() - start < ms) {
+        sptfNetLoop();
+        delay(1);
+    }
+}
+
+
+static void test_stale_connection_poll() {
+    startMock({0, 0, 0, 0, 2, 0, 3600, 30000, 0});
+    netLoopFor(300);
+    MOCK_stats_t before = mockSpotifyStats();
+
+    // The kept-alive connection is closed on the poll, sent again at once on a new one
+    mockSpotifyDropNext();
+    next_curplay_millis = millis();
+    netLoopFor(100);
+
+    MOCK_stats_t after = mockSpotifyStats();
+    TEST_ASSERT_EQUAL_UINT32(1, after.dropped);
+    TEST_ASSERT_EQUAL_UINT32(before.polls + 1, after.polls);
+    TEST_ASSERT_EQUAL_UINT32(before.connections + 1, after.connections);
+}
+
+
+static void test_stale_connection_command() {
+    startMock({0, 0, 0, 0, 2, 0, 3600, 30000, 0});
+    netLoopFor(300);
+    MOCK_stats_t before = mockSpotifyStats();
+    TEST_ASSERT_TRUE(before.polls > 0);
+
+    // The kept-alive connection is closed on the command, which is sent again on a new one
+    mockSpotifyDropNext();
+    cmdQueuePush(&ui_cmd_queue, Toggle);
+    netLoopFor(300);
+
+    MOCK_stats_t after = mockSpotifyStats();
+    TEST_ASSERT_EQUAL_UINT32(1, after.dropped);
+    TEST_ASSERT_EQUAL_UINT32(before.commands + 1, after.commands);
+}
+
+
+static void test_gzip_empty_body() {
+    startMock({0, 0, 0, 0, 2, 0, 3600, 30000, 0});
+    netLoopFor(300);
+
+    // 204 with Content-Encoding: gzip, and no body to inflate
+    HTTP_response_t response = sptfApiCommand("PUT", "/pause");
+    TEST_ASSERT_EQUAL(204, response.httpCode);
+}
+
+
+static void test_command_pipelining() {
+    startMock({0, 0, 0, 0, 2, 0, 3600, 30000, 0});
+    netLoopFor(300);
+    sptfAction = Toggle;
+    sptf_is_playing = true;
+
+    // Commands not shown within a round trip: the state is polled later, the round trip is learned
+    sptf_follow_up_ms = SPTF_FOLLOW_UP_MAX_MS;
+    sptf_command_ms = 1000;
+    MOCK_stats_t before = mockSpotifyStats();
+    TEST_ASSERT_EQUAL(204, sptfApiCommand("PUT", "/pause").httpCode);
+    TEST_ASSERT_EQUAL_UINT32(before.polls, mockSpotifyStats().polls);
+    TEST_ASSERT_TRUE(sptf_command_ms < 1000);
+
+    // Within: fetched in the same round trip, where the pause already shows
+    sptf_follow_up_ms = 100;
+    uint32_t command_ms = sptf_command_ms;
+    waitBucket(2);
+    TEST_ASSERT_EQUAL(204, sptfApiCommand("PUT", "/pause").httpCode);
+    TEST_ASSERT_EQUAL_UINT32(before.polls + 1, mockSpotifyStats().polls);
+    TEST_ASSERT_EQUAL_UINT32(command_ms, sptf_command_ms);
+    TEST_ASSERT_TRUE(sptf_follow_up_ms < 100);
+    TEST_ASSERT_FALSE(sptf_is_playing);
+
+    sptfAction = CurrentlyPlaying;
+}
+
+
+static void test_prefetch_swap() {
+    startMock({0, 0, 0, 0, 2, 0, 3600, 60000, 500});
+    netLoopFor(300);
+
+    // From the start of a track, once Spotify shows it
+    cmdQueuePush(&ui_cmd_queue, Next);
+    netLoopFor(1000);
+    SPTF_state_t shown;
+    TEST_ASSERT_TRUE(stateBufferRead(&sptf_state, &shown));
+
+    waitBucket(1);
+    MOCK_stats_t before = mockSpotifyStats();
+    sptfPrefetch();
+    TEST_ASSERT_EQUAL_UINT32(before.queues + 1, mockSpotifyStats().queues);
+
+    // Not shown until Spotify accepts a skip to it
+    SPTF_state_t state;
+    netLoopFor(300);
+    TEST_ASSERT_TRUE(stateBufferRead(&sptf_state, &state));
+    TEST_ASSERT_EQUAL_STRING(shown.id, state.id);
+
+    // Then at once, while the playback state still shows the previous track...
+    waitBucket(2);
+    cmdQueuePush(&ui_cmd_queue, Next);
+    netLoopFor(50);
+    TEST_ASSERT_TRUE(stateBufferRead(&sptf_state, &state));
+    TEST_ASSERT_TRUE(strcmp(shown.id, state.id) != 0);
+    TEST_ASSERT_TRUE(state.is_playing);
+
+    // ...which does not bring it back, and later agrees
+    SPTF_state_t swapped = state;
+    netLoopFor(1000);
+    TEST_ASSERT_TRUE(stateBufferRead(&sptf_state, &state));
+    TEST_ASSERT_EQUAL_STRING(swapped.id, state.id);
+}
+
+
+int main(int argc, char **argv) {
+    lcd_mutex = xSemaphoreCreateMutex();
+    settingsBegin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_http_reader_content_length);
+    RUN_TEST(test_http_reader_chunked);
+    RUN_TEST(test_http_reader_segmented);
+    RUN_TEST(test_http_reader_pipelined);
+    RUN_TEST(test_http_reader_truncated);
+    RUN_TEST(test_http_error_payload);
+    RUN_TEST(test_json_stream_playing);
+    RUN_TEST(test_json_stream_playing_gzip);
+    RUN_TEST(test_json_stream_token);
+    RUN_TEST(test_json_stream_queue);
+    RUN_TEST(test_token_restore);
+    RUN_TEST(test_token_reset);
+    RUN_TEST(test_schedule_poll);
+    RUN_TEST(test_follow_up_learning);
+    RUN_TEST(test_action_queue_coalesce_skips);
+    RUN_TEST(test_action_queue_coalesce_others);
+    RUN_TEST(test_action_queue_full);
+    RUN_TEST(test_action_queue_requeue);
+    RUN_TEST(test_governor_retry_after);
+    RUN_TEST(test_governor_backoff);
+    RUN_TEST(test_settings_commit_reload);
+    RUN_TEST(test_settings_corrupted);
+    RUN_TEST(test_event_log_empty_lines);
+    RUN_TEST(test_event_log_ring);
+    RUN_TEST(test_art_cache_writer);
+    RUN_TEST(test_art_cache_short_write);
+    RUN_TEST(test_art_cache_lru);
+    RUN_TEST(test_stale_connection_poll);
+    RUN_TEST(test_stale_connection_command);
+    RUN_TEST(test_gzip_empty_body);
+    RUN_TEST(test_command_pipelining);
+    RUN_TEST(test_prefetch_swap);
+    return UNITY_END();
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Build the web console into the SPIFFS image directory
+
+Sources in web/ are minified (HTML, inline CSS & JS) and gzipped into data/,
+as <name>.gz: the M5Stack serves them as is, with Content-Encoding: gzip.
+Output is deterministic (no timestamp in gzip headers), so unchanged sources
+give unchanged files, and unchanged ETags on the device.
+
+Run: python3 tools/build_web.py
+  or automatically before `pio run -t buildfs|uploadfs` (see platformio.ini)
+"""
+
+import gzip
+import os
+import re
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SRC_DIR = os.path.join(ROOT, "web")
+DATA_DIR = os.path.join(ROOT, "data")
+
+
+def minify_css(css):
+    css = re.sub(r"/\*.*?\*/", "", css, flags=re.S)
+    css = re.sub(r"\s+", " ", css)
+    css = re.sub(r"\s*([{}:;,])\s*", r"\1", css)
+    return css.replace(";}", "}").strip()
+
+
+def minify_js(js):
+    # Conservative: comments on lines of their own & indentation only,
+    # line breaks are kept (no need to care about automatic semicolons)
+    js = re.sub(r"/\*.*?\*/", "", js, flags=re.S)
+    lines = (line.strip() for line in js.split("\n"))
+    return "\n".join(line for line in lines if line and not line.startswith("//"))
+
+
+def minify_html(html):
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    html = re.sub(r"(<style[^>]*>)(.*?)(</style>)",
+                  lambda m: m.group(1) + minify_css(m.group(2)) + m.group(3), html, flags=re.S)
+    html = re.sub(r"(<script[^>]*>)(.*?)(</script>)",
+                  lambda m: m.group(1) + minify_js(m.group(2)) + m.group(3), html, flags=re.S)
+    html = re.sub(r">\s+<", "><", html)
+    return html.strip()
+
+
+def write_gzip(name, content):
+    path = os.path.join(DATA_DIR, name + ".gz")
+    data = gzip.compress(content, compresslevel=9, mtime=0)
+    with open(path, "wb") as f:
+        f.write(data)
+    print("%-16s %6d -> %6d bytes" % (name, len(content), len(data)))
+
+
+def build():
+    for name in sorted(os.listdir(SRC_DIR)):
+        with open(os.path.join(SRC_DIR, name), "rb") as f:
+            content = f.read()
+        if name.endswith(".html"):
+            content = minify_html(content.decode("utf-8")).encode("utf-8")
+        write_gzip(name, content)
+
+
+# PlatformIO extra script (pre:), or command line
+try:
+    Import("env")
+    env.AddPreAction("$BUILD_DIR/spiffs.bin", lambda *args, **kwargs: build())
+except NameError:
+    build()
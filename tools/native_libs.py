@@ -0,0 +1,11 @@
+"""
+System libraries of the native environment
+
+Appended to LIBS, so that they are passed to the linker after the objects
+(as -l options in build_flags, their place on the link line is up to the
+PlatformIO version), for both the program and `pio test -e native`.
+"""
+
+Import("env")
+
+env.Append(LIBS=["pthread", "z"])